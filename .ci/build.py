@@ -112,6 +112,10 @@ def test_linux():
     # Test logs
     builder.add(compiler=GCC, compiler_version="10", cppstd="20", options={"loglevel": "trace"})
 
+    # Test contention profiling
+    builder.add(compiler=GCC, compiler_version="10", cppstd="20", options={"contention_profiling": True})
+    builder.add(compiler=CLANG, compiler_version="10", cppstd="17", options={"contention_profiling": True})
+
     builder.run()
 
 
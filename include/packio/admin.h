@@ -0,0 +1,239 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_ADMIN_H
+#define PACKIO_ADMIN_H
+
+//! @file
+//! Function @ref packio::add_admin_procedures "add_admin_procedures"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "connection_stats.h"
+#include "handler.h"
+#include "internal/config.h"
+#include "internal/log.h"
+
+namespace packio {
+namespace internal {
+
+using admin_stats_type = std::vector<
+    std::tuple<std::string, std::map<std::string, uint64_t>>>;
+
+inline admin_stats_type to_admin_stats(
+    const std::vector<connection_stats>& stats)
+{
+    admin_stats_type result;
+    result.reserve(stats.size());
+    for (const auto& s : stats) {
+        result.emplace_back(
+            s.peer,
+            std::map<std::string, uint64_t>{
+                {"bytes_read", s.bytes_read},
+                {"bytes_written", s.bytes_written},
+                {"requests", s.requests},
+                {"in_progress", s.in_progress},
+                {"write_queue_bytes", s.write_queue_bytes},
+                {"average_latency_ns",
+                 static_cast<uint64_t>(s.average_latency.count())},
+                {"load", s.load()},
+                {"read_buffer_bytes", s.read_buffer_bytes},
+                {"pending_request_bytes", s.pending_request_bytes},
+                {"memory_usage", s.memory_usage()},
+            });
+    }
+    return result;
+}
+
+} // internal
+
+//! The default prefix of the administration procedures
+constexpr char kAdminPrefix[] = "packio.admin.";
+
+//! Add the administration procedures of a server to its dispatcher
+//!
+//! The procedures read and update the performance settings of the server
+//! at runtime, without redeploying it:
+//! - `get_settings()`: map of the current settings
+//! - `set_buffer_reserve_size(size)`: fixed size reserved by the
+//!   reception buffers, see @ref server::set_buffer_reserve_size
+//! - `set_adaptive_buffer_reserve_size(min_size, max_size)`: adaptive size
+//!   reserved by the reception buffers,
+//!   see @ref server::set_adaptive_buffer_reserve_size
+//! - `set_max_message_size(size)`: maximum size of a message received by
+//!   new sessions, see @ref server::set_max_message_size
+//! - `set_memory_budget_limit(limit)`: limit of the memory budget of the
+//!   server, see @ref server::set_memory_budget
+//! - `set_log_level(level)`: spdlog level name, with PACKIO_LOGGING only
+//! - `get_sessions_stats()`: counters of each session,
+//!   see @ref server::get_sessions_stats
+//! - `get_top_sessions(n)`: counters of the n sessions with the highest
+//!   load, see @ref server::get_top_sessions
+//!
+//! Session counters are reported as an array of [peer, counters] pairs.
+//!
+//! Buffer sizes apply to new sessions and to the running ones.
+//! The procedures are opt-in and anyone able to call them can change the
+//! behavior of the server, only add them on trusted endpoints.
+//! The procedures only keep a weak reference to the server.
+//! @param server The server to administrate
+//! @param prefix The prefix of the name of the procedures
+//! @return True if all the procedures have been added
+template <typename Server>
+bool add_admin_procedures(
+    const std::shared_ptr<Server>& server,
+    const std::string& prefix = kAdminPrefix)
+{
+    using completion_handler_type =
+        completion_handler<typename Server::rpc_type>;
+    using settings_type = std::map<std::string, uint64_t>;
+
+    auto dispatcher = server->dispatcher();
+    std::weak_ptr<Server> weak_server = server;
+    bool added = true;
+
+    added &= dispatcher->add_async(
+        prefix + "get_settings",
+        [weak_server](completion_handler_type handler) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            auto [min_size, max_size] = server->get_buffer_reserve_size();
+            settings_type settings{
+                {"buffer_reserve_min_size", min_size},
+                {"buffer_reserve_max_size", max_size},
+                {"max_message_size", server->get_max_message_size()},
+                {"sessions", server->get_session_count()},
+            };
+            if (const auto& budget = server->get_memory_budget()) {
+                settings["memory_budget_limit"] = budget->limit();
+                settings["memory_budget_used"] = budget->used();
+            }
+            handler(std::move(settings));
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "set_buffer_reserve_size",
+        [weak_server](completion_handler_type handler, uint64_t size) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            if (size == 0) {
+                handler.set_error("Invalid size");
+                return;
+            }
+            PACKIO_INFO("admin: buffer reserve size set to {}", size);
+            server->set_buffer_reserve_size(size);
+            handler();
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "set_adaptive_buffer_reserve_size",
+        [weak_server](
+            completion_handler_type handler,
+            uint64_t min_size,
+            uint64_t max_size) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            if (min_size == 0 || max_size < min_size) {
+                handler.set_error("Invalid size");
+                return;
+            }
+            PACKIO_INFO(
+                "admin: buffer reserve size set to [{}, {}]",
+                min_size,
+                max_size);
+            server->set_adaptive_buffer_reserve_size(min_size, max_size);
+            handler();
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "set_max_message_size",
+        [weak_server](completion_handler_type handler, uint64_t size) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            if (size == 0) {
+                handler.set_error("Invalid size");
+                return;
+            }
+            PACKIO_INFO("admin: max message size set to {}", size);
+            server->set_max_message_size(size);
+            handler();
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "set_memory_budget_limit",
+        [weak_server](completion_handler_type handler, uint64_t limit) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            const auto& budget = server->get_memory_budget();
+            if (!budget) {
+                handler.set_error("No memory budget");
+                return;
+            }
+            PACKIO_INFO("admin: memory budget limit set to {}", limit);
+            budget->set_limit(limit);
+            handler();
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "get_sessions_stats",
+        [weak_server](completion_handler_type handler) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            handler(internal::to_admin_stats(server->get_sessions_stats()));
+        });
+
+    added &= dispatcher->add_async(
+        prefix + "get_top_sessions",
+        [weak_server](completion_handler_type handler, uint64_t n) {
+            auto server = weak_server.lock();
+            if (!server) {
+                handler.set_error("Server closed");
+                return;
+            }
+            handler(internal::to_admin_stats(server->get_top_sessions(n)));
+        });
+
+#if defined(PACKIO_LOGGING)
+    added &= dispatcher->add_async(
+        prefix + "set_log_level",
+        [](completion_handler_type handler, std::string level) {
+            auto parsed = spdlog::level::from_str(level);
+            if (parsed == spdlog::level::off && level != "off") {
+                handler.set_error("Invalid level");
+                return;
+            }
+            spdlog::set_level(parsed);
+            handler();
+        });
+#endif // defined(PACKIO_LOGGING)
+
+    return added;
+}
+
+} // packio
+
+#endif // PACKIO_ADMIN_H
@@ -0,0 +1,49 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_BYTES_H
+#define PACKIO_BYTES_H
+
+//! @file
+//! Class @ref packio::bytes "bytes"
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace packio {
+
+//! Binary data, as argument or result of a procedure
+//!
+//! Serialized as a bin object by msgpack-RPC and as a base64 string
+//! by JSON-RPC.
+class bytes : public std::vector<uint8_t> {
+public:
+    using std::vector<uint8_t>::vector;
+
+    bytes() = default;
+
+    //! Take the data of a vector
+    explicit bytes(std::vector<uint8_t> data)
+        : std::vector<uint8_t>(std::move(data))
+    {
+    }
+
+    //! Copy the characters of a string
+    explicit bytes(std::string_view data)
+        : std::vector<uint8_t>(data.begin(), data.end())
+    {
+    }
+
+    //! View the data as characters
+    std::string_view str() const noexcept
+    {
+        return {reinterpret_cast<const char*>(data()), size()};
+    }
+};
+
+} // packio
+
+#endif // PACKIO_BYTES_H
@@ -8,19 +8,37 @@
 //! @file
 //! Class @ref packio::client "client"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <queue>
+#include <string>
 #include <string_view>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "compression.h"
+#include "connection_stats.h"
+#include "contention_profile.h"
+#include "internal/adaptive_reserve_size.h"
 #include "internal/config.h"
 #include "internal/manual_strand.h"
+#include "internal/memory_resource.h"
 #include "internal/movable_function.h"
 #include "internal/rpc.h"
+#include "internal/socket_timestamps.h"
 #include "internal/utils.h"
+#include "internal/waiter.h"
+#include "latency_histogram.h"
+#include "socket_tuning.h"
+#include "threading.h"
+#include "trace_context.h"
 #include "traits.h"
 
 namespace packio {
@@ -29,8 +47,14 @@ namespace packio {
 //! @tparam Rpc RPC protocol implementation
 //! @tparam Socket Socket type to use for this client
 //! @tparam Map Container used to associate call IDs and handlers
-template <typename Rpc, typename Socket, template <class...> class Map = default_map>
-class client : public std::enable_shared_from_this<client<Rpc, Socket, Map>> {
+//! @tparam Threading Threading policy, see @ref multi_threaded and @ref single_threaded
+template <
+    typename Rpc,
+    typename Socket,
+    template <class...> class Map = default_map,
+    typename Threading = default_threading>
+class client
+    : public std::enable_shared_from_this<client<Rpc, Socket, Map, Threading>> {
 public:
     //! The RPC protocol type
     using rpc_type = Rpc;
@@ -44,17 +68,38 @@ public:
     using protocol_type = typename socket_type::protocol_type;
     //! The executor type
     using executor_type = typename socket_type::executor_type;
-    using std::enable_shared_from_this<client<Rpc, Socket, Map>>::shared_from_this;
+    //! The threading policy
+    using threading_type = Threading;
+    using std::enable_shared_from_this<
+        client<Rpc, Socket, Map, Threading>>::shared_from_this;
 
     //! The default size reserved by the reception buffer
     static constexpr size_t kDefaultBufferReserveSize = 4096;
+    //! The default maximum size of a received message, unlimited
+    static constexpr size_t kDefaultMaxMessageSize =
+        std::numeric_limits<size_t>::max();
+
+    //! What @ref notify does when the notification batch is full
+    enum class batch_overflow {
+        drop, //!< The notification is dropped
+        block //!< The caller waits until the batch has been written
+    };
+
+    //! The default size from which a notification batch is written
+    static constexpr size_t kDefaultBatchFlushSize = 64 * 1024;
+    //! The default delay after which a notification batch is written
+    static constexpr std::chrono::microseconds kDefaultBatchDelay{500};
+    //! The default maximum size of the notifications waiting to be written
+    static constexpr size_t kDefaultBatchMaxSize = 16 * 1024 * 1024;
 
     //! The constructor
     //! @param socket The socket which the client will use. Can be connected or not
     explicit client(socket_type socket)
         : socket_{std::move(socket)},
           wstrand_{socket_.get_executor()},
-          call_strand_{socket_.get_executor()}
+          call_strand_{socket_.get_executor()},
+          batch_timer_{socket_.get_executor()},
+          peer_{internal::format_peer(socket_)}
     {
     }
 
@@ -64,29 +109,231 @@ public:
     //! Get the underlying socket, const
     const socket_type& socket() const noexcept { return socket_; }
 
+    //! Connect the socket of this client
+    //!
+    //! Unlike connecting the socket directly, the client knows the
+    //! connection is new, see @ref set_socket_tuning.
+    //! Must not be called while calls are in progress.
+    //! @param endpoint The endpoint to connect to
+    void connect(const typename protocol_type::endpoint& endpoint)
+    {
+        socket_.connect(endpoint);
+        connection_established();
+    }
+
+    //! Connect the socket of this client asynchronously, see @ref connect
+    //! @param endpoint The endpoint to connect to
+    //! @param handler Handler called once connected, with an error_code
+    template <
+        PACKIO_COMPLETION_TOKEN_FOR(void(error_code))
+            ConnectHandler PACKIO_DEFAULT_COMPLETION_TOKEN_TYPE(executor_type)>
+    auto async_connect(
+        const typename protocol_type::endpoint& endpoint,
+        ConnectHandler&& handler PACKIO_DEFAULT_COMPLETION_TOKEN(executor_type))
+    {
+        return net::async_initiate<ConnectHandler, void(error_code)>(
+            [self = shared_from_this(), endpoint](auto&& handler) mutable {
+                auto& socket = self->socket_;
+                socket.async_connect(
+                    endpoint,
+                    [self = std::move(self),
+                     handler = std::forward<decltype(handler)>(handler)](
+                        error_code ec) mutable {
+                        if (!ec) {
+                            self->connection_established();
+                        }
+                        handler(ec);
+                    });
+            },
+            handler);
+    }
+
     //! Set the size reserved by the reception buffer
+    //!
+    //! The size is fixed, this disables the adaptive sizing
+    //! set by @ref set_adaptive_buffer_reserve_size
     void set_buffer_reserve_size(std::size_t size) noexcept
     {
-        buffer_reserve_size_ = size;
+        buffer_reserve_size_.set_fixed(size);
     }
-    //! Get the size reserved by the reception buffer
+    //! Let the size reserved by the reception buffer adapt to the traffic
+    //!
+    //! The size grows when reads consistently fill the buffer and shrinks
+    //! after sustained small reads, staying between min_size and max_size
+    //! @param min_size The minimum size reserved
+    //! @param max_size The maximum size reserved
+    void set_adaptive_buffer_reserve_size(
+        std::size_t min_size,
+        std::size_t max_size) noexcept
+    {
+        buffer_reserve_size_.set_adaptive(min_size, max_size);
+    }
+    //! Get the size currently reserved by the reception buffer
     std::size_t get_buffer_reserve_size() const noexcept
     {
-        return buffer_reserve_size_;
+        return buffer_reserve_size_.get();
     }
 
+    //! Set the maximum size of a received message
+    //!
+    //! When a bigger message is received, pending calls are cancelled with
+    //! net::error::message_size and the connection is closed.
+    void set_max_message_size(std::size_t size) noexcept
+    {
+        max_message_size_ = size;
+    }
+    //! Get the maximum size of a received message
+    std::size_t get_max_message_size() const noexcept
+    {
+        return max_message_size_;
+    }
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    //! Set the memory resource used to allocate the asynchronous
+    //! operations of this client and the boxes owning its request buffers
+    //!
+    //! The buffers of the parser and of the serialized requests, and the
+    //! call handlers, which may be destroyed without being called, stay on
+    //! the default heap.
+    //! @param resource The memory resource, nullptr to use the default
+    //! allocators
+    void set_memory_resource(std::pmr::memory_resource* resource) noexcept
+    {
+        memory_resource_ = resource;
+    }
+    //! Get the memory resource used by this client
+    std::pmr::memory_resource* get_memory_resource() const noexcept
+    {
+        return memory_resource_;
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
     //! Get the executor associated with the object
     executor_type get_executor() { return socket().get_executor(); }
 
+    //! Compress the calls and notifications bigger than a threshold
+    //!
+    //! The client announces the codec to the server with its first message.
+    //! Messages are only compressed once the server answered that it
+    //! supports the same codec, see @ref server::set_compression, so this
+    //! can safely be enabled with servers not supporting compression.
+    //! Messages are compressed by the thread sending them, compressed
+    //! responses are decompressed on the executor of the client. A response
+    //! that cannot be decompressed fails all the pending calls with
+    //! net::error::connection_aborted and closes the connection.
+    //! Must be called before the first call.
+    //! @param codec The compression codec
+    //! @param threshold The size from which messages are compressed
+    void set_compression(
+        compression_codec codec,
+        std::size_t threshold = kDefaultCompressionThreshold)
+    {
+        compression_ = std::make_shared<const compression_codec>(
+            std::move(codec));
+        compression_threshold_ = threshold;
+    }
+
+    //! Set the size from which messages are queued in the bulk lane
+    //!
+    //! Messages in the bulk lane are written when no smaller message is
+    //! waiting, so that small calls are not blocked behind big ones, and
+    //! at least once every 16 smaller messages, so that they still progress
+    //! under a sustained traffic of small calls.
+    //! Messages are written in order by default.
+    //! Must be called before the first call.
+    void set_bulk_message_size(std::size_t size) noexcept
+    {
+        bulk_message_size_ = size;
+    }
+    //! Get the size from which messages are queued in the bulk lane
+    std::size_t get_bulk_message_size() const noexcept
+    {
+        return bulk_message_size_;
+    }
+
+    //! Write the messages of the bulk lane in fragments
+    //!
+    //! Smaller messages are written between the fragments. The server
+    //! must support fragments, which packio servers do since they were
+    //! introduced, see @ref set_bulk_message_size. An invalid fragment
+    //! received fails all the pending calls with
+    //! net::error::connection_aborted and closes the connection.
+    //! Must be called before the first call.
+    //! @param size The size of the fragments, 0 to disable
+    void set_fragment_size(std::size_t size) noexcept
+    {
+        fragment_size_ = size;
+    }
+    //! Get the size of the fragments of the bulk messages
+    std::size_t get_fragment_size() const noexcept { return fragment_size_; }
+
+    //! Set the socket options of this client
+    //!
+    //! The options are applied before the first write of each connection:
+    //! after @ref connect, after the client saw its connection close or
+    //! when the native handle of the socket changed. A socket reconnected
+    //! directly may get the handle of the previous connection, connect it
+    //! with @ref connect to have it tuned.
+    //! Must be called before the first call.
+    //! @param tuning The socket options, see @ref socket_tuning
+    void set_socket_tuning(const socket_tuning& tuning) noexcept
+    {
+        tuning_ = tuning;
+    }
+    //! Get the socket options of this client
+    const socket_tuning& get_socket_tuning() const noexcept { return tuning_; }
+
+    //! Measure where the time of the calls is spent
+    //!
+    //! Enables the software timestamps of the kernel on the socket, on
+    //! Linux TCP sockets, and fills the histograms returned by
+    //! @ref get_latency_breakdown.
+    //! Must be called once connected, before the first call.
+    //! @param enabled True to enable the timestamping
+    void set_socket_timestamping(bool enabled)
+    {
+        if (enabled && !timestamps_.enabled()) {
+            timestamps_.enable(socket_);
+        }
+        socket_timestamping_ = enabled;
+    }
+
+    //! Get the latency histograms of this client
+    //!
+    //! Empty unless @ref set_socket_timestamping is enabled.
+    //! Can be called from any thread.
+    latency_breakdown get_latency_breakdown() const
+    {
+        return timestamps_.get();
+    }
+
+    //! Get a snapshot of the counters of this client
+    //!
+    //! The counters are updated with relaxed atomics and may be slightly
+    //! inconsistent with each other. The peer is the one of the connection
+    //! at its first write, or when connected with @ref connect.
+    //! Can be called from any thread.
+    connection_stats get_stats() const
+    {
+        connection_stats stats;
+        {
+            std::unique_lock l{peer_mutex_};
+            stats.peer = peer_;
+        }
+        counters_.fill(stats);
+        stats.in_progress = in_progress_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
     //! Cancel a pending call
     //!
     //! The associated handler will be called with net::error::operation_aborted
     //! @param id The call ID of the call to cancel
     void cancel(id_type id)
     {
-        net::dispatch(call_strand_, [self = shared_from_this(), id] {
+        dispatch_to_call_strand([self = shared_from_this(), id] {
             auto ec = make_error_code(net::error::operation_aborted);
-            self->async_call_handler(id, ec, {});
+            self->call_handler(id, ec, {});
         });
     }
 
@@ -95,9 +342,8 @@ public:
     //! The associated handlers will be called with net::error::operation_aborted
     void cancel()
     {
-        net::dispatch(call_strand_, [self = shared_from_this()] {
-            self->cancel_all_calls();
-        });
+        dispatch_to_call_strand(
+            [self = shared_from_this()] { self->cancel_all_calls(); });
     }
 
     //! Send a notify request to the server with argument
@@ -138,6 +384,69 @@ public:
             name, std::tuple{}, std::forward<NotifyHandler>(handler));
     }
 
+    //! Configure the batches of notifications sent by @ref notify
+    //!
+    //! A batch is written once it reaches flush_size, or delay after its
+    //! first notification. Notifications of a batch are not compressed.
+    //! Must be called before the first notification.
+    //! @param flush_size The size from which a batch is written
+    //! @param delay The delay after which a batch is written
+    //! @param max_size The maximum size of the notifications waiting to be
+    //! written, in the batch or in the write queue
+    //! @param overflow What to do with a notification when max_size
+    //! is reached
+    void set_notification_batching(
+        std::size_t flush_size,
+        std::chrono::microseconds delay,
+        std::size_t max_size = kDefaultBatchMaxSize,
+        batch_overflow overflow = batch_overflow::drop) noexcept
+    {
+        batch_flush_size_ = flush_size;
+        batch_delay_ = delay;
+        batch_max_size_ = max_size;
+        batch_overflow_ = overflow;
+    }
+
+    //! Send a notify request to the server without completion handler
+    //!
+    //! The notification is serialized in the batch of the client, see
+    //! @ref set_notification_batching, which is cheaper than
+    //! @ref async_notify when sending many notifications.
+    //! With @ref batch_overflow::block, must not be called from a thread
+    //! running the executor of the client.
+    //! @param name Remote procedure name to call
+    //! @param args Tuple of arguments to pass to the remote procedure
+    //! @return False if the notification was dropped
+    template <
+        typename ArgsTuple,
+        typename = std::enable_if_t<internal::is_tuple_v<ArgsTuple>>>
+    bool notify(std::string_view name, ArgsTuple&& args)
+    {
+        PACKIO_TRACE("notify: {}", name);
+        const auto& trace = this_trace_context();
+        std::unique_lock l{batch_mutex_};
+        const std::size_t start = batch_.size();
+        try {
+            std::apply(
+                [&](auto&&... args) {
+                    rpc_type::append_notification(
+                        batch_,
+                        trace,
+                        name,
+                        std::forward<decltype(args)>(args)...);
+                },
+                std::forward<ArgsTuple>(args));
+        }
+        catch (...) {
+            batch_.resize(start);
+            throw;
+        }
+        return add_to_batch(l, start);
+    }
+
+    //! @overload
+    bool notify(std::string_view name) { return notify(name, std::tuple{}); }
+
     //! Call a remote procedure
     //!
     //! @param name Remote procedure name to call
@@ -178,23 +487,268 @@ public:
             name, std::tuple{}, std::forward<CallHandler>(handler), call_id);
     }
 
+    //! Call a remote procedure and wait for its response
+    //!
+    //! Meant for threads that don't run an executor: the calling thread
+    //! spins briefly, then sleeps until the response arrives. Unlike waiting
+    //! on a future, this does not allocate a shared state and the response
+    //! is handed over directly from the reading thread.
+    //! Must not be called from a thread running the executor of the client,
+    //! and requires a thread-safe client, see @ref multi_threaded.
+    //! @param name Remote procedure name to call
+    //! @param args Tuple of arguments to pass to the remote procedure
+    //! @param timeout Maximum duration of the call, it is cancelled after it
+    //! @param ec Set to net::error::timed_out on timeout, or to the error of
+    //! the call
+    //! @return The response, empty on error
+    template <
+        typename ArgsTuple,
+        typename Rep,
+        typename Period,
+        typename = std::enable_if_t<internal::is_tuple_v<ArgsTuple>>>
+    response_type call(
+        std::string_view name,
+        ArgsTuple&& args,
+        std::chrono::duration<Rep, Period> timeout,
+        error_code& ec)
+    {
+        const auto& waiter =
+            internal::this_thread_waiter<blocking_result_type>();
+        const auto deadline =
+            clock_type::now()
+            + std::chrono::duration_cast<clock_type::duration>(timeout);
+        const auto ticket = waiter->prepare();
+        id_type call_id{};
+        async_call(
+            name,
+            std::forward<ArgsTuple>(args),
+            blocking_call_handler{waiter, ticket},
+            std::ref(call_id));
+
+        auto result = waiter->wait_until(ticket, deadline);
+        if (!result) {
+            // the late completion is ignored by the waiter
+            cancel(call_id);
+            ec = make_error_code(net::error::timed_out);
+            return {};
+        }
+        ec = result->first;
+        return std::move(result->second);
+    }
+
+    //! @overload
+    template <typename Rep, typename Period>
+    response_type call(
+        std::string_view name,
+        std::chrono::duration<Rep, Period> timeout,
+        error_code& ec)
+    {
+        return call(name, std::tuple{}, timeout, ec);
+    }
+
+    //! Call a remote procedure once for each set of arguments,
+    //! in a single request
+    //!
+    //! The server runs the calls in parallel. The result of the call is an
+    //! array with one item per set of arguments, in the same order. With
+    //! msgpack-RPC, each item is an array [error, result], with JSON-RPC
+    //! each item is an object holding either "result" or "error".
+    //! Only synchronous procedures can be called this way.
+    //! @param name Remote procedure name to call
+    //! @param args Tuples of arguments to pass to the remote procedure
+    //! @param handler Handler called with the array of results
+    //! Must satisfy the @ref traits::CallHandler trait
+    //! @param call_id Output parameter that will receive the call ID
+    template <
+        PACKIO_COMPLETION_TOKEN_FOR(void(error_code, response_type))
+            CallHandler PACKIO_DEFAULT_COMPLETION_TOKEN_TYPE(executor_type),
+        typename ArgsTuple,
+        typename = std::enable_if_t<internal::is_tuple_v<ArgsTuple>>>
+    auto async_call_map(
+        std::string_view name,
+        std::vector<ArgsTuple> args,
+        CallHandler&& handler PACKIO_DEFAULT_COMPLETION_TOKEN(executor_type),
+        std::optional<std::reference_wrapper<id_type>> call_id = std::nullopt)
+    {
+        return async_call(
+            internal::map_method,
+            std::tuple<std::string_view, std::vector<ArgsTuple>>{
+                name, std::move(args)},
+            std::forward<CallHandler>(handler),
+            call_id);
+    }
+
 private:
     using parser_type = typename rpc_type::incremental_parser_type;
     using async_call_handler_type =
         internal::movable_function<void(error_code, response_type)>;
+    // each outstanding operation owns exactly one reference to the client,
+    // which is moved along the chain of handlers instead of being
+    // re-acquired with shared_from_this at each step
+    using client_ptr = std::shared_ptr<client>;
+    using clock_type = std::chrono::steady_clock;
+
+    struct pending_call {
+        async_call_handler_type handler;
+        clock_type::time_point sent;
+        // complete in place instead of posting the handler
+        bool in_place;
+    };
+
+    using blocking_result_type = std::pair<error_code, response_type>;
+
+    // only wakes up the waiting thread, cheap enough to run in place,
+    // shares the waiter which may complete after its thread exited
+    struct blocking_call_handler {
+        void operator()(error_code ec, response_type response)
+        {
+            waiter->complete(ticket, ec, std::move(response));
+        }
+
+        std::shared_ptr<internal::waiter<blocking_result_type>> waiter;
+        uint64_t ticket;
+    };
+
+    template <typename ArgsTuple>
+    static auto serialize_notification(std::string_view name, ArgsTuple&& args)
+    {
+        const auto& trace = this_trace_context();
+        return std::apply(
+            [&name, &trace](auto&&... args) {
+                if (trace.valid() && trace.sampled) {
+                    return rpc_type::serialize_traced_notification(
+                        trace, name, std::forward<decltype(args)>(args)...);
+                }
+                return rpc_type::serialize_notification(
+                    name, std::forward<decltype(args)>(args)...);
+            },
+            std::forward<ArgsTuple>(args));
+    }
+
+    // the notification has just been serialized at the end of the batch,
+    // from start, it is only moved out when it does not fit
+    bool add_to_batch(
+        std::unique_lock<typename threading_type::mutex_type>& l,
+        std::size_t start)
+    {
+        const std::size_t size = batch_.size() - start;
+        auto fits = [&](std::size_t batch_size) {
+            const std::size_t queued = batch_size + batch_writing_;
+            return queued == 0 || queued + size <= batch_max_size_;
+        };
+        bool first = start == 0;
+        if (!fits(start)) {
+            std::string message = batch_.substr(start);
+            batch_.resize(start);
+            if (batch_overflow_ == batch_overflow::drop) {
+                PACKIO_DEBUG("notification batch full, dropping");
+                return false;
+            }
+            batch_written_.wait(l, [&] { return fits(batch_.size()); });
+            first = batch_.empty();
+            batch_.append(message);
+        }
+
+        counters_.requests.fetch_add(1, std::memory_order_relaxed);
+        if (batch_.size() >= batch_flush_size_) {
+            flush_batch();
+        }
+        else if (first) {
+            // the timer is only used from call_strand_
+            dispatch_to_call_strand([self = shared_from_this()] {
+                self->batch_timer_.expires_after(self->batch_delay_);
+                self->batch_timer_.async_wait(net::bind_executor(
+                    self->call_strand_, [self](error_code ec) {
+                        if (ec) {
+                            return;
+                        }
+                        std::lock_guard l{self->batch_mutex_};
+                        self->flush_batch();
+                    }));
+            });
+        }
+        return true;
+    }
+
+    // only called with batch_mutex_ held, so that batches are queued
+    // in the order they were filled
+    void flush_batch()
+    {
+        if (batch_.empty()) {
+            return;
+        }
+        const std::size_t size = batch_.size();
+        batch_writing_ += size;
+        auto batch_ptr = internal::to_unique_ptr(
+            std::exchange(batch_, {}), memory_resource_);
+        async_write_buffer(
+            std::move(batch_ptr),
+            [self = shared_from_this(), size](error_code ec, std::size_t) {
+                if (ec) {
+                    PACKIO_WARN("write error: {}", ec.message());
+                }
+                {
+                    std::lock_guard l{self->batch_mutex_};
+                    self->batch_writing_ -= size;
+                }
+                self->batch_written_.notify_all();
+            },
+            shared_from_this());
+    }
+
+    // the socket options are applied again before the next write
+    void connection_established()
+    {
+        tuned_.store(false, std::memory_order_relaxed);
+        set_peer(internal::format_peer(socket_));
+    }
 
-    void cancel_all_calls()
+    void set_peer(std::string peer)
     {
-        assert(call_strand_.running_in_this_thread());
-        auto ec = make_error_code(net::error::operation_aborted);
+        std::unique_lock l{peer_mutex_};
+        peer_ = std::move(peer);
+    }
+
+    // fail all the pending calls and close the connection, used when the
+    // responses can no longer be read
+    void close_connection(error_code ec)
+    {
+        assert(internal::running_in_this_thread(call_strand_));
+        cancel_all_calls(ec);
+        tuned_.store(false, std::memory_order_relaxed);
+        error_code close_ec;
+        socket_.close(close_ec);
+        if (close_ec) {
+            PACKIO_WARN("close error: {}", close_ec.message());
+        }
+    }
+
+    void cancel_all_calls(
+        error_code ec = make_error_code(net::error::operation_aborted))
+    {
+        assert(internal::running_in_this_thread(call_strand_));
         while (!pending_.empty()) {
-            async_call_handler(pending_.begin()->first, ec, {});
+            call_handler(pending_.begin()->first, ec, {});
         }
     }
 
+    // the dispatches are profiled with PACKIO_CONTENTION_PROFILING
+    template <typename F>
+    void dispatch_to_call_strand(F&& f)
+    {
+#if defined(PACKIO_CONTENTION_PROFILING)
+        net::dispatch(
+            call_strand_,
+            internal::contention_recorders::get().call_strand.hop(
+                std::forward<F>(f)));
+#else // defined(PACKIO_CONTENTION_PROFILING)
+        net::dispatch(call_strand_, std::forward<F>(f));
+#endif // defined(PACKIO_CONTENTION_PROFILING)
+    }
+
     void maybe_stop_reading()
     {
-        assert(call_strand_.running_in_this_thread());
+        assert(internal::running_in_this_thread(call_strand_));
         if (reading_ && pending_.empty()) {
             PACKIO_DEBUG("stop reading");
             error_code ec;
@@ -205,114 +759,477 @@ private:
         }
     }
 
+    // compress where the message is produced, out of the I/O thread
+    template <typename Buffer, typename Send>
+    void send_maybe_compressed(Buffer&& buffer, Send&& send)
+    {
+        if (peer_compression_.load(std::memory_order_relaxed)) {
+            auto view = rpc_type::buffer(buffer);
+            auto frame = internal::compress_message(
+                {static_cast<const char*>(view.data()), view.size()},
+                *compression_,
+                compression_threshold_);
+            if (frame) {
+                send(internal::to_unique_ptr(
+                    std::move(*frame), memory_resource_));
+                return;
+            }
+        }
+        send(internal::to_unique_ptr(
+            std::forward<Buffer>(buffer), memory_resource_));
+    }
+
     template <typename Buffer, typename WriteHandler>
-    void async_send(std::unique_ptr<Buffer>&& buffer_ptr, WriteHandler&& handler)
-    {
-        wstrand_.push([self = shared_from_this(),
-                       buffer_ptr = std::move(buffer_ptr),
-                       handler = std::forward<WriteHandler>(handler)]() mutable {
-            internal::set_no_delay(self->socket_);
-
-            auto buf = rpc_type::buffer(*buffer_ptr);
-            net::async_write(
-                self->socket_,
-                buf,
-                [self,
-                 buffer_ptr = std::move(buffer_ptr),
-                 handler = std::forward<WriteHandler>(handler)](
-                    error_code ec, size_t length) mutable {
-                    self->wstrand_.next();
-                    handler(ec, length);
-                });
-        });
+    void async_send(
+        internal::resource_unique_ptr<Buffer>&& buffer_ptr,
+        WriteHandler&& handler,
+        client_ptr self)
+    {
+        if (compression_ && !announced_.exchange(true)) {
+            async_write_buffer(
+                internal::to_unique_ptr(
+                    internal::make_announcement_frame(compression_->id),
+                    memory_resource_),
+                [](error_code, std::size_t) {},
+                self);
+        }
+        counters_.requests.fetch_add(1, std::memory_order_relaxed);
+        async_write_buffer(
+            std::move(buffer_ptr),
+            std::forward<WriteHandler>(handler),
+            std::move(self));
+    }
+
+    // the write handler is called while the write operation still owns
+    // its reference, so it does not need to hold one
+    template <typename Buffer, typename WriteHandler>
+    void async_write_buffer(
+        internal::resource_unique_ptr<Buffer>&& buffer_ptr,
+        WriteHandler&& handler,
+        client_ptr self)
+    {
+        const std::size_t size = rpc_type::buffer(*buffer_ptr).size();
+        counters_.write_queue_bytes.fetch_add(size, std::memory_order_relaxed);
+
+        const bool bulk = size >= bulk_message_size_;
+        wstrand_.push(
+            [self = std::move(self),
+             buffer_ptr = std::move(buffer_ptr),
+             size,
+             handler = std::forward<WriteHandler>(handler)]() mutable {
+                const bool tuned = self->tuned_.exchange(
+                    true, std::memory_order_relaxed);
+                if (!tuned
+                    || self->socket_.native_handle() != self->tuned_handle_) {
+                    internal::apply_socket_tuning(self->socket_, self->tuning_);
+                    self->tuned_handle_ = self->socket_.native_handle();
+                    self->corked_ = false;
+                    self->set_peer(internal::format_peer(self->socket_));
+                }
+                auto* ptr = self.get();
+                ptr->write_buffer(
+                    std::move(buffer_ptr),
+                    size,
+                    0,
+                    std::move(handler),
+                    std::move(self));
+            },
+            bulk);
     }
 
-    void async_read(parser_type&& parser)
+    // size of the fragment starting at offset, 0 to write the whole message
+    std::size_t next_fragment_size(std::size_t size, std::size_t offset) const
     {
-        parser.reserve_buffer(buffer_reserve_size_);
+        if (fragment_size_ == 0 || size < bulk_message_size_
+            || size <= fragment_size_
+            || size > internal::kMaxFramePayloadSize) {
+            return 0;
+        }
+        return std::min(fragment_size_, size - offset);
+    }
+
+    // write the message, or its fragment starting at offset,
+    // only called from wstrand_
+    template <typename BufferPtr, typename WriteHandler>
+    void write_buffer(
+        BufferPtr&& buffer_ptr,
+        std::size_t size,
+        std::size_t offset,
+        WriteHandler&& handler,
+        client_ptr self)
+    {
+        auto buf = rpc_type::buffer(*buffer_ptr);
+        std::array<net::const_buffer, 2> buffers{buf, net::const_buffer{}};
+        const std::size_t fragment = next_fragment_size(size, offset);
+        if (fragment != 0) {
+            // a single write is in flight, it can use the member
+            fragment_header_ = internal::make_fragment_header(fragment, size);
+            buffers = {
+                net::buffer(fragment_header_),
+                net::buffer(buf + offset, fragment)};
+        }
+        offset = fragment != 0 ? offset + fragment : size;
+        if (timestamps_.enabled()) {
+            timestamps_.write_started(net::buffer_size(buffers));
+        }
+        // cork while more messages are queued, uncork with the last one
+        bool uncork = false;
+        if (tuning_.cork_batches) {
+            const bool more = offset < size || wstrand_.size() != 0;
+            if (more && !corked_) {
+                internal::set_cork(socket_, true);
+                corked_ = true;
+            }
+            uncork = corked_ && !more;
+        }
+
+        internal::initiate_with_resource(
+            memory_resource_,
+            [self = std::move(self),
+             buffer_ptr = std::forward<BufferPtr>(buffer_ptr),
+             size,
+             offset,
+             uncork,
+             handler = std::forward<WriteHandler>(handler)](
+                error_code ec, size_t length) mutable {
+                self->counters_.bytes_written.fetch_add(
+                    length, std::memory_order_relaxed);
+                if (self->timestamps_.enabled()) {
+                    self->timestamps_.collect_transmit_timestamps(
+                        self->socket_);
+                }
+                if (uncork) {
+                    internal::set_cork(self->socket_, false);
+                    self->corked_ = false;
+                }
+                if (!ec && offset < size) {
+                    // let the smaller messages through before the next
+                    // fragment
+                    auto& wstrand = self->wstrand_;
+                    wstrand.yield([self = std::move(self),
+                                   buffer_ptr = std::move(buffer_ptr),
+                                   size,
+                                   offset,
+                                   handler = std::move(handler)]() mutable {
+                        auto* ptr = self.get();
+                        ptr->write_buffer(
+                            std::move(buffer_ptr),
+                            size,
+                            offset,
+                            std::move(handler),
+                            std::move(self));
+                    });
+                    return;
+                }
+
+                self->wstrand_.next();
+                self->counters_.write_queue_bytes.fetch_sub(
+                    size, std::memory_order_relaxed);
+                handler(ec, length);
+            },
+            [&](auto&& handler) {
+                net::async_write(
+                    socket_, buffers, std::forward<decltype(handler)>(handler));
+            });
+    }
+
+    template <typename Buffer, typename CallHandler>
+    void async_send_call(
+        id_type call_id,
+        CallHandler&& handler,
+        internal::resource_unique_ptr<Buffer>&& packer_buf)
+    {
+        dispatch_to_call_strand(
+            [self = shared_from_this(),
+             call_id,
+             handler = std::forward<CallHandler>(handler),
+             packer_buf = std::move(packer_buf)]() mutable {
+                // we must emplace the id and handler before sending data
+                // otherwise we might drop a fast response
+                assert(internal::running_in_this_thread(self->call_strand_));
+                self->pending_.try_emplace(
+                    call_id,
+                    pending_call{
+                        std::move(handler),
+                        clock_type::now(),
+                        std::is_same_v<
+                            std::decay_t<CallHandler>,
+                            blocking_call_handler>});
+                self->in_progress_.fetch_add(1, std::memory_order_relaxed);
+
+                // if we are not reading, start the read operation
+                if (!self->reading_) {
+                    PACKIO_DEBUG("start reading");
+                    self->async_read(parser_type{self->max_message_size_}, self);
+                }
+
+                // send the request buffer
+                auto* ptr = self.get();
+                ptr->async_send(
+                    std::move(packer_buf),
+                    [ptr, call_id](error_code ec, std::size_t length) mutable {
+                        if (ec) {
+                            PACKIO_WARN("write error: {}", ec.message());
+                            ptr->dispatch_to_call_strand(
+                                [self = ptr->shared_from_this(),
+                                 call_id = std::move(call_id),
+                                 ec] { self->call_handler(call_id, ec, {}); });
+                        }
+                        else {
+                            PACKIO_TRACE("write: {}", length);
+                            (void)length;
+                        }
+                    },
+                    std::move(self));
+            });
+    }
+
+    void async_read(parser_type&& parser, client_ptr self)
+    {
+        parser.reserve_buffer(buffer_reserve_size_.get());
+        counters_.read_buffer_bytes.store(
+            parser.buffered_size() + parser.buffer_capacity(),
+            std::memory_order_relaxed);
         auto buffer = net::buffer(parser.buffer(), parser.buffer_capacity());
 
-        assert(call_strand_.running_in_this_thread());
+        assert(internal::running_in_this_thread(call_strand_));
         reading_ = true;
         PACKIO_TRACE("reading ... {} call(s) pending", pending_.size());
-        socket_.async_read_some(
-            buffer,
-            net::bind_executor(
-                call_strand_,
-                [self = shared_from_this(), parser = std::move(parser)](
-                    error_code ec, size_t length) mutable {
-                    // stop if there is an error or there is no more pending calls
-                    assert(self->call_strand_.running_in_this_thread());
-
-                    if (ec) {
-                        PACKIO_WARN("read error: {}", ec.message());
-                        self->reading_ = false;
-
-                        // cancel all pending calls
-                        self->cancel_all_calls();
+        internal::initiate_with_resource(
+            memory_resource_,
+            [self = std::move(self), parser = std::move(parser)](
+                error_code ec, size_t length) mutable {
+                // stop if there is an error or there is no more pending calls
+                assert(internal::running_in_this_thread(self->call_strand_));
+
+                if (ec) {
+                    self->reading_ = false;
+                    if (ec == net::error::operation_aborted
+                        && self->socket_.is_open()) {
+                        // stopped by maybe_stop_reading, calls may have
+                        // been made since then
+                        if (!self->pending_.empty()) {
+                            auto* ptr = self.get();
+                            ptr->async_read(std::move(parser), std::move(self));
+                        }
                         return;
                     }
 
-                    PACKIO_TRACE("read: {}", length);
-                    parser.buffer_consumed(length);
+                    PACKIO_WARN("read error: {}", ec.message());
+                    // tune the socket again if it is reconnected
+                    self->tuned_.store(false, std::memory_order_relaxed);
+                    // cancel all pending calls
+                    self->cancel_all_calls();
+                    return;
+                }
+
+                PACKIO_TRACE("read: {}", length);
+                self->buffer_reserve_size_.read_completed(length);
+                self->counters_.bytes_read.fetch_add(
+                    length, std::memory_order_relaxed);
+                parser.buffer_consumed(length);
+                if (self->socket_timestamping_) {
+                    self->read_at_ = clock_type::now();
+                }
 
-                    while (auto response = parser.get_response()) {
-                        if (!response) {
-                            PACKIO_ERROR("bad response");
-                            continue;
+                while (true) {
+                    if (auto frame = parser.get_compressed_frame()) {
+                        self->frame_received(std::move(*frame));
+                        if (!self->socket_.is_open()) {
+                            // closed on an invalid frame
+                            self->reading_ = false;
+                            return;
                         }
-                        self->async_call_handler(std::move(*response));
+                        continue;
                     }
-
-                    if (self->pending_.empty()) {
-                        PACKIO_TRACE("done reading, no more pending calls");
-                        self->reading_ = false;
-                        return;
+                    auto response = parser.get_response();
+                    if (!response) {
+                        break;
                     }
+                    self->call_handler(std::move(*response));
+                }
+
+                if (parser.message_size_exceeded()) {
+                    PACKIO_WARN(
+                        "message exceeds the maximum size: {}",
+                        self->max_message_size_);
+                    self->reading_ = false;
+                    self->close_connection(
+                        make_error_code(net::error::message_size));
+                    return;
+                }
+
+                if (self->pending_.empty()) {
+                    PACKIO_TRACE("done reading, no more pending calls");
+                    self->reading_ = false;
+                    return;
+                }
 
-                    self->async_read(std::move(parser));
-                }));
+                auto* ptr = self.get();
+                ptr->async_read(std::move(parser), std::move(self));
+            },
+            [&](auto&& handler) {
+                if (timestamps_.enabled()) {
+                    timestamps_.async_read_some(
+                        socket_,
+                        buffer,
+                        net::bind_executor(
+                            call_strand_,
+                            std::forward<decltype(handler)>(handler)));
+                    return;
+                }
+                socket_.async_read_some(
+                    buffer,
+                    net::bind_executor(
+                        call_strand_,
+                        std::forward<decltype(handler)>(handler)));
+            });
     }
 
-    void async_call_handler(response_type&& response)
+    void frame_received(std::string&& frame)
+    {
+        assert(internal::running_in_this_thread(call_strand_));
+        auto header = internal::parse_frame_header(frame);
+        if (header->codec == internal::kFragmentCodec) {
+            fragment_received(frame);
+            return;
+        }
+        if (!compression_ || header->codec != compression_->id) {
+            PACKIO_WARN("unsupported codec: {}", header->codec);
+            close_connection(make_error_code(net::error::connection_aborted));
+            return;
+        }
+        if (header->is_announcement()) {
+            PACKIO_DEBUG("compression enabled");
+            peer_compression_.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        // decompress out of the read loop
+        net::post(
+            socket_.get_executor(),
+            [self = shared_from_this(), frame = std::move(frame)]() {
+                auto message = internal::decompress_frame(
+                    frame, *self->compression_, self->max_message_size_);
+                std::optional<response_type> response;
+                if (message) {
+                    parser_type parser{self->max_message_size_};
+                    internal::feed_parser(parser, *message);
+                    response = parser.get_response();
+                }
+                if (!response) {
+                    PACKIO_ERROR("bad compressed response");
+                    self->dispatch_to_call_strand([self] {
+                        self->close_connection(
+                            make_error_code(net::error::connection_aborted));
+                    });
+                    return;
+                }
+                self->dispatch_to_call_strand(
+                    [self, response = std::move(*response)]() mutable {
+                        self->call_handler(std::move(response));
+                    });
+            });
+    }
+
+    void fragment_received(std::string_view frame)
+    {
+        assert(internal::running_in_this_thread(call_strand_));
+        using status = internal::fragment_assembler::status;
+        switch (fragments_.add(frame, max_message_size_)) {
+        case status::incomplete:
+            return;
+        case status::error:
+            PACKIO_ERROR("invalid fragment");
+            fragments_.take();
+            close_connection(make_error_code(net::error::connection_aborted));
+            return;
+        case status::complete:
+            break;
+        }
+
+        parser_type parser{max_message_size_};
+        internal::feed_parser(parser, fragments_.take());
+        if (auto message = parser.get_compressed_frame()) {
+            if (internal::parse_frame_header(*message)->codec
+                == internal::kFragmentCodec) {
+                PACKIO_ERROR("nested fragment");
+                close_connection(
+                    make_error_code(net::error::connection_aborted));
+                return;
+            }
+            frame_received(std::move(*message));
+            return;
+        }
+        auto response = parser.get_response();
+        if (!response) {
+            PACKIO_ERROR("bad fragmented response");
+            close_connection(make_error_code(net::error::connection_aborted));
+            return;
+        }
+        call_handler(std::move(*response));
+    }
+
+    void call_handler(response_type&& response)
     {
         auto id = response.id;
-        return async_call_handler(id, {}, std::move(response));
+        return call_handler(id, {}, std::move(response));
     }
 
-    void async_call_handler(id_type id, error_code ec, response_type&& response)
+    void call_handler(id_type id, error_code ec, response_type&& response)
     {
-        net::dispatch(
-            call_strand_,
-            [ec,
-             id,
-             self = shared_from_this(),
-             response = std::move(response)]() mutable {
-                PACKIO_DEBUG(
-                    "calling handler for id: {}", rpc_type::format_id(id));
+        assert(internal::running_in_this_thread(call_strand_));
+        PACKIO_DEBUG("calling handler for id: {}", rpc_type::format_id(id));
 
-                assert(call_strand_.running_in_this_thread());
-                auto it = self->pending_.find(id);
-                if (it == self->pending_.end()) {
-                    PACKIO_WARN("unexisting id: {}", rpc_type::format_id(id));
-                    return;
-                }
+        auto it = pending_.find(id);
+        if (it == pending_.end()) {
+            PACKIO_WARN("unexisting id: {}", rpc_type::format_id(id));
+            return;
+        }
 
-                auto handler = std::move(it->second);
-                self->pending_.erase(it);
-                self->maybe_stop_reading();
-
-                // handle the response asynchronously (post)
-                // to schedule the next read immediately
-                // this will allow parallel response handling
-                // in multi-threaded environments
-                net::post(
-                    self->socket_.get_executor(),
-                    [ec,
-                     handler = std::move(handler),
-                     response = std::move(response)]() mutable {
-                        handler(ec, std::move(response));
-                    });
+        auto handler = std::move(it->second.handler);
+        const bool in_place = it->second.in_place;
+        if (!ec) {
+            counters_.add_latency(clock_type::now() - it->second.sent);
+        }
+        pending_.erase(it);
+        in_progress_.fetch_sub(1, std::memory_order_relaxed);
+        maybe_stop_reading();
+
+        if (in_place) {
+            if (socket_timestamping_) {
+                timestamps_.read_to_dispatch.record(
+                    clock_type::now() - read_at_);
+            }
+            handler(ec, std::move(response));
+            return;
+        }
+
+        if (socket_timestamping_) {
+            net::post(
+                socket_.get_executor(),
+                [self = shared_from_this(),
+                 read_at = read_at_,
+                 ec,
+                 handler = std::move(handler),
+                 response = std::move(response)]() mutable {
+                    self->timestamps_.read_to_dispatch.record(
+                        clock_type::now() - read_at);
+                    handler(ec, std::move(response));
+                });
+            return;
+        }
+
+        // handle the response asynchronously (post)
+        // to schedule the next read immediately
+        // this will allow parallel response handling
+        // in multi-threaded environments
+        net::post(
+            socket_.get_executor(),
+            [ec,
+             handler = std::move(handler),
+             response = std::move(response)]() mutable {
+                handler(ec, std::move(response));
             });
     }
 
@@ -336,27 +1253,25 @@ private:
             PACKIO_STATIC_ASSERT_TRAIT(NotifyHandler);
             PACKIO_DEBUG("async_notify: {}", name);
 
-            auto packer_buf = internal::to_unique_ptr(std::apply(
-                [&name](auto&&... args) {
-                    return rpc_type::serialize_notification(
-                        name, std::forward<decltype(args)>(args)...);
-                },
-                std::forward<ArgsTuple>(args))
-
-            );
-            self_->async_send(
-                std::move(packer_buf),
-                [handler = std::forward<NotifyHandler>(handler)](
-                    error_code ec, std::size_t length) mutable {
-                    if (ec) {
-                        PACKIO_WARN("write error: {}", ec.message());
-                    }
-                    else {
-                        PACKIO_TRACE("write: {}", length);
-                        (void)length;
-                    }
+            auto buffer = serialize_notification(
+                name, std::forward<ArgsTuple>(args));
+            self_->send_maybe_compressed(
+                std::move(buffer), [&](auto&& packer_buf) {
+                    self_->async_send(
+                        std::move(packer_buf),
+                        [handler = std::forward<NotifyHandler>(handler)](
+                            error_code ec, std::size_t length) mutable {
+                            if (ec) {
+                                PACKIO_WARN("write error: {}", ec.message());
+                            }
+                            else {
+                                PACKIO_TRACE("write: {}", length);
+                                (void)length;
+                            }
 
-                    handler(ec);
+                            handler(ec);
+                        },
+                        self_->shared_from_this());
                 });
         }
 
@@ -390,44 +1305,28 @@ private:
                 opt_call_id->get() = call_id;
             }
 
-            auto packer_buf = internal::to_unique_ptr(std::apply(
-                [&name, &call_id](auto&&... args) {
+            // calls made while handling a sampled request carry its context
+            const auto& trace = this_trace_context();
+            auto buffer = std::apply(
+                [&name, &call_id, &trace](auto&&... args) {
+                    if (trace.valid() && trace.sampled) {
+                        return rpc_type::serialize_traced_request(
+                            trace,
+                            call_id,
+                            name,
+                            std::forward<decltype(args)>(args)...);
+                    }
                     return rpc_type::serialize_request(
                         call_id, name, std::forward<decltype(args)>(args)...);
                 },
-                std::forward<ArgsTuple>(args)));
-
-            net::dispatch(
-                self_->call_strand_,
-                [self = self_->shared_from_this(),
-                 call_id,
-                 handler = std::forward<CallHandler>(handler),
-                 packer_buf = std::move(packer_buf)]() mutable {
-                    // we must emplace the id and handler before sending data
-                    // otherwise we might drop a fast response
-                    assert(self->call_strand_.running_in_this_thread());
-                    self->pending_.try_emplace(call_id, std::move(handler));
-
-                    // if we are not reading, start the read operation
-                    if (!self->reading_) {
-                        PACKIO_DEBUG("start reading");
-                        self->async_read(parser_type{});
-                    }
+                std::forward<ArgsTuple>(args));
 
-                    // send the request buffer
-                    self->async_send(
-                        std::move(packer_buf),
-                        [self = std::move(self), call_id](
-                            error_code ec, std::size_t length) mutable {
-                            if (ec) {
-                                PACKIO_WARN("write error: {}", ec.message());
-                                self->async_call_handler(call_id, ec, {});
-                            }
-                            else {
-                                PACKIO_TRACE("write: {}", length);
-                                (void)length;
-                            }
-                        });
+            self_->send_maybe_compressed(
+                std::move(buffer), [&](auto&& packer_buf) {
+                    self_->async_send_call(
+                        call_id,
+                        std::forward<CallHandler>(handler),
+                        std::move(packer_buf));
                 });
         }
 
@@ -436,24 +1335,76 @@ private:
     };
 
     socket_type socket_;
-    std::size_t buffer_reserve_size_{kDefaultBufferReserveSize};
-    std::atomic<uint64_t> id_{0};
+    internal::adaptive_reserve_size buffer_reserve_size_{
+        kDefaultBufferReserveSize};
+    std::size_t max_message_size_{kDefaultMaxMessageSize};
+    typename threading_type::template atomic_type<uint64_t> id_{0};
+    internal::connection_counters<threading_type> counters_;
+    typename threading_type::template atomic_type<uint64_t> in_progress_{0};
+    internal::memory_resource* memory_resource_{nullptr};
 
-    internal::manual_strand<executor_type> wstrand_;
+    using strand_type =
+        typename threading_type::template strand_type<executor_type>;
+    internal::manual_strand<strand_type> wstrand_;
 
-    net::strand<executor_type> call_strand_;
-    Map<id_type, async_call_handler_type> pending_;
+    strand_type call_strand_;
+    Map<id_type, pending_call> pending_;
     bool reading_{false};
+
+    std::size_t bulk_message_size_{std::numeric_limits<std::size_t>::max()};
+    std::size_t fragment_size_{0};
+
+    typename threading_type::mutex_type batch_mutex_;
+    std::condition_variable_any batch_written_;
+    std::string batch_;
+    // size of the batches queued or being written
+    std::size_t batch_writing_{0};
+    std::size_t batch_flush_size_{kDefaultBatchFlushSize};
+    std::chrono::microseconds batch_delay_{kDefaultBatchDelay};
+    std::size_t batch_max_size_{kDefaultBatchMaxSize};
+    batch_overflow batch_overflow_{batch_overflow::drop};
+    net::steady_timer batch_timer_;
+    std::string fragment_header_;
+    internal::fragment_assembler fragments_;
+
+    socket_tuning tuning_;
+    // reset when the connection closes or is established
+    typename threading_type::template atomic_type<bool> tuned_{false};
+    // only used by the writer
+    typename socket_type::native_handle_type tuned_handle_{};
+    bool corked_{false};
+
+    // formatted once per connection, as reading the remote endpoint
+    // would race with the operations on the socket
+    std::string peer_;
+    mutable typename threading_type::mutex_type peer_mutex_;
+
+    bool socket_timestamping_{false};
+    internal::socket_timestamper<threading_type> timestamps_;
+    // time of the last read, only used from call_strand_
+    clock_type::time_point read_at_;
+
+    std::shared_ptr<const compression_codec> compression_;
+    std::size_t compression_threshold_{kDefaultCompressionThreshold};
+    typename threading_type::template atomic_type<bool> announced_{false};
+    // set once the server answered it supports our codec
+    typename threading_type::template atomic_type<bool> peer_compression_{
+        false};
 };
 
 //! Create a client from a socket
 //! @tparam Rpc RPC protocol implementation
 //! @tparam Socket Socket type to use for this client
 //! @tparam Map Container used to associate call IDs and handlers
-template <typename Rpc, typename Socket, template <class...> class Map = default_map>
+//! @tparam Threading Threading policy, see @ref multi_threaded and @ref single_threaded
+template <
+    typename Rpc,
+    typename Socket,
+    template <class...> class Map = default_map,
+    typename Threading = default_threading>
 auto make_client(Socket&& socket)
 {
-    return std::make_shared<client<Rpc, Socket, Map>>(
+    return std::make_shared<client<Rpc, Socket, Map, Threading>>(
         std::forward<Socket>(socket));
 }
 
@@ -0,0 +1,146 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_COMPRESSION_H
+#define PACKIO_COMPRESSION_H
+
+//! @file
+//! Struct @ref packio::compression_codec "compression_codec"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "internal/config.h"
+#include "internal/frame.h"
+
+#if PACKIO_HAS_ZLIB
+#include <zlib.h>
+#endif // PACKIO_HAS_ZLIB
+
+namespace packio {
+
+//! The default maximum ratio between the original and compressed sizes of
+//! a message, which is the highest ratio deflate can achieve
+constexpr std::size_t kDefaultMaxExpansion = 1032;
+
+//! A compression algorithm used for the messages
+//!
+//! See @ref server::set_compression and @ref client::set_compression.
+//! Both peers must use a codec with the same ID. The ID 1 is used by
+//! @ref zlib_codec, IDs 2 and 3 are reserved for LZ4 and zstd.
+struct compression_codec {
+    //! Identifier of the codec on the wire, must not be 0 nor 255
+    uint8_t id{0};
+    //! Compress a message, nullopt on failure
+    std::function<std::optional<std::string>(std::string_view)> compress;
+    //! Decompress a message, given its original size, nullopt on failure
+    std::function<std::optional<std::string>(std::string_view, std::size_t)>
+        decompress;
+    //! Maximum ratio between the original and compressed sizes of a message
+    //!
+    //! The original size is advertised by the peer, frames advertising a
+    //! higher ratio are rejected before allocating the decompressed message.
+    std::size_t max_expansion{kDefaultMaxExpansion};
+};
+
+//! The default size above which messages are compressed
+constexpr std::size_t kDefaultCompressionThreshold = 1024;
+
+#if PACKIO_HAS_ZLIB
+//! Identifier of @ref zlib_codec
+constexpr uint8_t kZlibCodecId = 1;
+
+//! Create a codec compressing the messages with zlib (deflate)
+//! @param level The compression level, favors speed by default
+inline compression_codec zlib_codec(int level = Z_BEST_SPEED)
+{
+    compression_codec codec;
+    codec.id = kZlibCodecId;
+    codec.compress =
+        [level](std::string_view data) -> std::optional<std::string> {
+        uLongf size = compressBound(static_cast<uLong>(data.size()));
+        std::string compressed(size, '\0');
+        int ret = compress2(
+            reinterpret_cast<Bytef*>(compressed.data()),
+            &size,
+            reinterpret_cast<const Bytef*>(data.data()),
+            static_cast<uLong>(data.size()),
+            level);
+        if (ret != Z_OK) {
+            return std::nullopt;
+        }
+        compressed.resize(size);
+        return compressed;
+    };
+    codec.decompress =
+        [](std::string_view data,
+           std::size_t original_size) -> std::optional<std::string> {
+        std::string decompressed(original_size, '\0');
+        uLongf size = static_cast<uLongf>(original_size);
+        int ret = uncompress(
+            reinterpret_cast<Bytef*>(decompressed.data()),
+            &size,
+            reinterpret_cast<const Bytef*>(data.data()),
+            static_cast<uLong>(data.size()));
+        if (ret != Z_OK || size != original_size) {
+            return std::nullopt;
+        }
+        return decompressed;
+    };
+    return codec;
+}
+#endif // PACKIO_HAS_ZLIB
+
+namespace internal {
+
+// frame holding the compressed message, nullopt when the message is too
+// small or does not compress well enough to be worth it
+inline std::optional<std::string> compress_message(
+    std::string_view message,
+    const compression_codec& codec,
+    std::size_t threshold)
+{
+    if (message.size() < threshold || message.size() > kMaxFramePayloadSize) {
+        return std::nullopt;
+    }
+    auto compressed = codec.compress(message);
+    if (!compressed || compressed->empty()
+        || compressed->size() + kFrameHeaderSize >= message.size()) {
+        return std::nullopt;
+    }
+    return make_frame(codec.id, *compressed, message.size());
+}
+
+// the original size advertised by the header is checked before decompressing
+inline std::optional<std::string> decompress_frame(
+    std::string_view frame,
+    const compression_codec& codec,
+    std::size_t max_message_size)
+{
+    auto header = parse_frame_header(frame);
+    if (!header || header->codec != codec.id
+        || frame.size() != header->frame_size()
+        || header->original_size > max_message_size) {
+        return std::nullopt;
+    }
+    // original_size > payload_size * max_expansion, without overflowing
+    const auto max_expansion = std::max<std::size_t>(codec.max_expansion, 1);
+    if (header->original_size > 0
+        && (header->original_size - 1) / max_expansion
+               >= header->payload_size) {
+        return std::nullopt;
+    }
+    return codec.decompress(
+        frame.substr(kFrameHeaderSize), header->original_size);
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_COMPRESSION_H
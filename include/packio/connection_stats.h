@@ -0,0 +1,120 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_CONNECTION_STATS_H
+#define PACKIO_CONNECTION_STATS_H
+
+//! @file
+//! Struct @ref packio::connection_stats "connection_stats"
+
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "internal/config.h"
+
+namespace packio {
+
+//! Snapshot of the counters of a connection
+//!
+//! See @ref server_session::get_stats and @ref client::get_stats.
+//! Counters are cumulative since the connection was created.
+struct connection_stats {
+    //! Weight of a request compared to a byte when computing the load
+    static constexpr uint64_t kRequestLoad = 1024;
+
+    std::string peer; //!< The remote endpoint, empty if unknown
+    uint64_t bytes_read{0}; //!< Bytes received
+    uint64_t bytes_written{0}; //!< Bytes sent
+    //! Requests received by a session, calls and notifications sent by a client
+    uint64_t requests{0};
+    //! Requests being handled by a session, calls waiting for their
+    //! response on a client
+    uint64_t in_progress{0};
+    uint64_t write_queue_bytes{0}; //!< Bytes waiting to be sent
+    //! Bytes held by the reception buffer, received or reserved
+    uint64_t read_buffer_bytes{0};
+    //! Estimated bytes held by the requests received and not completed yet
+    uint64_t pending_request_bytes{0};
+    //! Average time between receiving a request and sending its response
+    //! on a session, between sending a call and receiving its response on a
+    //! client
+    std::chrono::nanoseconds average_latency{0};
+
+    //! The load of the connection, bytes transferred and weighted requests
+    uint64_t load() const noexcept
+    {
+        return bytes_read + bytes_written + requests * kRequestLoad;
+    }
+
+    //! The memory held by the connection
+    uint64_t memory_usage() const noexcept
+    {
+        return write_queue_bytes + read_buffer_bytes + pending_request_bytes;
+    }
+};
+
+namespace internal {
+
+//! Counters of a connection, updated with relaxed atomics
+template <typename Threading>
+struct connection_counters {
+    template <typename T>
+    using atomic_type = typename Threading::template atomic_type<T>;
+
+    void add_latency(std::chrono::steady_clock::duration latency) noexcept
+    {
+        latency_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(latency)
+                .count(),
+            std::memory_order_relaxed);
+        latency_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void fill(connection_stats& stats) const noexcept
+    {
+        stats.bytes_read = bytes_read.load(std::memory_order_relaxed);
+        stats.bytes_written = bytes_written.load(std::memory_order_relaxed);
+        stats.requests = requests.load(std::memory_order_relaxed);
+        stats.write_queue_bytes = write_queue_bytes.load(
+            std::memory_order_relaxed);
+        stats.read_buffer_bytes = read_buffer_bytes.load(
+            std::memory_order_relaxed);
+        stats.pending_request_bytes = pending_request_bytes.load(
+            std::memory_order_relaxed);
+        uint64_t count = latency_count.load(std::memory_order_relaxed);
+        if (count != 0) {
+            stats.average_latency = std::chrono::nanoseconds{
+                latency_ns.load(std::memory_order_relaxed) / count};
+        }
+    }
+
+    atomic_type<uint64_t> bytes_read{0};
+    atomic_type<uint64_t> bytes_written{0};
+    atomic_type<uint64_t> requests{0};
+    atomic_type<uint64_t> write_queue_bytes{0};
+    atomic_type<uint64_t> read_buffer_bytes{0};
+    atomic_type<uint64_t> pending_request_bytes{0};
+    atomic_type<uint64_t> latency_ns{0};
+    atomic_type<uint64_t> latency_count{0};
+};
+
+template <typename Socket>
+std::string format_peer(const Socket& socket)
+{
+    error_code ec;
+    auto endpoint = socket.remote_endpoint(ec);
+    if (ec) {
+        return {};
+    }
+    std::ostringstream oss;
+    oss << endpoint;
+    return oss.str();
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_CONNECTION_STATS_H
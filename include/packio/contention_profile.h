@@ -0,0 +1,262 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_CONTENTION_PROFILE_H
+#define PACKIO_CONTENTION_PROFILE_H
+
+//! @file
+//! Struct @ref packio::contention_profile "contention_profile"
+//! and functions @ref packio::get_contention_profile "get_contention_profile"
+//! and @ref packio::reset_contention_profile "reset_contention_profile"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include "internal/config.h"
+#include "internal/utils.h"
+#include "latency_histogram.h"
+#include "threading.h"
+
+namespace packio {
+
+//! Contention of a type of lock
+struct lock_profile {
+    //! The number of acquisitions of the locks
+    uint64_t acquisitions{0};
+    //! The number of acquisitions that had to wait for another thread
+    uint64_t contended{0};
+    //! Time spent waiting for the locks, for the contended acquisitions
+    latency_histogram wait;
+    //! Time during which the locks were held
+    latency_histogram hold;
+};
+
+//! Contention of a type of strand
+struct strand_profile {
+    //! The number of functions dispatched to the strands
+    uint64_t dispatches{0};
+    //! The sum of the queue depths seen by the dispatches,
+    //! divide by @ref dispatches to get the mean depth
+    uint64_t total_depth{0};
+    //! The deepest queue seen by a dispatch
+    uint64_t max_depth{0};
+    //! Time from the dispatch of a function to its execution
+    latency_histogram wait;
+};
+
+//! Contention of the synchronization points of packio,
+//! aggregated over all the objects of a type
+//!
+//! Only recorded when PACKIO_CONTENTION_PROFILING is defined,
+//! the instrumentation is compiled out otherwise.
+struct contention_profile {
+    //! The mutex protecting the procedures of the dispatchers
+    lock_profile dispatcher_mutex;
+    //! The write queues of the clients and sessions,
+    //! depth is the number of messages queued
+    strand_profile write_strand;
+    //! The strands serializing the calls of the clients,
+    //! depth is the number of dispatches in flight
+    strand_profile call_strand;
+};
+
+namespace internal {
+
+class lock_recorder {
+public:
+    void acquired(std::chrono::nanoseconds wait, bool contended) noexcept
+    {
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            contended_.fetch_add(1, std::memory_order_relaxed);
+            wait_.record(wait);
+        }
+    }
+
+    void released(std::chrono::nanoseconds hold) noexcept
+    {
+        hold_.record(hold);
+    }
+
+    void fill(lock_profile& profile) const noexcept
+    {
+        profile.acquisitions = acquisitions_.load(std::memory_order_relaxed);
+        profile.contended = contended_.load(std::memory_order_relaxed);
+        wait_.fill(profile.wait);
+        hold_.fill(profile.hold);
+    }
+
+    void reset() noexcept
+    {
+        acquisitions_.store(0, std::memory_order_relaxed);
+        contended_.store(0, std::memory_order_relaxed);
+        wait_.reset();
+        hold_.reset();
+    }
+
+private:
+    std::atomic<uint64_t> acquisitions_{0};
+    std::atomic<uint64_t> contended_{0};
+    latency_recorder<multi_threaded> wait_;
+    latency_recorder<multi_threaded> hold_;
+};
+
+class strand_recorder {
+public:
+    void dispatched(uint64_t depth) noexcept
+    {
+        dispatches_.fetch_add(1, std::memory_order_relaxed);
+        total_depth_.fetch_add(depth, std::memory_order_relaxed);
+        auto max = max_depth_.load(std::memory_order_relaxed);
+        while (depth > max
+               && !max_depth_.compare_exchange_weak(
+                   max, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void executed(std::chrono::nanoseconds wait) noexcept
+    {
+        wait_.record(wait);
+    }
+
+    // wrap a function dispatched to the strand, the depth is the number
+    // of wrapped functions in flight
+    template <typename F>
+    auto hop(F&& f)
+    {
+        dispatched(in_flight_.fetch_add(1, std::memory_order_relaxed) + 1);
+        return [this,
+                start = std::chrono::steady_clock::now(),
+                f = std::forward<F>(f)]() mutable {
+            in_flight_.fetch_sub(1, std::memory_order_relaxed);
+            executed(std::chrono::steady_clock::now() - start);
+            f();
+        };
+    }
+
+    void fill(strand_profile& profile) const noexcept
+    {
+        profile.dispatches = dispatches_.load(std::memory_order_relaxed);
+        profile.total_depth = total_depth_.load(std::memory_order_relaxed);
+        profile.max_depth = max_depth_.load(std::memory_order_relaxed);
+        wait_.fill(profile.wait);
+    }
+
+    void reset() noexcept
+    {
+        dispatches_.store(0, std::memory_order_relaxed);
+        total_depth_.store(0, std::memory_order_relaxed);
+        max_depth_.store(0, std::memory_order_relaxed);
+        wait_.reset();
+    }
+
+private:
+    std::atomic<uint64_t> dispatches_{0};
+    std::atomic<uint64_t> total_depth_{0};
+    std::atomic<uint64_t> max_depth_{0};
+    std::atomic<uint64_t> in_flight_{0};
+    latency_recorder<multi_threaded> wait_;
+};
+
+struct contention_recorders {
+    lock_recorder dispatcher_mutex;
+    strand_recorder write_strand;
+    strand_recorder call_strand;
+
+    static contention_recorders& get() noexcept
+    {
+        static contention_recorders recorders;
+        return recorders;
+    }
+};
+
+//! Lockable recording the wait and hold times of another lock
+//!
+//! The wrapped lock only needs to be BasicLockable. Without try_lock,
+//! every acquisition is timed and counted as contended when the wait
+//! exceeds kContendedWait.
+template <typename Lockable>
+class profiled_mutex {
+public:
+    static constexpr std::chrono::nanoseconds kContendedWait{1000};
+
+    explicit profiled_mutex(lock_recorder& recorder) : recorder_{recorder} {}
+
+    void lock()
+    {
+        if constexpr (has_try_lock_v<Lockable>) {
+            if (mutex_.try_lock()) {
+                recorder_.acquired(std::chrono::nanoseconds{0}, false);
+            }
+            else {
+                const auto start = std::chrono::steady_clock::now();
+                mutex_.lock();
+                recorder_.acquired(
+                    std::chrono::steady_clock::now() - start, true);
+            }
+        }
+        else {
+            const auto start = std::chrono::steady_clock::now();
+            mutex_.lock();
+            const auto wait = std::chrono::steady_clock::now() - start;
+            recorder_.acquired(wait, wait > kContendedWait);
+        }
+        acquired_ = std::chrono::steady_clock::now();
+    }
+
+    template <typename L = Lockable>
+    std::enable_if_t<has_try_lock_v<L>, bool> try_lock()
+    {
+        if (!mutex_.try_lock()) {
+            return false;
+        }
+        recorder_.acquired(std::chrono::nanoseconds{0}, false);
+        acquired_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void unlock()
+    {
+        recorder_.released(std::chrono::steady_clock::now() - acquired_);
+        mutex_.unlock();
+    }
+
+private:
+    Lockable mutex_;
+    lock_recorder& recorder_;
+    // only accessed by the owner of the lock
+    std::chrono::steady_clock::time_point acquired_;
+};
+
+} // internal
+
+//! Get the contention recorded since the start of the program
+//! or the last call to @ref reset_contention_profile
+//!
+//! Empty unless PACKIO_CONTENTION_PROFILING is defined.
+//! Can be called from any thread.
+inline contention_profile get_contention_profile()
+{
+    const auto& recorders = internal::contention_recorders::get();
+    contention_profile profile;
+    recorders.dispatcher_mutex.fill(profile.dispatcher_mutex);
+    recorders.write_strand.fill(profile.write_strand);
+    recorders.call_strand.fill(profile.call_strand);
+    return profile;
+}
+
+//! Reset the contention recorded, to profile a phase of the program
+inline void reset_contention_profile()
+{
+    auto& recorders = internal::contention_recorders::get();
+    recorders.dispatcher_mutex.reset();
+    recorders.write_strand.reset();
+    recorders.call_strand.reset();
+}
+
+} // packio
+
+#endif // PACKIO_CONTENTION_PROFILE_H
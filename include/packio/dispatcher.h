@@ -8,18 +8,24 @@
 //! @file
 //! Class @ref packio::dispatcher "dispatcher"
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string_view>
+#include <thread>
 #include <tuple>
+#include <vector>
 
+#include "contention_profile.h"
 #include "handler.h"
 #include "internal/config.h"
 #include "internal/movable_function.h"
 #include "internal/rpc.h"
 #include "internal/utils.h"
+#include "trace_context.h"
 #include "traits.h"
 
 namespace packio {
@@ -28,6 +34,9 @@ namespace packio {
 //! @tparam Rpc RPC protocol implementation
 //! @tparam Map The container used to associate procedures to their name
 //! @tparam Lockable The lockable used to protect accesses to the procedure map
+//!
+//! The name "rpc.map" is reserved to the map calls, see
+//! @ref client::async_call_map, procedures cannot be added under it.
 template <typename Rpc, template <class...> class Map = default_map, typename Lockable = default_mutex>
 class dispatcher {
 public:
@@ -42,11 +51,31 @@ public:
         void(completion_handler<rpc_type>, args_type&& args)>;
     //! A shared pointer to @ref function_type
     using function_ptr_type = std::shared_ptr<function_type>;
+    //! The type of function used to run the tasks of a map call
+    using task_poster_type =
+        std::function<void(internal::movable_function<void()>)>;
+    //! The type of function applying a procedure to a list of arguments
+    using map_function_type = internal::movable_function<void(
+        completion_handler<rpc_type>,
+        std::vector<args_type>&& items,
+        const task_poster_type& post)>;
+    //! A shared pointer to @ref map_function_type
+    using map_function_ptr_type = std::shared_ptr<map_function_type>;
+
+    //! Number of tasks per CPU a map call is split into
+    static constexpr std::size_t kMapTasksPerThread = 4;
+
+    class procedure_set;
 
     //! Add a synchronous procedure to the dispatcher
+    //!
+    //! Synchronous procedures can also be applied to a list of arguments
+    //! in a single call, see @ref client::async_call_map
     //! @param name The name of the procedure
     //! @param arguments_names The name of the arguments (optional)
     //! @param fct The procedure itself
+    //! @return True if the procedure was added, false if the name is
+    //! already used or reserved
     template <
         typename SyncProcedure,
         std::size_t N = internal::func_traits<SyncProcedure>::args_count>
@@ -56,13 +85,13 @@ public:
         SyncProcedure&& fct)
     {
         PACKIO_STATIC_ASSERT_TRAIT(SyncProcedure);
+        if (is_reserved(name)) {
+            return false;
+        }
+        auto proc = make_sync(
+            std::forward<SyncProcedure>(fct), arguments_names);
         std::unique_lock lock{map_mutex_};
-        return function_map_
-            .emplace(
-                name,
-                std::make_shared<function_type>(wrap_sync(
-                    std::forward<SyncProcedure>(fct), arguments_names)))
-            .second;
+        return function_map_.emplace(name, std::move(proc)).second;
     }
 
     //! @overload
@@ -85,13 +114,13 @@ public:
         AsyncProcedure&& fct)
     {
         PACKIO_STATIC_ASSERT_TTRAIT(AsyncProcedure, rpc_type);
+        if (is_reserved(name)) {
+            return false;
+        }
+        auto proc = make_async(
+            std::forward<AsyncProcedure>(fct), arguments_names);
         std::unique_lock lock{map_mutex_};
-        return function_map_
-            .emplace(
-                name,
-                std::make_shared<function_type>(wrap_async(
-                    std::forward<AsyncProcedure>(fct), arguments_names)))
-            .second;
+        return function_map_.emplace(name, std::move(proc)).second;
     }
 
     //! @overload
@@ -119,13 +148,14 @@ public:
         CoroProcedure&& coro)
     {
         PACKIO_STATIC_ASSERT_TRAIT(CoroProcedure);
+        if (is_reserved(name)) {
+            return false;
+        }
+        procedure proc;
+        proc.function = std::make_shared<function_type>(wrap_coro(
+            executor, std::forward<CoroProcedure>(coro), arguments_names));
         std::unique_lock lock{map_mutex_};
-        return function_map_
-            .emplace(
-                name,
-                std::make_shared<function_type>(wrap_coro(
-                    executor, std::forward<CoroProcedure>(coro), arguments_names)))
-            .second;
+        return function_map_.emplace(name, std::move(proc)).second;
     }
 
     //! @overload
@@ -163,6 +193,68 @@ public:
     }
 #endif // defined(PACKIO_HAS_CO_AWAIT)
 
+    //! Add a synchronous procedure created on its first use
+    //!
+    //! The factory is called once, outside of the lock of the dispatcher,
+    //! when the procedure is first called, and returns the procedure.
+    //! Registering a large number of procedures this way defers their
+    //! construction to the ones actually used.
+    //! @param name The name of the procedure
+    //! @param arguments_names The name of the arguments (optional)
+    //! @param factory Function returning a
+    //! @ref traits::SyncProcedure "SyncProcedure"
+    template <
+        typename Factory,
+        std::size_t N =
+            internal::func_traits<std::invoke_result_t<Factory>>::args_count>
+    bool add_lazy(
+        std::string_view name,
+        const std::array<std::string, N>& arguments_names,
+        Factory&& factory)
+    {
+        using SyncProcedure = std::invoke_result_t<Factory>;
+        PACKIO_STATIC_ASSERT_TRAIT(SyncProcedure);
+        if (is_reserved(name)) {
+            return false;
+        }
+        auto proc = make_lazy(std::forward<Factory>(factory), arguments_names);
+        std::unique_lock lock{map_mutex_};
+        return function_map_.emplace(name, std::move(proc)).second;
+    }
+
+    //! @overload
+    template <typename Factory>
+    bool add_lazy(std::string_view name, Factory&& factory)
+    {
+        return add_lazy<Factory, 0>(name, {}, std::forward<Factory>(factory));
+    }
+
+    //! Add a set of procedures at once
+    //!
+    //! The set is built without locking the dispatcher, then published
+    //! under a single lock. When the dispatcher is empty, the map built
+    //! by the set replaces its map as is.
+    //! Procedures with a name already registered are not added.
+    //! @param set The procedures to add
+    //! @return The number of procedures added
+    std::size_t add_bulk(procedure_set&& set)
+    {
+        std::unique_lock lock{map_mutex_};
+        if (function_map_.empty()) {
+            function_map_.swap(set.map_);
+            return function_map_.size();
+        }
+
+        std::size_t added = 0;
+        for (auto& [name, proc] : set.map_) {
+            if (function_map_.emplace(name, std::move(proc)).second) {
+                ++added;
+            }
+        }
+        set.map_.clear();
+        return added;
+    }
+
     //! Remove a procedure from the dispatcher
     //! @param name The name of the procedure to remove
     //! @return True if the procedure was removed, False if it was not found
@@ -210,18 +302,123 @@ public:
 
     function_ptr_type get(const std::string& name) const
     {
-        std::unique_lock lock{map_mutex_};
-        auto it = function_map_.find(name);
-        if (it == function_map_.end()) {
-            return {};
+        return find(name, &procedure::function);
+    }
+
+    //! Get the function applying a procedure to a list of arguments
+    //! @param name The name of the procedure
+    //! @return The function, null if the procedure is unknown
+    //! or is not synchronous
+    map_function_ptr_type get_map(const std::string& name) const
+    {
+        auto sync = find(name, &procedure::sync);
+        return sync ? sync->map_function() : nullptr;
+    }
+
+private:
+    struct lazy_procedure;
+    struct sync_source;
+
+    struct procedure {
+        function_ptr_type function;
+        // set for the synchronous procedures, which can be mapped
+        std::shared_ptr<sync_source> sync;
+        // set instead of the functions until the procedure is created
+        std::shared_ptr<lazy_procedure> lazy;
+    };
+
+    struct lazy_procedure {
+        const procedure& resolve()
+        {
+            std::call_once(once, [this] {
+                resolved = factory();
+                factory = nullptr;
+            });
+            return resolved;
         }
-        else {
-            return it->second;
+
+        std::once_flag once;
+        internal::movable_function<procedure()> factory;
+        procedure resolved;
+    };
+
+    struct sync_source {
+        virtual ~sync_source() = default;
+        virtual map_function_ptr_type map_function() = 0;
+    };
+
+    // a synchronous procedure and its function, the map function is only
+    // built by the first map call using the procedure
+    template <typename F, std::size_t N>
+    struct sync_procedure
+        : sync_source,
+          std::enable_shared_from_this<sync_procedure<F, N>> {
+        template <typename T>
+        sync_procedure(T&& fct, const std::array<std::string, N>& args_names)
+            : fct{std::forward<T>(fct)},
+              args_names{args_names},
+              function{wrap_sync(&this->fct, args_names)}
+        {
+        }
+
+        map_function_ptr_type map_function() override
+        {
+            auto self = this->shared_from_this();
+            std::call_once(map_once, [&] {
+                // weak to not own itself, a map call holds the procedure
+                map.emplace(wrap_map(
+                    std::weak_ptr<F>{std::shared_ptr<F>{self, &fct}},
+                    args_names));
+            });
+            return {std::move(self), &*map};
+        }
+
+        F fct;
+        const std::array<std::string, N> args_names;
+        function_type function;
+        std::once_flag map_once;
+        std::optional<map_function_type> map;
+    };
+
+    // state of a map call, shared by its tasks
+    template <typename Args, typename Item>
+    struct map_call {
+        map_call(completion_handler<rpc_type>&& handler, std::size_t size)
+            : handler{std::move(handler)}, args(size), results(size)
+        {
+        }
+
+        completion_handler<rpc_type> handler;
+        std::vector<std::optional<Args>> args;
+        std::vector<Item> results;
+        std::atomic<std::size_t> remaining_tasks{0};
+    };
+
+    using function_map_type = Map<std::string, procedure>;
+
+    template <typename Ptr>
+    Ptr find(const std::string& name, Ptr procedure::*member) const
+    {
+        std::shared_ptr<lazy_procedure> lazy;
+        {
+            std::unique_lock lock{map_mutex_};
+            auto it = function_map_.find(name);
+            if (it == function_map_.end()) {
+                return {};
+            }
+            if (!it->second.lazy) {
+                return it->second.*member;
+            }
+            lazy = it->second.lazy;
         }
+        // the factory may be slow, don't block the other lookups
+        return lazy->resolve().*member;
     }
 
-private:
-    using function_map_type = Map<std::string, function_ptr_type>;
+    static bool is_reserved(std::string_view name)
+    {
+        return name == internal::map_method;
+    }
 
     template <typename TArgs, std::size_t NNamedArgs>
     static void static_assert_arguments_name_and_count()
@@ -232,7 +429,47 @@ private:
     }
 
     template <typename F, std::size_t N>
-    auto wrap_sync(F&& fct, const std::array<std::string, N>& args_names)
+    static procedure make_sync(
+        F&& fct,
+        const std::array<std::string, N>& args_names)
+    {
+        auto sync = std::make_shared<sync_procedure<std::decay_t<F>, N>>(
+            std::forward<F>(fct), args_names);
+        procedure proc;
+        proc.function = function_ptr_type{sync, &sync->function};
+        proc.sync = std::move(sync);
+        return proc;
+    }
+
+    template <typename F, std::size_t N>
+    static procedure make_async(
+        F&& fct,
+        const std::array<std::string, N>& args_names)
+    {
+        procedure proc;
+        proc.function = std::make_shared<function_type>(
+            wrap_async(std::forward<F>(fct), args_names));
+        return proc;
+    }
+
+    template <typename Factory, std::size_t N>
+    static procedure make_lazy(
+        Factory&& factory,
+        const std::array<std::string, N>& args_names)
+    {
+        procedure proc;
+        proc.lazy = std::make_shared<lazy_procedure>();
+        proc.lazy->factory = [factory = std::forward<Factory>(factory),
+                              args_names]() mutable {
+            return make_sync(factory(), args_names);
+        };
+        return proc;
+    }
+
+    template <typename F, std::size_t N>
+    static auto wrap_sync(
+        F* fct,
+        const std::array<std::string, N>& args_names)
     {
         using value_args =
             internal::decay_tuple_t<typename internal::func_traits<F>::args_type>;
@@ -240,7 +477,7 @@ private:
         static_assert_arguments_name_and_count<value_args, N>();
 
         return
-            [fct = std::forward<F>(fct), args_names](
+            [fct, args_names](
                 completion_handler<rpc_type> handler, args_type&& args) mutable {
                 auto typed_args = rpc_type::template extract_args<value_args>(
                     std::move(args), args_names);
@@ -251,17 +488,94 @@ private:
                 }
 
                 if constexpr (std::is_void_v<result_type>) {
-                    std::apply(fct, std::move(*typed_args));
+                    std::apply(*fct, std::move(*typed_args));
                     handler();
                 }
                 else {
-                    handler(std::apply(fct, std::move(*typed_args)));
+                    handler(std::apply(*fct, std::move(*typed_args)));
                 }
             };
     }
 
+    // the items are converted when the map function is called, as they may
+    // reference the request, then processed in chunks by parallel tasks;
+    // the last task to complete sends the results
     template <typename F, std::size_t N>
-    auto wrap_async(F&& fct, const std::array<std::string, N>& args_names)
+    static auto wrap_map(
+        std::weak_ptr<F> weak_fct,
+        const std::array<std::string, N>& args_names)
+    {
+        using value_args =
+            internal::decay_tuple_t<typename internal::func_traits<F>::args_type>;
+        using result_type = typename internal::func_traits<F>::result_type;
+        using item_type = internal::map_item<std::conditional_t<
+            std::is_void_v<result_type>,
+            std::nullptr_t,
+            result_type>>;
+        using map_call_type = map_call<value_args, item_type>;
+        static_assert_arguments_name_and_count<value_args, N>();
+
+        return [weak_fct = std::move(weak_fct), args_names](
+                   completion_handler<rpc_type> handler,
+                   std::vector<args_type>&& items,
+                   const task_poster_type& post) mutable {
+            if (items.empty()) {
+                handler(std::vector<item_type>{});
+                return;
+            }
+
+            auto fct = weak_fct.lock();
+            auto call = std::make_shared<map_call_type>(
+                std::move(handler), items.size());
+            for (std::size_t i = 0; i < items.size(); ++i) {
+                call->args[i] = rpc_type::template extract_args<value_args>(
+                    std::move(items[i]), args_names);
+            }
+
+            const std::size_t n_tasks = std::min(
+                items.size(),
+                kMapTasksPerThread
+                    * std::max(1u, std::thread::hardware_concurrency()));
+            const std::size_t chunk_size = (items.size() + n_tasks - 1)
+                                           / n_tasks;
+            call->remaining_tasks = (items.size() + chunk_size - 1)
+                                    / chunk_size;
+
+            for (std::size_t begin = 0; begin < items.size();
+                 begin += chunk_size) {
+                std::size_t end = std::min(begin + chunk_size, items.size());
+                post([fct, call, begin, end]() {
+                    for (std::size_t i = begin; i < end; ++i) {
+                        auto& typed_args = call->args[i];
+                        auto& result = call->results[i];
+                        if (!typed_args) {
+                            PACKIO_DEBUG("incompatible arguments");
+                            result.error = "Incompatible arguments";
+                        }
+                        else if constexpr (std::is_void_v<result_type>) {
+                            std::apply(*fct, std::move(*typed_args));
+                            result.value = nullptr;
+                        }
+                        else {
+                            result.value = std::apply(
+                                *fct, std::move(*typed_args));
+                        }
+                    }
+
+                    if (call->remaining_tasks.fetch_sub(
+                            1, std::memory_order_acq_rel)
+                        == 1) {
+                        call->handler(std::move(call->results));
+                    }
+                });
+            }
+        };
+    }
+
+    template <typename F, std::size_t N>
+    static auto wrap_async(
+        F&& fct,
+        const std::array<std::string, N>& args_names)
     {
         using args = typename internal::func_traits<F>::args_type;
         using value_args = internal::decay_tuple_t<internal::shift_tuple_t<args>>;
@@ -311,32 +625,162 @@ private:
                 return;
             }
 
-            net::co_spawn(
-                executor,
-                [typed_args = std::move(*typed_args),
-                 handler = std::move(handler),
-                 coro = std::forward<C>(coro)]() mutable -> net::awaitable<void> {
-                    if constexpr (std::is_void_v<result_type>) {
-                        co_await std::apply(coro, std::move(typed_args));
-                        handler();
-                    }
-                    else {
-                        handler(co_await std::apply(coro, std::move(typed_args)));
-                    }
-                },
-                [](std::exception_ptr exc) {
-                    if (exc) {
-                        std::rethrow_exception(exc);
-                    }
-                });
+            auto body = [typed_args = std::move(*typed_args),
+                         handler = std::move(handler),
+                         coro = std::forward<C>(coro)]() mutable
+                -> net::awaitable<void> {
+                if constexpr (std::is_void_v<result_type>) {
+                    co_await std::apply(coro, std::move(typed_args));
+                    handler();
+                }
+                else {
+                    handler(co_await std::apply(coro, std::move(typed_args)));
+                }
+            };
+            auto rethrow = [](std::exception_ptr exc) {
+                if (exc) {
+                    std::rethrow_exception(exc);
+                }
+            };
+
+            // the trace context must follow the coroutine across its
+            // suspensions, so its executor installs it each time it resumes
+            const auto& trace = this_trace_context();
+            if (trace.valid()) {
+                net::co_spawn(
+                    internal::traced_executor<E>{executor, trace},
+                    std::move(body),
+                    rethrow);
+            }
+            else {
+                net::co_spawn(executor, std::move(body), rethrow);
+            }
         };
     }
 #endif // defined(PACKIO_HAS_CO_AWAIT)
 
+#if defined(PACKIO_CONTENTION_PROFILING)
+    mutable internal::profiled_mutex<mutex_type> map_mutex_{
+        internal::contention_recorders::get().dispatcher_mutex};
+#else // defined(PACKIO_CONTENTION_PROFILING)
     mutable mutex_type map_mutex_;
+#endif // defined(PACKIO_CONTENTION_PROFILING)
     function_map_type function_map_;
 };
 
+//! A set of procedures built without locking the dispatcher,
+//! see @ref dispatcher::add_bulk
+template <typename Rpc, template <class...> class Map, typename Lockable>
+class dispatcher<Rpc, Map, Lockable>::procedure_set {
+public:
+    //! The constructor
+    //! @param size_hint The expected number of procedures, used to size
+    //! the procedure map up front when it supports it
+    explicit procedure_set(std::size_t size_hint = 0)
+    {
+        if constexpr (internal::has_reserve_v<function_map_type>) {
+            map_.reserve(size_hint);
+        }
+        else {
+            (void)size_hint;
+        }
+    }
+
+    //! Add a synchronous procedure to the set, see @ref dispatcher::add
+    template <
+        typename SyncProcedure,
+        std::size_t N = internal::func_traits<SyncProcedure>::args_count>
+    bool add(
+        std::string_view name,
+        const std::array<std::string, N>& arguments_names,
+        SyncProcedure&& fct)
+    {
+        PACKIO_STATIC_ASSERT_TRAIT(SyncProcedure);
+        if (is_reserved(name)) {
+            return false;
+        }
+        return map_
+            .emplace(
+                name,
+                make_sync(std::forward<SyncProcedure>(fct), arguments_names))
+            .second;
+    }
+
+    //! @overload
+    template <typename SyncProcedure>
+    bool add(std::string_view name, SyncProcedure&& fct)
+    {
+        return add<SyncProcedure, 0>(name, {}, std::forward<SyncProcedure>(fct));
+    }
+
+    //! Add an asynchronous procedure to the set,
+    //! see @ref dispatcher::add_async
+    template <
+        typename AsyncProcedure,
+        std::size_t N = internal::func_traits<AsyncProcedure>::args_count - 1>
+    bool add_async(
+        std::string_view name,
+        const std::array<std::string, N>& arguments_names,
+        AsyncProcedure&& fct)
+    {
+        PACKIO_STATIC_ASSERT_TTRAIT(AsyncProcedure, rpc_type);
+        if (is_reserved(name)) {
+            return false;
+        }
+        return map_
+            .emplace(
+                name,
+                make_async(std::forward<AsyncProcedure>(fct), arguments_names))
+            .second;
+    }
+
+    //! @overload
+    template <typename AsyncProcedure>
+    bool add_async(std::string_view name, AsyncProcedure&& fct)
+    {
+        return add_async<AsyncProcedure, 0>(
+            name, {}, std::forward<AsyncProcedure>(fct));
+    }
+
+    //! Add a synchronous procedure created on its first use to the set,
+    //! see @ref dispatcher::add_lazy
+    template <
+        typename Factory,
+        std::size_t N =
+            internal::func_traits<std::invoke_result_t<Factory>>::args_count>
+    bool add_lazy(
+        std::string_view name,
+        const std::array<std::string, N>& arguments_names,
+        Factory&& factory)
+    {
+        using SyncProcedure = std::invoke_result_t<Factory>;
+        PACKIO_STATIC_ASSERT_TRAIT(SyncProcedure);
+        if (is_reserved(name)) {
+            return false;
+        }
+        return map_
+            .emplace(
+                name,
+                make_lazy(std::forward<Factory>(factory), arguments_names))
+            .second;
+    }
+
+    //! @overload
+    template <typename Factory>
+    bool add_lazy(std::string_view name, Factory&& factory)
+    {
+        return add_lazy<Factory, 0>(name, {}, std::forward<Factory>(factory));
+    }
+
+    //! Get the number of procedures in the set
+    std::size_t size() const { return map_.size(); }
+
+private:
+    friend class dispatcher;
+
+    function_map_type map_;
+};
+
 } // packio
 
 #endif // PACKIO_DISPATCHER_H
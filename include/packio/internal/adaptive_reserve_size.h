@@ -0,0 +1,102 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_ADAPTIVE_RESERVE_SIZE_H
+#define PACKIO_ADAPTIVE_RESERVE_SIZE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+namespace packio {
+namespace internal {
+
+//! Size reserved by a reception buffer, adapted to the observed reads
+//!
+//! The size doubles when consecutive reads fill the buffer and halves
+//! after a sustained series of small reads, staying within [min, max].
+//! With min == max the size is fixed. The bounds can be changed while
+//! reads complete, the counters are only updated by the reader.
+class adaptive_reserve_size {
+public:
+    //! Number of consecutive full reads before growing
+    static constexpr unsigned kGrowAfter = 2;
+    //! Number of consecutive small reads before shrinking
+    static constexpr unsigned kShrinkAfter = 16;
+
+    explicit adaptive_reserve_size(std::size_t size) noexcept
+        : size_{size}, min_{size}, max_{size}
+    {
+    }
+
+    std::size_t get() const noexcept
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+    std::size_t min() const noexcept
+    {
+        return min_.load(std::memory_order_relaxed);
+    }
+    std::size_t max() const noexcept
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    void set_fixed(std::size_t size) noexcept { set_adaptive(size, size); }
+
+    void set_adaptive(std::size_t min, std::size_t max) noexcept
+    {
+        max = std::max(min, max);
+        min_.store(min, std::memory_order_relaxed);
+        max_.store(max, std::memory_order_relaxed);
+        set(std::clamp(get(), min, max));
+    }
+
+    //! Update the size after a read of length bytes
+    void read_completed(std::size_t length) noexcept
+    {
+        const std::size_t min = this->min();
+        const std::size_t max = this->max();
+        if (min == max) {
+            return;
+        }
+
+        const std::size_t size = std::clamp(get(), min, max);
+        if (length >= size) {
+            small_reads_ = 0;
+            if (++full_reads_ >= kGrowAfter) {
+                full_reads_ = 0;
+                set(size > max / 2 ? max : size * 2);
+            }
+        }
+        else if (length <= size / 4) {
+            full_reads_ = 0;
+            if (++small_reads_ >= kShrinkAfter) {
+                small_reads_ = 0;
+                set(std::max(size / 2, min));
+            }
+        }
+        else {
+            full_reads_ = 0;
+            small_reads_ = 0;
+        }
+    }
+
+private:
+    void set(std::size_t size) noexcept
+    {
+        size_.store(size, std::memory_order_relaxed);
+    }
+
+    std::atomic<std::size_t> size_;
+    std::atomic<std::size_t> min_;
+    std::atomic<std::size_t> max_;
+    unsigned full_reads_{0};
+    unsigned small_reads_{0};
+};
+
+} // internal
+} // packio
+
+#endif // PACKIO_ADAPTIVE_RESERVE_SIZE_H
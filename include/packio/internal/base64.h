@@ -0,0 +1,368 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_BASE64_H
+#define PACKIO_BASE64_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#if defined(__AVX2__)
+#define PACKIO_BASE64_AVX2 1
+#include <immintrin.h>
+#endif // defined(__AVX2__)
+
+#if defined(__SSSE3__) || defined(__AVX__) || defined(__AVX2__)
+#define PACKIO_BASE64_SSSE3 1
+#include <tmmintrin.h>
+#endif // defined(__SSSE3__) || defined(__AVX__) || ...
+
+namespace packio {
+namespace internal {
+
+// Standard base64 with padding (RFC 4648). The vectorized paths encode
+// 12 or 24 bytes and decode 16 or 32 characters at a time with byte
+// shuffles, following "Faster Base64 Encoding and Decoding Using AVX2
+// Instructions" by W. Muła and D. Lemire. The tails and the padding are
+// handled by the scalar code.
+
+constexpr char kBase64Alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct base64_decode_table {
+    // value of each character, -1 if it is not part of the alphabet
+    std::array<int8_t, 256> values{};
+
+    constexpr base64_decode_table()
+    {
+        for (auto& value : values) {
+            value = -1;
+        }
+        for (int i = 0; i < 64; ++i) {
+            values[static_cast<unsigned char>(kBase64Alphabet[i])] =
+                static_cast<int8_t>(i);
+        }
+    }
+};
+
+inline constexpr base64_decode_table kBase64Decode{};
+
+constexpr std::size_t base64_encoded_size(std::size_t size) noexcept
+{
+    return (size + 2) / 3 * 4;
+}
+
+// size of the data encoded in a base64 string,
+// nullopt if the string cannot be base64
+inline std::optional<std::size_t> base64_decoded_size(
+    std::string_view encoded) noexcept
+{
+    if (encoded.size() % 4 != 0) {
+        return std::nullopt;
+    }
+    std::size_t size = encoded.size() / 4 * 3;
+    if (!encoded.empty() && encoded.back() == '=') {
+        --size;
+        if (encoded[encoded.size() - 2] == '=') {
+            --size;
+        }
+    }
+    return size;
+}
+
+inline void base64_encode_scalar(
+    const uint8_t* in,
+    std::size_t size,
+    char* out) noexcept
+{
+    std::size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        const uint32_t triple = (uint32_t{in[i]} << 16)
+                                | (uint32_t{in[i + 1]} << 8) | in[i + 2];
+        *out++ = kBase64Alphabet[triple >> 18];
+        *out++ = kBase64Alphabet[(triple >> 12) & 0x3f];
+        *out++ = kBase64Alphabet[(triple >> 6) & 0x3f];
+        *out++ = kBase64Alphabet[triple & 0x3f];
+    }
+    if (i == size) {
+        return;
+    }
+    uint32_t triple = uint32_t{in[i]} << 16;
+    if (i + 2 == size) {
+        triple |= uint32_t{in[i + 1]} << 8;
+    }
+    *out++ = kBase64Alphabet[triple >> 18];
+    *out++ = kBase64Alphabet[(triple >> 12) & 0x3f];
+    *out++ = i + 2 == size ? kBase64Alphabet[(triple >> 6) & 0x3f] : '=';
+    *out++ = '=';
+}
+
+// decode groups of 4 characters, the last one may be padded
+inline bool base64_decode_scalar(
+    const char* in,
+    std::size_t size,
+    uint8_t* out) noexcept
+{
+    const auto value = [](char c) -> int {
+        return kBase64Decode.values[static_cast<unsigned char>(c)];
+    };
+    for (std::size_t i = 0; i < size; i += 4) {
+        const int a = value(in[i]);
+        const int b = value(in[i + 1]);
+        int c = value(in[i + 2]);
+        int d = value(in[i + 3]);
+        std::size_t bytes = 3;
+        if (i + 4 == size && in[i + 3] == '=') {
+            d = 0;
+            bytes = 2;
+            if (in[i + 2] == '=') {
+                c = 0;
+                bytes = 1;
+            }
+        }
+        if ((a | b | c | d) < 0) {
+            return false;
+        }
+        const auto triple =
+            static_cast<uint32_t>((a << 18) | (b << 12) | (c << 6) | d);
+        out[0] = static_cast<uint8_t>(triple >> 16);
+        if (bytes > 1) {
+            out[1] = static_cast<uint8_t>(triple >> 8);
+        }
+        if (bytes > 2) {
+            out[2] = static_cast<uint8_t>(triple);
+        }
+        out += bytes;
+    }
+    return true;
+}
+
+#if defined(PACKIO_BASE64_SSSE3)
+// each 32 bits lane gets the bytes [b1, b0, b2, b1] of 3 input bytes
+alignas(16) inline constexpr int8_t kBase64Spread[16] =
+    {1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10};
+// offset from an index to its character, by range of indices:
+// 0 for a-z, 1-10 for 0-9, 11 for +, 12 for / and 13 for A-Z
+alignas(16) inline constexpr int8_t kBase64EncodeOffsets[16] = {
+    'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+    '/' - 63, 'A',      0,        0};
+// a character is valid when the classes of its low and high nibbles
+// have no bit in common
+alignas(16) inline constexpr int8_t kBase64LowClasses[16] = {
+    0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a};
+alignas(16) inline constexpr int8_t kBase64HighClasses[16] = {
+    0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10};
+// offset from a character to its index, by high nibble,
+// / is moved to the slot 1
+alignas(16) inline constexpr int8_t kBase64DecodeOffsets[16] =
+    {0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0};
+// the 3 bytes of each 32 bits lane, in order, in the 12 low bytes
+alignas(16) inline constexpr int8_t kBase64Pack[16] =
+    {2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1};
+
+inline __m128i base64_table(const int8_t* table) noexcept
+{
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(table));
+}
+
+// spread the 12 low bytes as 16 indices of 6 bits
+inline __m128i base64_split(__m128i in) noexcept
+{
+    in = _mm_shuffle_epi8(in, base64_table(kBase64Spread));
+    const __m128i ac = _mm_mulhi_epu16(
+        _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+        _mm_set1_epi32(0x04000040));
+    const __m128i bd = _mm_mullo_epi16(
+        _mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+        _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(ac, bd);
+}
+
+// characters of 16 indices of 6 bits
+inline __m128i base64_lookup(__m128i indices) noexcept
+{
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    return _mm_add_epi8(
+        indices,
+        _mm_shuffle_epi8(base64_table(kBase64EncodeOffsets), range));
+}
+
+// decode 16 characters into the 12 low bytes, false if one is invalid
+inline bool base64_decode_block(__m128i in, __m128i& out) noexcept
+{
+    const __m128i hi_nibbles =
+        _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+    const __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+    const __m128i classes = _mm_and_si128(
+        _mm_shuffle_epi8(base64_table(kBase64LowClasses), lo_nibbles),
+        _mm_shuffle_epi8(base64_table(kBase64HighClasses), hi_nibbles));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(classes, _mm_setzero_si128()))
+        != 0xffff) {
+        return false;
+    }
+
+    const __m128i slashes = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+    const __m128i indices = _mm_add_epi8(
+        in,
+        _mm_shuffle_epi8(
+            base64_table(kBase64DecodeOffsets),
+            _mm_add_epi8(slashes, hi_nibbles)));
+    // merge the 4 indices of each 32 bits lane into 24 bits
+    const __m128i merged = _mm_madd_epi16(
+        _mm_maddubs_epi16(indices, _mm_set1_epi32(0x01400140)),
+        _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(merged, base64_table(kBase64Pack));
+    return true;
+}
+#endif // defined(PACKIO_BASE64_SSSE3)
+
+#if defined(PACKIO_BASE64_AVX2)
+// the 256 bits versions work on each lane like the 128 bits ones
+inline __m256i base64_table256(const int8_t* table) noexcept
+{
+    return _mm256_broadcastsi128_si256(base64_table(table));
+}
+
+inline __m256i base64_split(__m256i in) noexcept
+{
+    in = _mm256_shuffle_epi8(in, base64_table256(kBase64Spread));
+    const __m256i ac = _mm256_mulhi_epu16(
+        _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+        _mm256_set1_epi32(0x04000040));
+    const __m256i bd = _mm256_mullo_epi16(
+        _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+        _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(ac, bd);
+}
+
+inline __m256i base64_lookup(__m256i indices) noexcept
+{
+    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(
+        range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    return _mm256_add_epi8(
+        indices,
+        _mm256_shuffle_epi8(base64_table256(kBase64EncodeOffsets), range));
+}
+
+inline bool base64_decode_block(__m256i in, __m256i& out) noexcept
+{
+    const __m256i hi_nibbles =
+        _mm256_and_si256(_mm256_srli_epi32(in, 4), _mm256_set1_epi8(0x0f));
+    const __m256i lo_nibbles = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+    const __m256i classes = _mm256_and_si256(
+        _mm256_shuffle_epi8(base64_table256(kBase64LowClasses), lo_nibbles),
+        _mm256_shuffle_epi8(base64_table256(kBase64HighClasses), hi_nibbles));
+    if (static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(classes, _mm256_setzero_si256())))
+        != 0xffffffff) {
+        return false;
+    }
+
+    const __m256i slashes = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+    const __m256i indices = _mm256_add_epi8(
+        in,
+        _mm256_shuffle_epi8(
+            base64_table256(kBase64DecodeOffsets),
+            _mm256_add_epi8(slashes, hi_nibbles)));
+    const __m256i merged = _mm256_madd_epi16(
+        _mm256_maddubs_epi16(indices, _mm256_set1_epi32(0x01400140)),
+        _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(merged, base64_table256(kBase64Pack));
+    return true;
+}
+#endif // defined(PACKIO_BASE64_AVX2)
+
+// encode the data into base64_encoded_size(size) characters
+inline void base64_encode(
+    const uint8_t* in,
+    std::size_t size,
+    char* out) noexcept
+{
+    const uint8_t* const last = in + size;
+#if defined(PACKIO_BASE64_AVX2)
+    // the lanes are loaded separately, each one reads 16 bytes for 12
+    while (last - in >= 28) {
+        const __m256i block = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)),
+            1);
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(out),
+            base64_lookup(base64_split(block)));
+        in += 24;
+        out += 32;
+    }
+#endif // defined(PACKIO_BASE64_AVX2)
+#if defined(PACKIO_BASE64_SSSE3)
+    while (last - in >= 16) {
+        const __m128i block =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out),
+            base64_lookup(base64_split(block)));
+        in += 12;
+        out += 16;
+    }
+#endif // defined(PACKIO_BASE64_SSSE3)
+    base64_encode_scalar(in, static_cast<std::size_t>(last - in), out);
+}
+
+// decode a string into *base64_decoded_size(encoded) bytes,
+// false if it is not valid base64
+inline bool base64_decode(std::string_view encoded, uint8_t* out) noexcept
+{
+    if (encoded.size() % 4 != 0) {
+        return false;
+    }
+    const char* in = encoded.data();
+    const char* const last = in + encoded.size();
+#if defined(PACKIO_BASE64_AVX2)
+    // the lanes are stored separately, each one writes 16 bytes for 12,
+    // the 8 characters left give the 4 bytes written ahead
+    while (last - in >= 40) {
+        __m256i block;
+        if (!base64_decode_block(
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in)),
+                block)) {
+            return false;
+        }
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(block));
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + 12),
+            _mm256_extracti128_si256(block, 1));
+        in += 32;
+        out += 24;
+    }
+#endif // defined(PACKIO_BASE64_AVX2)
+#if defined(PACKIO_BASE64_SSSE3)
+    while (last - in >= 24) {
+        __m128i block;
+        if (!base64_decode_block(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), block)) {
+            return false;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+        in += 16;
+        out += 12;
+    }
+#endif // defined(PACKIO_BASE64_SSSE3)
+    return base64_decode_scalar(in, static_cast<std::size_t>(last - in), out);
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_BASE64_H
@@ -15,6 +15,7 @@
 
 #define PACKIO_HAS_MSGPACK __has_include(<msgpack.hpp>)
 #define PACKIO_HAS_NLOHMANN_JSON __has_include(<nlohmann/json.hpp>)
+#define PACKIO_HAS_ZLIB __has_include(<zlib.h>)
 
 namespace packio {
 
@@ -40,6 +41,10 @@ using error_category = boost::system::error_category;
 #define PACKIO_HAS_LOCAL_SOCKETS 1
 #endif
 
+#if __has_include(<memory_resource>) || defined(PACKIO_DOCUMENTATION)
+#define PACKIO_HAS_MEMORY_RESOURCE 1
+#endif
+
 #if defined(BOOST_ASIO_DEFAULT_COMPLETION_TOKEN)
 #define PACKIO_DEFAULT_COMPLETION_TOKEN(e) \
     BOOST_ASIO_DEFAULT_COMPLETION_TOKEN(e)
@@ -0,0 +1,169 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_FRAME_H
+#define PACKIO_FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace packio {
+namespace internal {
+
+// compressed messages are sent in frames starting with a byte that can't
+// start a msgpack or a JSON message, so they can be told apart from plain
+// messages at message boundaries:
+// [0xc1, codec, payload size (u32 BE), original size (u32 BE), payload]
+// a frame without payload announces that the sender supports the codec
+// frames with the fragment codec carry a piece of a bigger message, the
+// original size being the size of the whole message. The fragments of a
+// message are consecutive, other messages can be sent between them
+constexpr unsigned char kFrameMarker = 0xc1;
+constexpr uint8_t kFragmentCodec = 0xff;
+constexpr std::size_t kFrameHeaderSize = 10;
+constexpr std::size_t kMaxFramePayloadSize =
+    std::numeric_limits<uint32_t>::max();
+
+struct frame_header {
+    uint8_t codec;
+    std::size_t payload_size;
+    std::size_t original_size;
+
+    std::size_t frame_size() const noexcept
+    {
+        return kFrameHeaderSize + payload_size;
+    }
+    bool is_announcement() const noexcept { return payload_size == 0; }
+};
+
+inline bool is_frame_start(char c) noexcept
+{
+    return static_cast<unsigned char>(c) == kFrameMarker;
+}
+
+inline uint32_t read_frame_size(const char* data) noexcept
+{
+    uint32_t size = 0;
+    for (int i = 0; i < 4; ++i) {
+        size = (size << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return size;
+}
+
+inline void write_frame_size(std::string& frame, std::size_t size)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        frame.push_back(static_cast<char>((size >> shift) & 0xff));
+    }
+}
+
+// nullopt until the whole header is available
+inline std::optional<frame_header> parse_frame_header(
+    const char* data,
+    std::size_t size) noexcept
+{
+    if (size < kFrameHeaderSize) {
+        return std::nullopt;
+    }
+    return frame_header{
+        static_cast<uint8_t>(data[1]),
+        read_frame_size(data + 2),
+        read_frame_size(data + 6)};
+}
+
+inline std::optional<frame_header> parse_frame_header(
+    std::string_view frame) noexcept
+{
+    return parse_frame_header(frame.data(), frame.size());
+}
+
+inline std::string make_frame(
+    uint8_t codec,
+    std::string_view payload,
+    std::size_t original_size)
+{
+    std::string frame;
+    frame.reserve(kFrameHeaderSize + payload.size());
+    frame.push_back(static_cast<char>(kFrameMarker));
+    frame.push_back(static_cast<char>(codec));
+    write_frame_size(frame, payload.size());
+    write_frame_size(frame, original_size);
+    frame.append(payload);
+    return frame;
+}
+
+inline std::string make_announcement_frame(uint8_t codec)
+{
+    return make_frame(codec, {}, 0);
+}
+
+// the fragment follows the header in the same write
+inline std::string make_fragment_header(
+    std::size_t fragment_size,
+    std::size_t message_size)
+{
+    std::string header;
+    header.push_back(static_cast<char>(kFrameMarker));
+    header.push_back(static_cast<char>(kFragmentCodec));
+    write_frame_size(header, fragment_size);
+    write_frame_size(header, message_size);
+    return header;
+}
+
+// reassemble the messages sent in fragments
+class fragment_assembler {
+public:
+    enum class status { incomplete, complete, error };
+
+    // add the fragment held by the frame, the message can be taken
+    // once complete. The message grows with the fragments received, the
+    // size advertised by the peer is only trusted as a bound
+    status add(std::string_view frame, std::size_t max_message_size)
+    {
+        auto header = parse_frame_header(frame);
+        if (!header || header->codec != kFragmentCodec
+            || header->is_announcement()
+            || header->original_size > max_message_size
+            || (!message_.empty() && header->original_size != original_size_)
+            || message_.size() + header->payload_size > header->original_size) {
+            return status::error;
+        }
+        original_size_ = header->original_size;
+        message_.append(frame.substr(kFrameHeaderSize));
+        return message_.size() == original_size_ ? status::complete
+                                                 : status::incomplete;
+    }
+
+    std::string take() noexcept
+    {
+        original_size_ = 0;
+        return std::exchange(message_, {});
+    }
+
+    // bytes allocated for the message being assembled
+    std::size_t capacity() const noexcept { return message_.capacity(); }
+
+private:
+    std::string message_;
+    std::size_t original_size_{0};
+};
+
+// feed a whole message to a parser
+template <typename Parser>
+void feed_parser(Parser& parser, std::string_view message)
+{
+    parser.reserve_buffer(message.size());
+    message.copy(parser.buffer(), message.size());
+    parser.buffer_consumed(message.size());
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_FRAME_H
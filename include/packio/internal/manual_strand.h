@@ -5,31 +5,56 @@
 #ifndef PACKIO_MANUAL_STRAND_H
 #define PACKIO_MANUAL_STRAND_H
 
-#include <queue>
+#include <chrono>
+#include <deque>
 
+#include "../contention_profile.h"
 #include "config.h"
 #include "movable_function.h"
 
 namespace packio {
 namespace internal {
 
-template <typename Executor>
+template <typename Strand>
 class manual_strand {
 public:
     using function_type = movable_function<void()>;
 
-    manual_strand(const Executor& executor) : strand_{executor} {}
+    // number of functions of the normal lane run in a row before a function
+    // of the bulk lane gets a turn
+    static constexpr std::size_t kMaxNormalInARow = 16;
 
-    void push(function_type function)
+    template <typename Executor>
+    manual_strand(const Executor& executor) : strand_{executor}
     {
-        net::dispatch(strand_, [this, function = std::move(function)]() mutable {
-            queue_.push(std::move(function));
+    }
 
-            if (!executing_) {
-                executing_ = true;
-                execute();
-            }
-        });
+    // functions of the bulk lane run when no other function is queued,
+    // or after kMaxNormalInARow functions of the normal lane
+    void push(function_type function, bool bulk = false)
+    {
+#if defined(PACKIO_CONTENTION_PROFILING)
+        function = [start = std::chrono::steady_clock::now(),
+                    function = std::move(function)]() mutable {
+            contention_recorders::get().write_strand.executed(
+                std::chrono::steady_clock::now() - start);
+            function();
+        };
+#endif // defined(PACKIO_CONTENTION_PROFILING)
+        net::dispatch(
+            strand_,
+            [this, function = std::move(function), bulk]() mutable {
+                (bulk ? bulk_ : queue_).push_back(std::move(function));
+#if defined(PACKIO_CONTENTION_PROFILING)
+                contention_recorders::get().write_strand.dispatched(
+                    queue_.size() + bulk_.size());
+#endif // defined(PACKIO_CONTENTION_PROFILING)
+
+                if (!executing_) {
+                    executing_ = true;
+                    execute();
+                }
+            });
     }
 
     void next()
@@ -37,21 +62,50 @@ public:
         net::dispatch(strand_, [this] { execute(); });
     }
 
+    // end the current function of the bulk lane, the continuation runs
+    // at the next turn of the bulk lane, before the rest of it
+    void yield(function_type continuation)
+    {
+        net::dispatch(
+            strand_, [this, continuation = std::move(continuation)]() mutable {
+                bulk_.push_front(std::move(continuation));
+                execute();
+            });
+    }
+
+    // number of functions queued, only valid from a function of the strand
+    std::size_t size() const noexcept { return queue_.size() + bulk_.size(); }
+
+    // move the strand to another executor, only valid from a function
+    // of the strand when the queues are empty, before calling next
+    template <typename Executor>
+    void rebind(const Executor& executor)
+    {
+        strand_ = Strand{executor};
+    }
+
 private:
     void execute()
     {
-        if (queue_.empty()) {
+        const bool bulk_turn = queue_.empty()
+                               || (!bulk_.empty()
+                                   && normal_in_a_row_ >= kMaxNormalInARow);
+        auto& queue = bulk_turn ? bulk_ : queue_;
+        if (queue.empty()) {
             executing_ = false;
             return;
         }
+        normal_in_a_row_ = bulk_turn ? 0 : normal_in_a_row_ + 1;
 
-        auto function = std::move(queue_.front());
-        queue_.pop();
+        auto function = std::move(queue.front());
+        queue.pop_front();
         function();
     }
 
-    net::strand<Executor> strand_;
-    std::queue<function_type> queue_;
+    Strand strand_;
+    std::deque<function_type> queue_;
+    std::deque<function_type> bulk_;
+    std::size_t normal_in_a_row_{0};
     bool executing_{false};
 };
 
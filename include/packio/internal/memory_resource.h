@@ -0,0 +1,172 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_MEMORY_RESOURCE_H
+#define PACKIO_MEMORY_RESOURCE_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "config.h"
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+#include <memory_resource>
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+namespace packio {
+namespace internal {
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+using memory_resource = std::pmr::memory_resource;
+#else // defined(PACKIO_HAS_MEMORY_RESOURCE)
+class memory_resource;
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+template <typename T>
+class resource_deleter {
+public:
+    explicit resource_deleter(memory_resource* resource = nullptr) noexcept
+        : resource_{resource}
+    {
+    }
+
+    void operator()(T* ptr) const
+    {
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+        if (resource_) {
+            ptr->~T();
+            resource_->deallocate(ptr, sizeof(T), alignof(T));
+            return;
+        }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        delete ptr;
+    }
+
+    memory_resource* resource() const noexcept { return resource_; }
+
+private:
+    memory_resource* resource_;
+};
+
+template <typename T>
+using resource_unique_ptr = std::unique_ptr<T, resource_deleter<T>>;
+
+//! Move value to the heap, or to the memory resource if there is one
+template <typename T>
+resource_unique_ptr<std::decay_t<T>> to_unique_ptr(
+    T&& value,
+    memory_resource* resource)
+{
+    using value_type = std::decay_t<T>;
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    if (resource) {
+        void* ptr = resource->allocate(sizeof(value_type), alignof(value_type));
+        try {
+            return resource_unique_ptr<value_type>{
+                new (ptr) value_type(std::forward<T>(value)),
+                resource_deleter<value_type>{resource}};
+        }
+        catch (...) {
+            resource->deallocate(ptr, sizeof(value_type), alignof(value_type));
+            throw;
+        }
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+    return resource_unique_ptr<value_type>{
+        new value_type(std::forward<T>(value))};
+}
+
+//! Create a shared object, allocated from the memory resource if there is one
+template <typename T, typename... Args>
+std::shared_ptr<T> make_shared_with_resource(
+    memory_resource* resource,
+    Args&&... args)
+{
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    if (resource) {
+        return std::allocate_shared<T>(
+            std::pmr::polymorphic_allocator<T>{resource},
+            std::forward<Args>(args)...);
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+    return std::make_shared<T>(std::forward<Args>(args)...);
+}
+
+//! Function called at most once, owning a function allocated from a memory
+//! resource. It only holds two pointers, so that the type-erased function
+//! wrappers store it in place instead of allocating from the heap.
+//! The owned function is destroyed when called, it leaks if never called.
+template <typename Fn>
+class resource_once_function {
+public:
+    resource_once_function(resource_unique_ptr<Fn> fn) noexcept
+        : resource_{fn.get_deleter().resource()}, fn_{fn.release()}
+    {
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args)
+    {
+        resource_unique_ptr<Fn> fn{
+            std::exchange(fn_, nullptr), resource_deleter<Fn>{resource_}};
+        if (fn) {
+            (*fn)(std::forward<Args>(args)...);
+        }
+    }
+
+private:
+    memory_resource* resource_;
+    Fn* fn_;
+};
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+//! Handler wrapper associating an allocator to a handler
+template <typename Handler>
+class allocator_binder {
+public:
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    template <typename H>
+    allocator_binder(H&& handler, memory_resource* resource)
+        : handler_{std::forward<H>(handler)}, allocator_{resource}
+    {
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator_; }
+
+    template <typename... Args>
+    decltype(auto) operator()(Args&&... args)
+    {
+        return handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    Handler handler_;
+    allocator_type allocator_;
+};
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+//! Call initiate with the handler, bound to the memory resource if there
+//! is one. Without resource, asio keeps using its own handler allocator.
+template <typename Handler, typename Initiate>
+void initiate_with_resource(
+    memory_resource* resource,
+    Handler&& handler,
+    Initiate&& initiate)
+{
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    if (resource) {
+        initiate(allocator_binder<std::decay_t<Handler>>{
+            std::forward<Handler>(handler), resource});
+        return;
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+    initiate(std::forward<Handler>(handler));
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_MEMORY_RESOURCE_H
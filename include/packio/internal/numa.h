@@ -0,0 +1,227 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_NUMA_H
+#define PACKIO_NUMA_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // defined(__linux__)
+
+#include "config.h"
+#include "log.h"
+#include "memory_resource.h"
+
+namespace packio {
+namespace internal {
+
+struct numa_node {
+    int id;
+    std::vector<int> cpus;
+};
+
+// parse a list formatted like "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(std::string_view list)
+{
+    std::vector<int> cpus;
+    while (!list.empty()) {
+        auto comma = list.find(',');
+        auto range = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view{}
+                                               : list.substr(comma + 1);
+
+        auto dash = range.find('-');
+        try {
+            int first = std::stoi(std::string{range.substr(0, dash)});
+            int last = dash == std::string_view::npos
+                           ? first
+                           : std::stoi(std::string{range.substr(dash + 1)});
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        catch (std::exception&) {
+            // skip trailing whitespaces and garbage
+        }
+    }
+    return cpus;
+}
+
+inline std::vector<int> read_cpu_list(const std::string& path)
+{
+    std::ifstream file{path};
+    std::string list;
+    if (!std::getline(file, list)) {
+        return {};
+    }
+    return parse_cpu_list(list);
+}
+
+// NUMA nodes of the machine and their CPUs, a single node with all
+// the CPUs if the topology is not available
+inline std::vector<numa_node> numa_topology()
+{
+    std::vector<numa_node> nodes;
+#if defined(__linux__)
+    const std::string base = "/sys/devices/system/node/";
+    for (int id : read_cpu_list(base + "online")) {
+        auto cpus = read_cpu_list(
+            base + "node" + std::to_string(id) + "/cpulist");
+        if (!cpus.empty()) {
+            nodes.push_back({id, std::move(cpus)});
+        }
+    }
+#endif // defined(__linux__)
+
+    if (nodes.empty()) {
+        numa_node node{0, {}};
+        unsigned n_cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n_cpus; ++cpu) {
+            node.cpus.push_back(static_cast<int>(cpu));
+        }
+        nodes.push_back(std::move(node));
+    }
+    return nodes;
+}
+
+// restrict the calling thread to the given CPUs, no-op where
+// thread affinity is not supported
+inline void pin_this_thread(const std::vector<int>& cpus)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        PACKIO_WARN("failed to set the thread affinity: {}", err);
+    }
+#else // defined(__linux__)
+    (void)cpus;
+#endif // defined(__linux__)
+}
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+// memory resource allocating pages bound to a NUMA node, used as the
+// upstream of the pools of the node. Where the memory policies are not
+// supported, the pages are left to the default policy of the OS
+class node_memory_resource : public std::pmr::memory_resource {
+public:
+    explicit node_memory_resource(int node) noexcept : node_{node} {}
+
+    node_memory_resource(const node_memory_resource&) = delete;
+    node_memory_resource& operator=(const node_memory_resource&) = delete;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        if (alignment <= page_size()) {
+            const std::size_t size = round_to_pages(bytes);
+            void* ptr = ::mmap(
+                nullptr,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS,
+                -1,
+                0);
+            if (ptr == MAP_FAILED) {
+                throw std::bad_alloc{};
+            }
+            bind(ptr, size);
+            return ptr;
+        }
+#endif // defined(__linux__) && defined(SYS_mbind)
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment)
+        override
+    {
+#if defined(__linux__) && defined(SYS_mbind)
+        if (alignment <= page_size()) {
+            ::munmap(ptr, round_to_pages(bytes));
+            return;
+        }
+#endif // defined(__linux__) && defined(SYS_mbind)
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const
+        noexcept override
+    {
+        return this == &other;
+    }
+
+#if defined(__linux__) && defined(SYS_mbind)
+    static std::size_t page_size() noexcept
+    {
+        static const std::size_t size = [] {
+            long size = ::sysconf(_SC_PAGESIZE);
+            return size > 0 ? static_cast<std::size_t>(size) : 4096;
+        }();
+        return size;
+    }
+
+    static std::size_t round_to_pages(std::size_t bytes) noexcept
+    {
+        const std::size_t page = page_size();
+        return (std::max<std::size_t>(bytes, 1) + page - 1) / page * page;
+    }
+
+    void bind(void* ptr, std::size_t size) noexcept
+    {
+        // MPOL_BIND, numaif.h is not always available
+        constexpr int kBindPolicy = 2;
+        constexpr std::size_t kBitsPerMask = 8 * sizeof(unsigned long);
+        std::array<unsigned long, 16> mask{};
+        if (node_ < 0
+            || static_cast<std::size_t>(node_) >= mask.size() * kBitsPerMask) {
+            return;
+        }
+        mask[node_ / kBitsPerMask] = 1ul << (node_ % kBitsPerMask);
+        // the kernel reads one bit less than the maximum node given
+        long ret = ::syscall(
+            SYS_mbind,
+            ptr,
+            size,
+            kBindPolicy,
+            mask.data(),
+            mask.size() * kBitsPerMask + 1,
+            0);
+        if (ret != 0 && !warned_.exchange(true)) {
+            PACKIO_WARN("failed to bind memory to node {}: {}", node_, errno);
+        }
+    }
+#endif // defined(__linux__) && defined(SYS_mbind)
+
+    int node_;
+    std::atomic<bool> warned_{false};
+};
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+} // internal
+} // packio
+
+#endif // PACKIO_NUMA_H
@@ -7,11 +7,26 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
 
 namespace packio {
 
 enum class call_type { request = 0, notification = 1 };
 
+namespace internal {
+
+// method of the calls applying a procedure to a list of arguments,
+// the "rpc." prefix is reserved to the protocol by JSON-RPC
+constexpr std::string_view map_method = "rpc.map";
+
+// outcome of one item of a map call, a value or an error message
+template <typename T>
+struct map_item {
+    std::optional<T> value;
+    std::string error;
+};
+
+} // internal
 } // packio
 
 #endif // PACKIO_RPC_H
@@ -0,0 +1,284 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_SOCKET_TIMESTAMPS_H
+#define PACKIO_SOCKET_TIMESTAMPS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif // defined(__linux__)
+
+#include "../latency_histogram.h"
+#include "config.h"
+#include "log.h"
+
+namespace packio {
+namespace internal {
+
+// the software timestamps of the kernel use CLOCK_REALTIME
+using kernel_clock = std::chrono::system_clock;
+
+#if defined(__linux__)
+inline kernel_clock::time_point to_time_point(const timespec& ts)
+{
+    auto since_epoch = std::chrono::seconds{ts.tv_sec}
+                       + std::chrono::nanoseconds{ts.tv_nsec};
+    return kernel_clock::time_point{
+        std::chrono::duration_cast<kernel_clock::duration>(since_epoch)};
+}
+
+// software timestamp of a received or transmitted message, if any
+inline std::optional<kernel_clock::time_point> software_timestamp(msghdr& msg)
+{
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET
+            && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+            auto* tss = reinterpret_cast<scm_timestamping*>(CMSG_DATA(cmsg));
+            if (tss->ts[0].tv_sec == 0 && tss->ts[0].tv_nsec == 0) {
+                return std::nullopt;
+            }
+            return to_time_point(tss->ts[0]);
+        }
+    }
+    return std::nullopt;
+}
+#endif // defined(__linux__)
+
+// receive like read_some, with the kernel timestamp of the data
+inline std::size_t receive_timestamped(
+    int fd,
+    net::mutable_buffer buffer,
+    std::optional<kernel_clock::time_point>& timestamp,
+    error_code& ec)
+{
+#if defined(__linux__)
+    iovec iov{buffer.data(), buffer.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t length = ::recvmsg(fd, &msg, MSG_DONTWAIT);
+    if (length < 0) {
+        ec = error_code{errno, net::error::get_system_category()};
+        return 0;
+    }
+    if (length == 0 && buffer.size() != 0) {
+        ec = net::error::eof;
+        return 0;
+    }
+    timestamp = software_timestamp(msg);
+    return static_cast<std::size_t>(length);
+#else // defined(__linux__)
+    (void)fd;
+    (void)buffer;
+    (void)timestamp;
+    ec = net::error::operation_not_supported;
+    return 0;
+#endif // defined(__linux__)
+}
+
+// call f(key, timestamp) for each transmit timestamp queued on the socket
+template <typename F>
+void read_transmit_timestamps(int fd, F&& f)
+{
+#if defined(__linux__)
+    while (true) {
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))
+                                      + CMSG_SPACE(sizeof(sock_extended_err))];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            return;
+        }
+
+        std::optional<uint32_t> key;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                || (cmsg->cmsg_level == SOL_IPV6
+                    && cmsg->cmsg_type == IPV6_RECVERR)) {
+                auto* err = reinterpret_cast<sock_extended_err*>(
+                    CMSG_DATA(cmsg));
+                if (err->ee_errno == ENOMSG
+                    && err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    key = err->ee_data;
+                }
+            }
+        }
+        auto timestamp = software_timestamp(msg);
+        if (key && timestamp) {
+            f(*key, *timestamp);
+        }
+    }
+#else // defined(__linux__)
+    (void)fd;
+    (void)f;
+#endif // defined(__linux__)
+}
+
+// kernel timestamps of a socket and the latency histograms of a connection
+template <typename Threading>
+class socket_timestamper {
+public:
+    bool enabled() const noexcept { return enabled_; }
+
+    // enable the software timestamps of the kernel, false if unsupported
+    template <typename Socket>
+    bool enable(Socket& socket)
+    {
+#if defined(__linux__)
+        // other sockets may accept the option without timestamping
+        if constexpr (!std::is_same_v<
+                          typename Socket::protocol_type,
+                          net::ip::tcp>) {
+            return false;
+        }
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE
+                    | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID
+                    | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (::setsockopt(
+                socket.native_handle(),
+                SOL_SOCKET,
+                SO_TIMESTAMPING,
+                &flags,
+                sizeof(flags))
+            != 0) {
+            PACKIO_WARN("cannot enable timestamping: {}", errno);
+            return false;
+        }
+        enabled_ = true;
+        return true;
+#else // defined(__linux__)
+        (void)socket;
+        return false;
+#endif // defined(__linux__)
+    }
+
+    // read_some on the socket, recording the kernel-to-read latency
+    template <typename Socket, typename Handler>
+    void async_read_some(
+        Socket& socket,
+        net::mutable_buffer buffer,
+        Handler&& handler)
+    {
+        auto executor = net::get_associated_executor(
+            handler, socket.get_executor());
+        socket.async_wait(
+            net::socket_base::wait_read,
+            net::bind_executor(
+                executor,
+                [this,
+                 &socket,
+                 buffer,
+                 handler = std::forward<Handler>(handler)](
+                    error_code ec) mutable {
+                    if (ec) {
+                        handler(ec, 0);
+                        return;
+                    }
+                    // readiness is also signaled for the transmit timestamps
+                    collect_transmit_timestamps(socket);
+                    std::optional<kernel_clock::time_point> timestamp;
+                    auto length = receive_timestamped(
+                        socket.native_handle(), buffer, timestamp, ec);
+                    if (ec == net::error::would_block
+                        || ec == net::error::try_again) {
+                        async_read_some(socket, buffer, std::move(handler));
+                        return;
+                    }
+                    if (timestamp) {
+                        kernel_to_read.record(kernel_clock::now() - *timestamp);
+                    }
+                    handler(ec, length);
+                }));
+    }
+
+    // called by the writer before writing the given number of bytes
+    void write_started(std::size_t bytes)
+    {
+        written_bytes_ += bytes;
+        // the key of a transmit timestamp is the offset of the last byte
+        const auto key = static_cast<uint32_t>(written_bytes_ - 1);
+        std::lock_guard l{mutex_};
+        if (pending_writes_.size() >= kMaxPendingWrites) {
+            pending_writes_.pop_front();
+        }
+        pending_writes_.emplace_back(key, kernel_clock::now());
+    }
+
+    // record the write-to-kernel latency of the writes transmitted
+    template <typename Socket>
+    void collect_transmit_timestamps(Socket& socket)
+    {
+        read_transmit_timestamps(
+            socket.native_handle(),
+            [this](uint32_t key, kernel_clock::time_point timestamp) {
+                std::lock_guard l{mutex_};
+                while (!pending_writes_.empty()) {
+                    auto [pending_key, started] = pending_writes_.front();
+                    // keys wrap around
+                    auto distance = static_cast<int32_t>(key - pending_key);
+                    if (distance < 0) {
+                        // an intermediate write of a message
+                        return;
+                    }
+                    pending_writes_.pop_front();
+                    if (distance == 0) {
+                        write_to_kernel.record(timestamp - started);
+                        return;
+                    }
+                }
+            });
+    }
+
+    latency_breakdown get() const
+    {
+        latency_breakdown breakdown;
+        kernel_to_read.fill(breakdown.kernel_to_read);
+        read_to_dispatch.fill(breakdown.read_to_dispatch);
+        dispatch_to_response.fill(breakdown.dispatch_to_response);
+        response_to_write.fill(breakdown.response_to_write);
+        write_to_kernel.fill(breakdown.write_to_kernel);
+        return breakdown;
+    }
+
+    latency_recorder<Threading> kernel_to_read;
+    latency_recorder<Threading> read_to_dispatch;
+    latency_recorder<Threading> dispatch_to_response;
+    latency_recorder<Threading> response_to_write;
+    latency_recorder<Threading> write_to_kernel;
+
+private:
+    // bound the writes waiting for a timestamp that may never come
+    static constexpr std::size_t kMaxPendingWrites = 1024;
+
+    bool enabled_{false};
+    // only used by the writer
+    uint64_t written_bytes_{0};
+    typename Threading::mutex_type mutex_;
+    std::deque<std::pair<uint32_t, kernel_clock::time_point>> pending_writes_;
+};
+
+} // internal
+} // packio
+
+#endif // PACKIO_SOCKET_TIMESTAMPS_H
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <string_view>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "config.h"
@@ -43,6 +44,32 @@ struct func_traits<R (*)(Args...)> : std::true_type {
 template <typename T>
 constexpr bool func_traits_v = func_traits<T>::value;
 
+template <typename, typename = void>
+struct has_reserve : std::false_type {
+};
+
+template <typename T>
+struct has_reserve<
+    T,
+    std::void_t<decltype(std::declval<T&>().reserve(std::size_t{}))>>
+    : std::true_type {
+};
+
+template <typename T>
+constexpr bool has_reserve_v = has_reserve<T>::value;
+
+template <typename, typename = void>
+struct has_try_lock : std::false_type {
+};
+
+template <typename T>
+struct has_try_lock<T, std::void_t<decltype(std::declval<T&>().try_lock())>>
+    : std::true_type {
+};
+
+template <typename T>
+constexpr bool has_try_lock_v = has_try_lock<T>::value;
+
 #if defined(PACKIO_HAS_CO_AWAIT)
 template <typename>
 struct is_awaitable : std::false_type {
@@ -99,17 +126,6 @@ struct decay_tuple<std::tuple<Args...>> {
 template <typename T>
 using decay_tuple_t = typename decay_tuple<T>::type;
 
-template <typename T>
-void set_no_delay(T&)
-{
-}
-
-template <>
-inline void set_no_delay(net::ip::tcp::socket& socket)
-{
-    socket.set_option(net::ip::tcp::no_delay{true});
-}
-
 template <typename T>
 std::unique_ptr<std::decay_t<T>> to_unique_ptr(T&& value)
 {
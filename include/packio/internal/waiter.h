@@ -0,0 +1,206 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_WAITER_H
+#define PACKIO_WAITER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else // defined(__linux__)
+#include <condition_variable>
+#include <mutex>
+#endif // defined(__linux__)
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "config.h"
+
+namespace packio {
+namespace internal {
+
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+//! Wait for a single completion from another thread
+//!
+//! The waiting thread spins briefly, then sleeps on a futex. Each wait is
+//! identified by a ticket so that a completion arriving after the waiter
+//! gave up is ignored, the waiter can then be reused right away.
+template <typename Result>
+class waiter {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    //! How long the waiting thread spins before sleeping
+    static constexpr std::chrono::microseconds kSpinDuration{20};
+
+    //! Start a new wait, return its ticket
+    uint64_t prepare() noexcept
+    {
+        result_.reset();
+        state_.store(kWaiting, std::memory_order_relaxed);
+        ticket_.store(++generation_, std::memory_order_release);
+        return generation_;
+    }
+
+    //! Complete the wait of the ticket, from any thread
+    //! @return False if the waiter gave up waiting for this ticket
+    template <typename... Args>
+    bool complete(uint64_t ticket, Args&&... args)
+    {
+        if (!claim(ticket)) {
+            return false;
+        }
+        result_.emplace(std::forward<Args>(args)...);
+        notify();
+        return true;
+    }
+
+    //! Wait for the completion of the ticket until the deadline
+    //! @return The result, nullopt on timeout
+    std::optional<Result> wait_until(
+        uint64_t ticket,
+        clock_type::time_point deadline)
+    {
+        if (!wait_done(deadline) && claim(ticket)) {
+            // gave up before the completion
+            return std::nullopt;
+        }
+        // the completion has been claimed, it is being stored
+        wait_done(clock_type::time_point::max());
+        return std::move(result_);
+    }
+
+private:
+    static constexpr uint32_t kWaiting = 0;
+    static constexpr uint32_t kDone = 1;
+
+    bool claim(uint64_t ticket) noexcept
+    {
+        return ticket_.compare_exchange_strong(
+            ticket, 0, std::memory_order_acq_rel);
+    }
+
+    bool done() const noexcept
+    {
+        return state_.load(std::memory_order_acquire) == kDone;
+    }
+
+    bool wait_done(clock_type::time_point deadline)
+    {
+        const auto spin_end = clock_type::now() + kSpinDuration;
+        for (int i = 0; !done(); ++i) {
+            cpu_relax();
+            if (i % 64 == 0 && clock_type::now() >= spin_end) {
+                return park(deadline);
+            }
+        }
+        return true;
+    }
+
+#if defined(__linux__)
+    void notify() noexcept
+    {
+        state_.store(kDone, std::memory_order_release);
+        syscall(
+            SYS_futex,
+            reinterpret_cast<uint32_t*>(&state_),
+            FUTEX_WAKE_PRIVATE,
+            1,
+            nullptr,
+            nullptr,
+            0);
+    }
+
+    bool park(clock_type::time_point deadline)
+    {
+        while (!done()) {
+            timespec* timeout_ptr = nullptr;
+            timespec timeout;
+            if (deadline != clock_type::time_point::max()) {
+                auto remaining = deadline - clock_type::now();
+                if (remaining <= clock_type::duration::zero()) {
+                    return false;
+                }
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              remaining)
+                              .count();
+                timeout.tv_sec = static_cast<time_t>(ns / 1000000000);
+                timeout.tv_nsec = static_cast<long>(ns % 1000000000);
+                timeout_ptr = &timeout;
+            }
+            syscall(
+                SYS_futex,
+                reinterpret_cast<uint32_t*>(&state_),
+                FUTEX_WAIT_PRIVATE,
+                kWaiting,
+                timeout_ptr,
+                nullptr,
+                0);
+        }
+        return true;
+    }
+#else // defined(__linux__)
+    void notify()
+    {
+        {
+            std::lock_guard l{mutex_};
+            state_.store(kDone, std::memory_order_release);
+        }
+        cv_.notify_one();
+    }
+
+    bool park(clock_type::time_point deadline)
+    {
+        std::unique_lock l{mutex_};
+        if (deadline == clock_type::time_point::max()) {
+            cv_.wait(l, [this] { return done(); });
+            return true;
+        }
+        return cv_.wait_until(l, deadline, [this] { return done(); });
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+#endif // defined(__linux__)
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+    std::atomic<uint32_t> state_{kWaiting};
+    std::atomic<uint64_t> ticket_{0};
+    uint64_t generation_{0};
+    std::optional<Result> result_;
+};
+
+//! The waiter of the calling thread
+//!
+//! Shared with the pending completions, which can outlive the thread.
+template <typename Result>
+const std::shared_ptr<waiter<Result>>& this_thread_waiter()
+{
+    thread_local const auto instance = std::make_shared<waiter<Result>>();
+    return instance;
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_WAITER_H
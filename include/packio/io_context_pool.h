@@ -0,0 +1,209 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_IO_CONTEXT_POOL_H
+#define PACKIO_IO_CONTEXT_POOL_H
+
+//! @file
+//! Class @ref packio::io_context_pool "io_context_pool"
+
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "internal/config.h"
+#include "internal/memory_resource.h"
+#include "internal/numa.h"
+
+namespace packio {
+
+//! A pool of io_context, each one run by threads pinned to a
+//! NUMA node or to a single core
+//!
+//! Combined with @ref server::add_session_executor, see @ref place_sessions,
+//! it keeps each connection on the node that accepted it: its socket,
+//! its handlers and, through the per-context memory resource, its buffers.
+//! The sessions are built by the threads of their node, and the memory
+//! resource of a context allocates pages bound to its node where the OS
+//! supports it (Linux), relying on the first-touch policy elsewhere.
+class io_context_pool {
+public:
+    //! What an io_context of the pool is bound to
+    enum class granularity {
+        numa_node, //!< One io_context per NUMA node
+        core //!< One io_context per CPU
+    };
+
+    //! The executor type of the io_contexts
+    using executor_type = net::io_context::executor_type;
+
+    //! The constructor
+    //! @param gran What each io_context is bound to
+    //! @param threads_per_context Number of threads running each io_context,
+    //! 0 to use one thread per CPU of the io_context
+    explicit io_context_pool(
+        granularity gran = granularity::numa_node,
+        std::size_t threads_per_context = 0)
+    {
+        for (auto& node : internal::numa_topology()) {
+            if (gran == granularity::numa_node) {
+                add_context(node.id, node.cpus, threads_per_context);
+            }
+            else {
+                for (int cpu : node.cpus) {
+                    add_context(node.id, {cpu}, threads_per_context);
+                }
+            }
+        }
+    }
+
+    io_context_pool(const io_context_pool&) = delete;
+    io_context_pool& operator=(const io_context_pool&) = delete;
+
+    //! The destructor, stops the pool and waits for its threads
+    ~io_context_pool()
+    {
+        stop();
+        join();
+    }
+
+    //! Get the number of io_context in the pool
+    std::size_t size() const noexcept { return contexts_.size(); }
+
+    //! Get an io_context of the pool
+    net::io_context& get_io_context(std::size_t index)
+    {
+        return contexts_.at(index)->io;
+    }
+
+    //! Get the executor of an io_context of the pool
+    executor_type get_executor(std::size_t index)
+    {
+        return get_io_context(index).get_executor();
+    }
+
+    //! Get the NUMA node of an io_context of the pool
+    int get_numa_node(std::size_t index) const
+    {
+        return contexts_.at(index)->node;
+    }
+
+    //! Get the CPUs running an io_context of the pool
+    const std::vector<int>& get_cpus(std::size_t index) const
+    {
+        return contexts_.at(index)->cpus;
+    }
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    //! Get the memory resource local to an io_context of the pool
+    //!
+    //! Its memory is bound to the NUMA node of the io_context.
+    //! It must only be used by objects running on this io_context,
+    //! and outlives them as long as the pool is destroyed last.
+    std::pmr::memory_resource* get_memory_resource(std::size_t index)
+    {
+        return &contexts_.at(index)->resource;
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    //! Start the threads of the pool
+    //!
+    //! The io_contexts are kept running until @ref stop is called
+    void run()
+    {
+        for (auto& context : contexts_) {
+            context->work.emplace(context->io.get_executor());
+            for (std::size_t i = 0; i < context->n_threads; ++i) {
+                threads_.emplace_back([ctx = context.get()] {
+                    internal::pin_this_thread(ctx->cpus);
+                    ctx->io.run();
+                });
+            }
+        }
+    }
+
+    //! Stop the io_contexts of the pool
+    void stop()
+    {
+        for (auto& context : contexts_) {
+            context->work.reset();
+            context->io.stop();
+        }
+    }
+
+    //! Wait for the threads of the pool to exit
+    void join()
+    {
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        threads_.clear();
+    }
+
+    //! Make a server place its new sessions on the io_contexts of the pool
+    //!
+    //! Sessions are distributed round-robin, each one using the
+    //! memory resource of its io_context when available.
+    //! The pool must outlive the server.
+    //! @param server The server
+    template <typename Server>
+    void place_sessions(Server& server)
+    {
+        for (std::size_t i = 0; i < size(); ++i) {
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+            server.add_session_executor(get_executor(i), get_memory_resource(i));
+#else // defined(PACKIO_HAS_MEMORY_RESOURCE)
+            server.add_session_executor(get_executor(i));
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        }
+    }
+
+private:
+    struct context {
+        context(int node, std::vector<int> cpus, std::size_t n_threads)
+            : node{node},
+              cpus{std::move(cpus)},
+              n_threads{n_threads},
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+              upstream{node},
+              resource{&upstream},
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+              io{static_cast<int>(n_threads)}
+        {
+        }
+
+        int node;
+        std::vector<int> cpus;
+        std::size_t n_threads;
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+        // declared before the io_context so that pending handlers
+        // are destroyed before their memory
+        internal::node_memory_resource upstream;
+        std::pmr::synchronized_pool_resource resource;
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        net::io_context io;
+        std::optional<net::executor_work_guard<executor_type>> work;
+    };
+
+    void add_context(
+        int node,
+        std::vector<int> cpus,
+        std::size_t threads_per_context)
+    {
+        std::size_t n_threads = threads_per_context ? threads_per_context
+                                                    : cpus.size();
+        contexts_.push_back(
+            std::make_unique<context>(node, std::move(cpus), n_threads));
+    }
+
+    std::vector<std::unique_ptr<context>> contexts_;
+    std::vector<std::thread> threads_;
+};
+
+} // packio
+
+#endif // PACKIO_IO_CONTEXT_POOL_H
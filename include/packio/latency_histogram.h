@@ -0,0 +1,149 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_LATENCY_HISTOGRAM_H
+#define PACKIO_LATENCY_HISTOGRAM_H
+
+//! @file
+//! Structs @ref packio::latency_histogram "latency_histogram" and
+//! @ref packio::latency_breakdown "latency_breakdown"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "internal/config.h"
+
+namespace packio {
+
+//! Histogram of latencies with power of two buckets
+struct latency_histogram {
+    //! The number of buckets, the last one counts the latencies above 2^47ns
+    static constexpr std::size_t kBuckets = 48;
+
+    //! counts[i] counts the latencies in [2^i, 2^(i+1)) nanoseconds,
+    //! counts[0] also counts the null latencies
+    std::array<uint64_t, kBuckets> counts{};
+
+    //! The number of latencies counted
+    uint64_t count() const noexcept
+    {
+        uint64_t total = 0;
+        for (auto c : counts) {
+            total += c;
+        }
+        return total;
+    }
+
+    //! Upper bound of the bucket holding the quantile q, between 0 and 1
+    //! @return The upper bound, 0 if the histogram is empty
+    std::chrono::nanoseconds quantile(double q) const noexcept
+    {
+        const uint64_t total = count();
+        if (total == 0) {
+            return std::chrono::nanoseconds{0};
+        }
+        const auto rank = static_cast<uint64_t>(q * (total - 1));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::chrono::nanoseconds{int64_t{2} << i};
+            }
+        }
+        return std::chrono::nanoseconds{int64_t{2} << (kBuckets - 1)};
+    }
+
+    //! Add the counts of another histogram
+    latency_histogram& operator+=(const latency_histogram& other) noexcept
+    {
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            counts[i] += other.counts[i];
+        }
+        return *this;
+    }
+};
+
+//! Where the time of the requests of a connection is spent
+//!
+//! Filled when socket timestamping is enabled, see
+//! @ref server_session::set_socket_timestamping and
+//! @ref client::set_socket_timestamping. The kernel timestamps are
+//! software timestamps, available on Linux TCP sockets.
+struct latency_breakdown {
+    //! From the reception of the data by the kernel to its read by packio
+    latency_histogram kernel_to_read;
+    //! From the read of a request to the start of its procedure on a
+    //! session, from the read of a response to its handler on a client
+    latency_histogram read_to_dispatch;
+    //! From the start of a procedure to its response, sessions only
+    latency_histogram dispatch_to_response;
+    //! From a response to the end of its write, sessions only
+    latency_histogram response_to_write;
+    //! From the start of a write to the transmission of its last byte
+    //! by the kernel
+    latency_histogram write_to_kernel;
+
+    //! Add the counts of another breakdown
+    latency_breakdown& operator+=(const latency_breakdown& other) noexcept
+    {
+        kernel_to_read += other.kernel_to_read;
+        read_to_dispatch += other.read_to_dispatch;
+        dispatch_to_response += other.dispatch_to_response;
+        response_to_write += other.response_to_write;
+        write_to_kernel += other.write_to_kernel;
+        return *this;
+    }
+};
+
+namespace internal {
+
+//! Histogram of latencies updated with relaxed atomics
+template <typename Threading>
+class latency_recorder {
+public:
+    void record(std::chrono::nanoseconds latency) noexcept
+    {
+        uint64_t ns =
+            latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+        std::size_t bucket = 0;
+        while (ns > 1 && bucket < latency_histogram::kBuckets - 1) {
+            ns >>= 1;
+            ++bucket;
+        }
+        counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename Duration>
+    void record(Duration latency) noexcept
+    {
+        record(std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+    }
+
+    void fill(latency_histogram& histogram) const noexcept
+    {
+        for (std::size_t i = 0; i < latency_histogram::kBuckets; ++i) {
+            histogram.counts[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    void reset() noexcept
+    {
+        for (auto& count : counts_) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::array<
+        typename Threading::template atomic_type<uint64_t>,
+        latency_histogram::kBuckets>
+        counts_{};
+};
+
+} // internal
+} // packio
+
+#endif // PACKIO_LATENCY_HISTOGRAM_H
@@ -0,0 +1,191 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_MEMORY_BUDGET_H
+#define PACKIO_MEMORY_BUDGET_H
+
+//! @file
+//! Class @ref packio::memory_budget "memory_budget"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "internal/config.h"
+#include "internal/movable_function.h"
+
+namespace packio {
+
+//! Bound on the memory held by sessions
+//!
+//! Sessions sharing a budget account the memory held by their reception
+//! buffer, their pending requests and their queued responses, see
+//! @ref server_session::set_memory_budget. A budget can be shared by several
+//! servers to bound the memory of the whole process.
+//! When the budget is exceeded, sessions holding at least their share of the
+//! used memory stop reading. They check again once their requests in
+//! progress complete, then wait for the budget to no longer be exceeded,
+//! the heaviest sessions resuming first. The limit must leave room for the
+//! reception buffers of the sessions.
+//! Pending requests are accounted with the size of their serialized form,
+//! the parsed requests (JSON values, msgpack zones) are not measured and
+//! usually take more: the limit should leave room for them as well. With
+//! @ref overflow_policy::shed_requests, requests received while the budget
+//! is exceeded are also rejected with an error.
+class memory_budget {
+public:
+    //! What to do with new requests when the budget is exceeded
+    enum class overflow_policy {
+        pause_reads, //!< Only pause the reads of the heaviest sessions
+        shed_requests, //!< Also reject the requests with an error
+    };
+
+    //! The constructor
+    //! @param limit The maximum number of bytes held by the sessions
+    //! @param policy What to do with new requests when the limit is exceeded
+    explicit memory_budget(
+        std::size_t limit,
+        overflow_policy policy = overflow_policy::pause_reads) noexcept
+        : limit_{limit}, policy_{policy}
+    {
+    }
+
+    memory_budget(const memory_budget&) = delete;
+    memory_budget& operator=(const memory_budget&) = delete;
+
+    //! Get the maximum number of bytes held by the sessions
+    std::size_t limit() const noexcept
+    {
+        return limit_.load(std::memory_order_relaxed);
+    }
+    //! Set the maximum number of bytes held by the sessions
+    void set_limit(std::size_t limit)
+    {
+        limit_.store(limit);
+        maybe_notify_waiters();
+    }
+
+    //! Get the policy applied when the budget is exceeded
+    overflow_policy policy() const noexcept { return policy_; }
+
+    //! Get the number of bytes currently held by the sessions
+    std::size_t used() const noexcept
+    {
+        return used_.load(std::memory_order_relaxed);
+    }
+    //! Get the number of sessions using this budget
+    std::size_t sessions() const noexcept
+    {
+        return sessions_.load(std::memory_order_relaxed);
+    }
+
+    //! Check if the memory held by the sessions exceeds the limit
+    bool exceeded() const noexcept { return used() > limit(); }
+
+    //! Check if a session holding the given number of bytes should stop
+    //! reading, which is the case when the budget is exceeded and the
+    //! session holds at least an even share of the used memory
+    bool should_pause(std::size_t session_bytes) const noexcept
+    {
+        if (!exceeded()) {
+            return false;
+        }
+        std::size_t sessions = std::max<std::size_t>(this->sessions(), 1);
+        return session_bytes >= used() / sessions;
+    }
+
+    //! Check if new requests should be rejected
+    bool should_shed() const noexcept
+    {
+        return policy_ == overflow_policy::shed_requests && exceeded();
+    }
+
+    //! @cond
+    void add(std::size_t bytes) noexcept
+    {
+        used_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void release(std::size_t bytes)
+    {
+        used_.fetch_sub(bytes);
+        maybe_notify_waiters();
+    }
+    void attach() noexcept
+    {
+        sessions_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void detach() noexcept
+    {
+        sessions_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // call resume once the budget is no longer exceeded, now if it is not
+    // already, the waiters holding the most bytes first
+    void wait(
+        std::size_t session_bytes,
+        internal::movable_function<void()> resume)
+    {
+        std::unique_lock l{waiters_mutex_};
+        // counted before checking the budget, so that a concurrent release
+        // either sees the waiter or is seen by the check
+        waiting_.fetch_add(1);
+        if (!exceeded_for_waiters()) {
+            waiting_.fetch_sub(1);
+            l.unlock();
+            resume();
+            return;
+        }
+        waiters_.push_back({session_bytes, std::move(resume)});
+    }
+    //! @endcond
+
+private:
+    struct waiter {
+        std::size_t bytes;
+        internal::movable_function<void()> resume;
+    };
+
+    bool exceeded_for_waiters() const noexcept
+    {
+        return used_.load() > limit_.load();
+    }
+
+    void maybe_notify_waiters()
+    {
+        if (waiting_.load() == 0 || exceeded_for_waiters()) {
+            return;
+        }
+
+        std::vector<waiter> waiters;
+        {
+            std::unique_lock l{waiters_mutex_};
+            waiters.swap(waiters_);
+            waiting_.fetch_sub(waiters.size());
+        }
+        std::sort(
+            waiters.begin(), waiters.end(), [](const auto& a, const auto& b) {
+                return a.bytes > b.bytes;
+            });
+        for (auto& waiter : waiters) {
+            waiter.resume();
+        }
+    }
+
+    std::atomic<std::size_t> limit_;
+    const overflow_policy policy_;
+    std::atomic<std::size_t> used_{0};
+    std::atomic<std::size_t> sessions_{0};
+
+    std::mutex waiters_mutex_;
+    std::vector<waiter> waiters_;
+    std::atomic<std::size_t> waiting_{0};
+};
+
+} // packio
+
+#endif // PACKIO_MEMORY_BUDGET_H
@@ -25,25 +25,38 @@ template <template <class...> class Map = default_map, typename Lockable = defau
 using dispatcher = dispatcher<rpc, Map, Lockable>;
 
 //! The @ref packio::client "client" for msgpack-RPC
-template <typename Socket, template <class...> class Map = default_map>
-using client = ::packio::client<rpc, Socket, Map>;
+template <
+    typename Socket,
+    template <class...> class Map = default_map,
+    typename Threading = default_threading>
+using client = ::packio::client<rpc, Socket, Map, Threading>;
 
 //! The @ref packio::make_client "make_client" function for msgpack-RPC
-template <typename Socket, template <class...> class Map = default_map>
+template <
+    typename Socket,
+    template <class...> class Map = default_map,
+    typename Threading = default_threading>
 auto make_client(Socket&& socket)
 {
-    return std::make_shared<client<Socket, Map>>(std::forward<Socket>(socket));
+    return std::make_shared<client<Socket, Map, Threading>>(
+        std::forward<Socket>(socket));
 }
 
 //! The @ref packio::server "server" for msgpack-RPC
-template <typename Acceptor, typename Dispatcher = dispatcher<>>
-using server = ::packio::server<rpc, Acceptor, Dispatcher>;
+template <
+    typename Acceptor,
+    typename Dispatcher = default_dispatcher,
+    typename Threading = default_threading>
+using server = ::packio::server<rpc, Acceptor, Dispatcher, Threading>;
 
 //! The @ref packio::make_server "make_server" function for msgpack-RPC
-template <typename Acceptor, typename Dispatcher = dispatcher<>>
+template <
+    typename Acceptor,
+    typename Dispatcher = default_dispatcher,
+    typename Threading = default_threading>
 auto make_server(Acceptor&& acceptor)
 {
-    return std::make_shared<server<Acceptor, Dispatcher>>(
+    return std::make_shared<server<Acceptor, Dispatcher, Threading>>(
         std::forward<Acceptor>(acceptor));
 }
 
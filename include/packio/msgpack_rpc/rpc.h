@@ -5,12 +5,21 @@
 #ifndef PACKIO_MSGPACK_RPC_RPC_H
 #define PACKIO_MSGPACK_RPC_RPC_H
 
+#include <limits>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include <msgpack.hpp>
 
 #include "../arg.h"
+#include "../bytes.h"
 #include "../internal/config.h"
+#include "../internal/frame.h"
 #include "../internal/log.h"
 #include "../internal/rpc.h"
+#include "../trace_context.h"
 
 namespace packio {
 namespace msgpack_rpc {
@@ -21,15 +30,26 @@ constexpr bool positional_args_v = (!is_arg_v<Args> && ...);
 
 enum class msgpack_rpc_type { request = 0, response = 1, notification = 2 };
 
+// flags of the trace context appended to requests and notifications
+constexpr uint8_t kTraceSampled = 0x01;
+
 using id_type = uint32_t;
 using native_type = ::msgpack::object;
 
+// msgpack stream appending to a string
+struct string_writer {
+    void write(const char* data, std::size_t size) { out.append(data, size); }
+
+    std::string& out;
+};
+
 //! The object representing a client request
 struct request {
     call_type type;
     id_type id;
     std::string method;
     native_type args;
+    trace_context trace; //!< Trace context of the caller, if any
 
     std::unique_ptr<::msgpack::zone> zone; //!< Msgpack zone storing the args
 };
@@ -46,7 +66,27 @@ struct response {
 //! The incremental parser for msgpack-RPC objects
 class incremental_parser {
 public:
-    incremental_parser() : unpacker_{std::make_unique<::msgpack::unpacker>()} {}
+    explicit incremental_parser(
+        std::size_t max_message_size = std::numeric_limits<std::size_t>::max())
+        : unpacker_{std::make_unique<::msgpack::unpacker>(
+              // same as the default reference function
+              [](::msgpack::type::object_type, std::size_t, void*) {
+                  return true;
+              },
+              nullptr,
+              MSGPACK_UNPACKER_INIT_BUFFER_SIZE,
+              // each element takes at least one byte, each map pair two,
+              // so oversized containers and str/bin/ext are rejected as
+              // soon as their header is parsed
+              ::msgpack::unpack_limit(
+                  max_message_size,
+                  max_message_size / 2,
+                  max_message_size,
+                  max_message_size,
+                  max_message_size))},
+          max_message_size_{max_message_size}
+    {
+    }
 
     std::optional<request> get_request()
     {
@@ -70,6 +110,13 @@ public:
         return parse_response(std::move(object));
     }
 
+    //! Get the next message if it is a compressed frame
+    std::optional<std::string> get_compressed_frame()
+    {
+        try_parse_object();
+        return std::exchange(frame_, std::nullopt);
+    }
+
     char* buffer() const
     { //
         return unpacker_->buffer();
@@ -77,25 +124,90 @@ public:
 
     std::size_t buffer_capacity() const { return unpacker_->buffer_capacity(); }
 
+    std::size_t buffered_size() const { return unpacker_->nonparsed_size(); }
+
     void buffer_consumed(std::size_t bytes)
     {
         unpacker_->buffer_consumed(bytes);
     }
 
-    void reserve_buffer(std::size_t bytes) { unpacker_->reserve_buffer(bytes); }
+    void reserve_buffer(std::size_t bytes)
+    {
+        if (message_size_exceeded_) {
+            return;
+        }
+        unpacker_->reserve_buffer(bytes);
+    }
+
+    bool message_size_exceeded() const noexcept
+    {
+        return message_size_exceeded_;
+    }
 
 private:
     void try_parse_object()
     {
-        if (parsed_) {
+        if (parsed_ || frame_ || message_size_exceeded_) {
+            return;
+        }
+        if (at_boundary_ && try_parse_frame()) {
             return;
         }
+        const bool had_data = unpacker_->nonparsed_size() != 0;
         ::msgpack::object_handle object;
-        if (unpacker_->next(object)) {
-            parsed_ = std::move(object);
+        try {
+            if (unpacker_->next(object)) {
+                parsed_ = std::move(object);
+                at_boundary_ = true;
+                return;
+            }
+            // the beginning of a message has been consumed
+            at_boundary_ = at_boundary_ && !had_data;
+        }
+        catch (::msgpack::size_overflow& exc) {
+            PACKIO_ERROR("message exceeds the maximum size: {}", exc.what());
+            (void)exc;
+            message_size_exceeded_ = true;
+            return;
+        }
+
+        // the remaining data is the beginning of a single message
+        if (unpacker_->nonparsed_size() > max_message_size_) {
+            PACKIO_ERROR(
+                "message exceeds the maximum size: {}",
+                unpacker_->nonparsed_size());
+            message_size_exceeded_ = true;
         }
     }
 
+    // compressed frames can only start between two messages,
+    // true if the remaining data starts with a frame
+    bool try_parse_frame()
+    {
+        const std::size_t size = unpacker_->nonparsed_size();
+        const char* data = unpacker_->nonparsed_buffer();
+        if (size == 0 || !packio::internal::is_frame_start(*data)) {
+            return false;
+        }
+        auto header = packio::internal::parse_frame_header(data, size);
+        if (!header) {
+            return true;
+        }
+        if (header->frame_size() > max_message_size_
+            || header->original_size > max_message_size_) {
+            PACKIO_ERROR(
+                "message exceeds the maximum size: {}",
+                header->original_size);
+            message_size_exceeded_ = true;
+            return true;
+        }
+        if (size >= header->frame_size()) {
+            frame_.emplace(data, header->frame_size());
+            unpacker_->skip_nonparsed_buffer(header->frame_size());
+        }
+        return true;
+    }
+
     static std::optional<response> parse_response(::msgpack::object_handle&& res)
     {
         if (res->type != ::msgpack::type::ARRAY) {
@@ -160,13 +272,22 @@ private:
                 return std::nullopt;
             }
 
-            if (array_size != expected_size) {
+            // the trace context is an optional last element
+            if (array_size != expected_size && array_size != expected_size + 1) {
                 PACKIO_ERROR("unexpected message size: {}", array_size);
                 return std::nullopt;
             }
 
             parsed->method = array[idx++].as<std::string>();
             parsed->args = array[idx++];
+            if (array_size > expected_size) {
+                auto [trace_id, span_id, flags] = array[idx++].as<
+                    std::tuple<uint64_t, uint64_t, uint8_t>>();
+                parsed->trace.trace_id = trace_id;
+                parsed->trace.parent_span_id = span_id;
+                parsed->trace.span_id = packio::internal::random_trace_id();
+                parsed->trace.sampled = flags & kTraceSampled;
+            }
 
             return parsed;
         }
@@ -178,7 +299,11 @@ private:
     }
 
     std::optional<::msgpack::object_handle> parsed_;
+    std::optional<std::string> frame_;
+    bool at_boundary_{true};
     std::unique_ptr<::msgpack::unpacker> unpacker_;
+    std::size_t max_message_size_;
+    bool message_size_exceeded_{false};
 };
 
 } // internal
@@ -229,6 +354,78 @@ public:
             "msgpack-RPC does not support named arguments");
     }
 
+    //! Serialize a notification followed by the trace context
+    template <typename... Args>
+    static auto serialize_traced_notification(
+        const trace_context& trace,
+        std::string_view method,
+        Args&&... args)
+        -> std::enable_if_t<internal::positional_args_v<Args...>, ::msgpack::sbuffer>
+    {
+        ::msgpack::sbuffer buffer;
+        ::msgpack::pack(
+            buffer,
+            std::forward_as_tuple(
+                static_cast<int>(internal::msgpack_rpc_type::notification),
+                method,
+                std::forward_as_tuple(std::forward<Args>(args)...),
+                pack_trace(trace)));
+        return buffer;
+    }
+
+    template <typename... Args>
+    static auto serialize_traced_notification(
+        const trace_context&,
+        std::string_view,
+        Args&&...)
+        -> std::enable_if_t<!internal::positional_args_v<Args...>, ::msgpack::sbuffer>
+    {
+        static_assert(
+            internal::positional_args_v<Args...>,
+            "msgpack-RPC does not support named arguments");
+    }
+
+    //! Serialize a notification at the end of a buffer, followed by the
+    //! trace context when it is valid and sampled
+    template <typename... Args>
+    static auto append_notification(
+        std::string& buffer,
+        const trace_context& trace,
+        std::string_view method,
+        Args&&... args)
+        -> std::enable_if_t<internal::positional_args_v<Args...>>
+    {
+        internal::string_writer writer{buffer};
+        if (trace.valid() && trace.sampled) {
+            ::msgpack::pack(
+                writer,
+                std::forward_as_tuple(
+                    static_cast<int>(internal::msgpack_rpc_type::notification),
+                    method,
+                    std::forward_as_tuple(std::forward<Args>(args)...),
+                    pack_trace(trace)));
+            return;
+        }
+        ::msgpack::pack(
+            writer,
+            std::forward_as_tuple(
+                static_cast<int>(internal::msgpack_rpc_type::notification),
+                method,
+                std::forward_as_tuple(std::forward<Args>(args)...)));
+    }
+
+    template <typename... Args>
+    static auto append_notification(
+        std::string&,
+        const trace_context&,
+        std::string_view,
+        Args&&...) -> std::enable_if_t<!internal::positional_args_v<Args...>>
+    {
+        static_assert(
+            internal::positional_args_v<Args...>,
+            "msgpack-RPC does not support named arguments");
+    }
+
     template <typename... Args>
     static auto serialize_request(id_type id, std::string_view method, Args&&... args)
         -> std::enable_if_t<internal::positional_args_v<Args...>, ::msgpack::sbuffer>
@@ -253,6 +450,40 @@ public:
             "msgpack-RPC does not support named arguments");
     }
 
+    //! Serialize a request followed by the trace context
+    template <typename... Args>
+    static auto serialize_traced_request(
+        const trace_context& trace,
+        id_type id,
+        std::string_view method,
+        Args&&... args)
+        -> std::enable_if_t<internal::positional_args_v<Args...>, ::msgpack::sbuffer>
+    {
+        ::msgpack::sbuffer buffer;
+        ::msgpack::pack(
+            buffer,
+            std::forward_as_tuple(
+                static_cast<int>(internal::msgpack_rpc_type::request),
+                id,
+                method,
+                std::forward_as_tuple(std::forward<Args>(args)...),
+                pack_trace(trace)));
+        return buffer;
+    }
+
+    template <typename... Args>
+    static auto serialize_traced_request(
+        const trace_context&,
+        id_type,
+        std::string_view,
+        Args&&...)
+        -> std::enable_if_t<!internal::positional_args_v<Args...>, ::msgpack::sbuffer>
+    {
+        static_assert(
+            internal::positional_args_v<Args...>,
+            "msgpack-RPC does not support named arguments");
+    }
+
     static ::msgpack::sbuffer serialize_response(id_type id)
     {
         return serialize_response(id, ::msgpack::object{});
@@ -286,6 +517,11 @@ public:
         return buffer;
     }
 
+    static net::const_buffer buffer(const std::string& buf)
+    {
+        return net::const_buffer(buf.data(), buf.size());
+    }
+
     static net::const_buffer buffer(const ::msgpack::sbuffer& buf)
     {
         return net::const_buffer(buf.data(), buf.size());
@@ -314,9 +550,97 @@ public:
             return std::nullopt;
         }
     }
+
+    //! Split the arguments of a map call, [name, [args...]], into the name
+    //! of the procedure and the arguments of each item
+    //!
+    //! The arguments still reference the zone of the request
+    static std::optional<std::pair<std::string, std::vector<::msgpack::object>>>
+    extract_map_args(const ::msgpack::object& args)
+    {
+        if (args.type != ::msgpack::type::ARRAY || args.via.array.size != 2) {
+            PACKIO_ERROR("map arguments are not a [name, items] array");
+            return std::nullopt;
+        }
+
+        const auto& name = args.via.array.ptr[0];
+        const auto& items = args.via.array.ptr[1];
+        if (name.type != ::msgpack::type::STR
+            || items.type != ::msgpack::type::ARRAY) {
+            PACKIO_ERROR("map arguments are not a [name, items] array");
+            return std::nullopt;
+        }
+
+        std::optional<std::pair<std::string, std::vector<::msgpack::object>>>
+            parsed{std::in_place};
+        parsed->first = name.as<std::string>();
+        parsed->second.assign(
+            items.via.array.ptr, items.via.array.ptr + items.via.array.size);
+        return parsed;
+    }
+
+private:
+    // the trace context is packed as [trace_id, span_id, flags]
+    static std::tuple<uint64_t, uint64_t, uint8_t> pack_trace(
+        const trace_context& trace)
+    {
+        return {
+            trace.trace_id,
+            trace.span_id,
+            trace.sampled ? internal::kTraceSampled : uint8_t{0}};
+    }
 };
 
 } // msgpack_rpc
 } // packio
 
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+{
+    namespace adaptor {
+
+    // an item of a map call is packed as [error, result], like a response
+    template <typename T>
+    struct pack<::packio::internal::map_item<T>> {
+        template <typename Stream>
+        packer<Stream>& operator()(
+            packer<Stream>& o,
+            const ::packio::internal::map_item<T>& item) const
+        {
+            o.pack_array(2);
+            if (!item.value) {
+                o.pack(item.error);
+                o.pack_nil();
+                return o;
+            }
+
+            o.pack_nil();
+            if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                o.pack_nil();
+            }
+            else {
+                o.pack(*item.value);
+            }
+            return o;
+        }
+    };
+
+    // bytes are packed as bin, like std::vector<unsigned char>
+    template <>
+    struct pack<::packio::bytes> : pack<std::vector<uint8_t>> {
+    };
+
+    template <>
+    struct convert<::packio::bytes> : convert<std::vector<uint8_t>> {
+    };
+
+    template <>
+    struct object_with_zone<::packio::bytes>
+        : object_with_zone<std::vector<uint8_t>> {
+    };
+
+    } // adaptor
+} // MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS)
+} // msgpack
+
 #endif // PACKIO_MSGPACK_RPC_RPC_H
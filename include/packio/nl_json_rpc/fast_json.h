@@ -0,0 +1,668 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_NL_JSON_RPC_FAST_JSON_H
+#define PACKIO_NL_JSON_RPC_FAST_JSON_H
+
+#include <cerrno>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#if defined(__AVX2__)
+#define PACKIO_JSON_AVX2 1
+#include <immintrin.h>
+#endif // defined(__AVX2__)
+
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PACKIO_JSON_SSE2 1
+#include <emmintrin.h>
+#endif // defined(__SSE2__) || ...
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif // defined(_MSC_VER)
+
+#include <nlohmann/json.hpp>
+
+namespace packio {
+namespace nl_json_rpc {
+namespace internal {
+
+// Serialization and parsing of nlohmann::json with vectorized string
+// scanning. The strings are copied by runs of characters that need no
+// escaping, the output is identical to nlohmann::json::dump() and the
+// values identical to nlohmann::json::parse(). Everything unusual is
+// left to nlohmann: the numbers are formatted by its serializer, invalid
+// input is parsed again by nlohmann to throw the same exceptions.
+
+inline unsigned count_trailing_zeros(uint32_t mask) noexcept
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else // defined(_MSC_VER)
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif // defined(_MSC_VER)
+}
+
+// true for a quote, a backslash, a control character or a non-ASCII byte
+constexpr bool is_special(char c) noexcept
+{
+    const auto byte = static_cast<unsigned char>(c);
+    return byte < 0x20 || byte >= 0x80 || c == '"' || c == '\\';
+}
+
+// first special character of [first, last), last if there is none
+inline const char* find_special(const char* first, const char* last) noexcept
+{
+    // signed comparisons to 0x20 also match the bytes above 0x7f,
+    // they are negative
+#if defined(PACKIO_JSON_AVX2)
+    const __m256i quote32 = _mm256_set1_epi8('"');
+    const __m256i backslash32 = _mm256_set1_epi8('\\');
+    const __m256i space32 = _mm256_set1_epi8(0x20);
+    while (last - first >= 32) {
+        const __m256i chunk =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        const __m256i special = _mm256_or_si256(
+            _mm256_cmpgt_epi8(space32, chunk),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(chunk, quote32),
+                _mm256_cmpeq_epi8(chunk, backslash32)));
+        const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(special));
+        if (mask != 0) {
+            return first + count_trailing_zeros(mask);
+        }
+        first += 32;
+    }
+#endif // defined(PACKIO_JSON_AVX2)
+#if defined(PACKIO_JSON_SSE2)
+    const __m128i quote16 = _mm_set1_epi8('"');
+    const __m128i backslash16 = _mm_set1_epi8('\\');
+    const __m128i space16 = _mm_set1_epi8(0x20);
+    while (last - first >= 16) {
+        const __m128i chunk =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        const __m128i special = _mm_or_si128(
+            _mm_cmplt_epi8(chunk, space16),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(chunk, quote16),
+                _mm_cmpeq_epi8(chunk, backslash16)));
+        const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(special));
+        if (mask != 0) {
+            return first + count_trailing_zeros(mask);
+        }
+        first += 16;
+    }
+#endif // defined(PACKIO_JSON_SSE2)
+    while (first != last && !is_special(*first)) {
+        ++first;
+    }
+    return first;
+}
+
+// length of the valid UTF-8 sequence starting at a non-ASCII byte,
+// 0 if the sequence is invalid or truncated
+inline std::size_t utf8_sequence_length(
+    const char* first,
+    const char* last) noexcept
+{
+    const auto byte = [first](std::size_t i) {
+        return static_cast<unsigned char>(first[i]);
+    };
+    const unsigned char lead = byte(0);
+    // range of the second byte, excluding overlong encodings,
+    // surrogates and code points above U+10FFFF
+    unsigned char min = 0x80;
+    unsigned char max = 0xbf;
+    std::size_t length = 0;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+        length = 2;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef) {
+        length = 3;
+        min = lead == 0xe0 ? 0xa0 : min;
+        max = lead == 0xed ? 0x9f : max;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4) {
+        length = 4;
+        min = lead == 0xf0 ? 0x90 : min;
+        max = lead == 0xf4 ? 0x8f : max;
+    }
+    else {
+        return 0;
+    }
+    if (static_cast<std::size_t>(last - first) < length || byte(1) < min
+        || byte(1) > max) {
+        return 0;
+    }
+    for (std::size_t i = 2; i < length; ++i) {
+        if ((byte(i) & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+//! Serialize like nlohmann::json::dump() without indentation
+class json_writer {
+public:
+    explicit json_writer(std::string& out) : out_{out} {}
+
+    void write(const nlohmann::json& value)
+    {
+        switch (value.type()) {
+        case nlohmann::json::value_t::object: {
+            const auto& object =
+                value.get_ref<const nlohmann::json::object_t&>();
+            out_.push_back('{');
+            bool first = true;
+            for (const auto& [key, element] : object) {
+                if (!first) {
+                    out_.push_back(',');
+                }
+                first = false;
+                write_string(key);
+                out_.push_back(':');
+                write(element);
+            }
+            out_.push_back('}');
+            return;
+        }
+        case nlohmann::json::value_t::array: {
+            const auto& array = value.get_ref<const nlohmann::json::array_t&>();
+            out_.push_back('[');
+            bool first = true;
+            for (const auto& element : array) {
+                if (!first) {
+                    out_.push_back(',');
+                }
+                first = false;
+                write(element);
+            }
+            out_.push_back(']');
+            return;
+        }
+        case nlohmann::json::value_t::string:
+            write_string(value.get_ref<const nlohmann::json::string_t&>());
+            return;
+        case nlohmann::json::value_t::boolean:
+            out_ += value.get<bool>() ? "true" : "false";
+            return;
+        case nlohmann::json::value_t::null:
+            out_ += "null";
+            return;
+        default:
+            // numbers, binary and discarded values
+            if (!serializer_) {
+                serializer_.emplace(
+                    nlohmann::detail::output_adapter<char, std::string>(out_),
+                    ' ');
+            }
+            serializer_->dump(value, false, false, 0);
+            return;
+        }
+    }
+
+private:
+    void write_string(const std::string& str)
+    {
+        const std::size_t start = out_.size();
+        const char* first = str.data();
+        const char* const last = first + str.size();
+        out_.push_back('"');
+        while (true) {
+            const char* special = find_special(first, last);
+            out_.append(first, special);
+            if (special == last) {
+                break;
+            }
+            const char c = *special;
+            if (static_cast<unsigned char>(c) >= 0x80) {
+                const std::size_t length = utf8_sequence_length(special, last);
+                if (length == 0) {
+                    // same exception, or same output, as nlohmann
+                    out_.resize(start);
+                    out_ += nlohmann::json(str).dump();
+                    return;
+                }
+                out_.append(special, length);
+                first = special + length;
+                continue;
+            }
+            write_escaped(c);
+            first = special + 1;
+        }
+        out_.push_back('"');
+    }
+
+    void write_escaped(char c)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        switch (c) {
+        case '"':
+            out_ += "\\\"";
+            return;
+        case '\\':
+            out_ += "\\\\";
+            return;
+        case '\b':
+            out_ += "\\b";
+            return;
+        case '\t':
+            out_ += "\\t";
+            return;
+        case '\n':
+            out_ += "\\n";
+            return;
+        case '\f':
+            out_ += "\\f";
+            return;
+        case '\r':
+            out_ += "\\r";
+            return;
+        default: {
+            const auto byte = static_cast<unsigned char>(c);
+            const char escaped[] = {
+                '\\', 'u', '0', '0', hex[byte >> 4], hex[byte & 0xf]};
+            out_.append(escaped, sizeof(escaped));
+            return;
+        }
+        }
+    }
+
+    std::string& out_;
+    std::optional<nlohmann::detail::serializer<nlohmann::json>> serializer_;
+};
+
+//! Parse like nlohmann::json::parse(), reject what it would not
+//! parse the same way
+class json_reader {
+public:
+    explicit json_reader(std::string_view input)
+        : pos_{input.data()}, end_{input.data() + input.size()}
+    {
+    }
+
+    //! Parse the whole input, false if it is not valid or deeper than
+    //! the recursion allows
+    bool read(nlohmann::json& value)
+    {
+        skip_whitespace();
+        if (!read_value(value, 0)) {
+            return false;
+        }
+        skip_whitespace();
+        return pos_ == end_;
+    }
+
+private:
+    static constexpr int kMaxDepth = 256;
+
+    bool read_value(nlohmann::json& value, int depth)
+    {
+        if (pos_ == end_) {
+            return false;
+        }
+        switch (*pos_) {
+        case '{':
+            return read_object(value, depth + 1);
+        case '[':
+            return read_array(value, depth + 1);
+        case '"': {
+            ++pos_;
+            std::string str;
+            if (!read_string(str)) {
+                return false;
+            }
+            value = std::move(str);
+            return true;
+        }
+        case 't':
+            value = true;
+            return read_literal("true");
+        case 'f':
+            value = false;
+            return read_literal("false");
+        case 'n':
+            value = nullptr;
+            return read_literal("null");
+        default:
+            return read_number(value);
+        }
+    }
+
+    bool read_object(nlohmann::json& value, int depth)
+    {
+        if (depth > kMaxDepth) {
+            return false;
+        }
+        ++pos_;
+        value = nlohmann::json::object();
+        auto& object = value.get_ref<nlohmann::json::object_t&>();
+        skip_whitespace();
+        if (consume('}')) {
+            return true;
+        }
+        while (true) {
+            std::string key;
+            if (!consume('"') || !read_string(key)) {
+                return false;
+            }
+            skip_whitespace();
+            if (!consume(':')) {
+                return false;
+            }
+            skip_whitespace();
+            // the last duplicate key wins, like nlohmann
+            if (!read_value(object[std::move(key)], depth)) {
+                return false;
+            }
+            skip_whitespace();
+            if (!consume(',')) {
+                return consume('}');
+            }
+            skip_whitespace();
+        }
+    }
+
+    bool read_array(nlohmann::json& value, int depth)
+    {
+        if (depth > kMaxDepth) {
+            return false;
+        }
+        ++pos_;
+        value = nlohmann::json::array();
+        auto& array = value.get_ref<nlohmann::json::array_t&>();
+        skip_whitespace();
+        if (consume(']')) {
+            return true;
+        }
+        while (true) {
+            if (!read_value(array.emplace_back(), depth)) {
+                return false;
+            }
+            skip_whitespace();
+            if (!consume(',')) {
+                return consume(']');
+            }
+            skip_whitespace();
+        }
+    }
+
+    // read the rest of a string, after the opening quote
+    bool read_string(std::string& str)
+    {
+        while (true) {
+            const char* special = find_special(pos_, end_);
+            str.append(pos_, special);
+            pos_ = special;
+            if (pos_ == end_) {
+                return false;
+            }
+            const auto c = static_cast<unsigned char>(*pos_);
+            if (c == '"') {
+                ++pos_;
+                return true;
+            }
+            if (c == '\\') {
+                if (!read_escape(str)) {
+                    return false;
+                }
+                continue;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            const std::size_t length = utf8_sequence_length(pos_, end_);
+            if (length == 0) {
+                return false;
+            }
+            str.append(pos_, length);
+            pos_ += length;
+        }
+    }
+
+    bool read_escape(std::string& str)
+    {
+        ++pos_;
+        if (pos_ == end_) {
+            return false;
+        }
+        switch (*pos_++) {
+        case '"':
+            str.push_back('"');
+            return true;
+        case '\\':
+            str.push_back('\\');
+            return true;
+        case '/':
+            str.push_back('/');
+            return true;
+        case 'b':
+            str.push_back('\b');
+            return true;
+        case 'f':
+            str.push_back('\f');
+            return true;
+        case 'n':
+            str.push_back('\n');
+            return true;
+        case 'r':
+            str.push_back('\r');
+            return true;
+        case 't':
+            str.push_back('\t');
+            return true;
+        case 'u':
+            return read_code_point(str);
+        default:
+            return false;
+        }
+    }
+
+    // read the code point of a \u escape, and of the following one
+    // for a surrogate pair
+    bool read_code_point(std::string& str)
+    {
+        long code_point = read_hex4();
+        if (code_point >= 0xdc00 && code_point <= 0xdfff) {
+            return false;
+        }
+        if (code_point >= 0xd800 && code_point <= 0xdbff) {
+            if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+                return false;
+            }
+            pos_ += 2;
+            const long low = read_hex4();
+            if (low < 0xdc00 || low > 0xdfff) {
+                return false;
+            }
+            code_point = 0x10000 + ((code_point - 0xd800) << 10)
+                         + (low - 0xdc00);
+        }
+        if (code_point < 0) {
+            return false;
+        }
+        const auto cp = static_cast<uint32_t>(code_point);
+        if (cp < 0x80) {
+            str.push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800) {
+            str.push_back(static_cast<char>(0xc0 | (cp >> 6)));
+            str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else if (cp < 0x10000) {
+            str.push_back(static_cast<char>(0xe0 | (cp >> 12)));
+            str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        else {
+            str.push_back(static_cast<char>(0xf0 | (cp >> 18)));
+            str.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+            str.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+            str.push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+        }
+        return true;
+    }
+
+    // value of 4 hexadecimal digits, -1 if invalid
+    long read_hex4()
+    {
+        if (end_ - pos_ < 4) {
+            return -1;
+        }
+        long value = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = *pos_++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value += c - '0';
+            }
+            else if (c >= 'a' && c <= 'f') {
+                value += c - 'a' + 10;
+            }
+            else if (c >= 'A' && c <= 'F') {
+                value += c - 'A' + 10;
+            }
+            else {
+                return -1;
+            }
+        }
+        return value;
+    }
+
+    // convert the numbers like the lexer of nlohmann: unsigned and signed
+    // integers when they fit, floating point otherwise
+    bool read_number(nlohmann::json& value)
+    {
+        const char* start = pos_;
+        const bool is_signed = consume('-');
+        bool is_float = false;
+        if (!consume('0') && !consume_digits()) {
+            return false;
+        }
+        if (consume('.')) {
+            is_float = true;
+            if (!consume_digits()) {
+                return false;
+            }
+        }
+        if (consume('e') || consume('E')) {
+            is_float = true;
+            if (!consume('+')) {
+                consume('-');
+            }
+            if (!consume_digits()) {
+                return false;
+            }
+        }
+
+        std::string token{start, pos_};
+        char* token_end = nullptr;
+        errno = 0;
+        if (!is_float && !is_signed) {
+            const auto x = std::strtoull(token.c_str(), &token_end, 10);
+            if (errno == 0) {
+                value = static_cast<nlohmann::json::number_unsigned_t>(x);
+                return true;
+            }
+        }
+        else if (!is_float) {
+            const auto x = std::strtoll(token.c_str(), &token_end, 10);
+            if (errno == 0) {
+                value = static_cast<nlohmann::json::number_integer_t>(x);
+                return true;
+            }
+        }
+
+        const char decimal_point = *std::localeconv()->decimal_point;
+        if (decimal_point != '.') {
+            for (char& c : token) {
+                c = c == '.' ? decimal_point : c;
+            }
+        }
+        const double x = std::strtod(token.c_str(), &token_end);
+        if (!std::isfinite(x)) {
+            return false;
+        }
+        value = x;
+        return true;
+    }
+
+    bool read_literal(std::string_view literal)
+    {
+        if (std::string_view{pos_, static_cast<std::size_t>(end_ - pos_)}
+                .substr(0, literal.size())
+            != literal) {
+            return false;
+        }
+        pos_ += literal.size();
+        return true;
+    }
+
+    bool consume_digits()
+    {
+        const char* start = pos_;
+        while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9') {
+            ++pos_;
+        }
+        return pos_ != start;
+    }
+
+    bool consume(char c)
+    {
+        if (pos_ == end_ || *pos_ != c) {
+            return false;
+        }
+        ++pos_;
+        return true;
+    }
+
+    void skip_whitespace()
+    {
+        while (pos_ != end_
+               && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n'
+                   || *pos_ == '\r')) {
+            ++pos_;
+        }
+    }
+
+    const char* pos_;
+    const char* const end_;
+};
+
+//! Same as value.dump()
+inline std::string dump(const nlohmann::json& value)
+{
+    std::string out;
+    json_writer{out}.write(value);
+    return out;
+}
+
+//! Same as nlohmann::json::parse(input), including the exceptions
+inline nlohmann::json parse(std::string_view input)
+{
+#if !JSON_DIAGNOSTICS
+    // the diagnostics need the parents that only nlohmann sets
+    nlohmann::json value;
+    if (json_reader{input}.read(value)) {
+        return value;
+    }
+#endif // !JSON_DIAGNOSTICS
+    return nlohmann::json::parse(input.begin(), input.end());
+}
+
+} // internal
+} // nl_json_rpc
+} // packio
+
+#endif // PACKIO_NL_JSON_RPC_FAST_JSON_H
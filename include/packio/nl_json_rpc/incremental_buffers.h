@@ -7,14 +7,31 @@
 
 #include <cassert>
 #include <deque>
+#include <limits>
 #include <optional>
 #include <string>
 
+#include "../internal/frame.h"
+
 namespace packio {
 namespace nl_json_rpc {
 
+//! Split a stream into JSON messages and compressed frames
 class incremental_buffers {
 public:
+    explicit incremental_buffers(
+        std::size_t max_message_size = std::numeric_limits<std::size_t>::max())
+        : max_message_size_{max_message_size}
+    {
+    }
+
+    //! True if a message bigger than the maximum size has been received,
+    //! nothing is parsed anymore once this happened
+    bool message_size_exceeded() const noexcept
+    {
+        return message_size_exceeded_;
+    }
+
     std::size_t available_buffers() const
     { //
         return serialized_objects_.size();
@@ -33,6 +50,9 @@ public:
 
     void feed(std::string_view data)
     {
+        if (message_size_exceeded_) {
+            return;
+        }
         reserve_in_place_buffer(data.size());
         std::copy(begin(data), end(data), in_place_buffer());
         in_place_buffer_consumed(data.size());
@@ -48,9 +68,15 @@ public:
         return raw_buffer_.size() - buffer_.size();
     }
 
+    //! Size of the data received but not split into messages yet
+    std::size_t in_place_buffer_size() const
+    { //
+        return buffer_.size();
+    }
+
     void in_place_buffer_consumed(std::size_t bytes)
     {
-        if (bytes == 0) {
+        if (bytes == 0 || message_size_exceeded_) {
             return;
         }
         incremental_parse(bytes);
@@ -58,7 +84,7 @@ public:
 
     void reserve_in_place_buffer(std::size_t bytes)
     {
-        if (in_place_buffer_capacity() >= bytes) {
+        if (in_place_buffer_capacity() >= bytes || message_size_exceeded_) {
             return;
         }
         raw_buffer_.resize(buffer_.size() + bytes);
@@ -67,24 +93,41 @@ public:
 private:
     void incremental_parse(std::size_t bytes)
     {
-        if (buffer_.empty()) {
-            std::string_view new_data{in_place_buffer(), bytes};
-            auto first_pos = new_data.find_first_of("{[");
-            if (first_pos == std::string::npos) {
-                return;
-            }
-
-            initialize(new_data[first_pos]);
-        }
-
-        std::size_t token_pos = buffer_.size();
+        // first byte to scan, the bytes of the current message received
+        // before have already been scanned
+        std::size_t search_pos = buffer_.size();
         buffer_ = std::string_view{raw_buffer_.data(), buffer_.size() + bytes};
 
         while (true) {
-            token_pos = buffer_.find_first_of(tokens_, token_pos + 1);
+            if (depth_ == 0) {
+                // between two messages, drop what precedes the next one
+                std::size_t first_pos = buffer_.find_first_of(kMessageStarts);
+                if (first_pos == std::string::npos) {
+                    buffer_ = std::string_view{};
+                    return;
+                }
+                drop_front(first_pos);
+
+                if (packio::internal::is_frame_start(buffer_.front())) {
+                    if (!extract_frame()) {
+                        return;
+                    }
+                    continue;
+                }
+
+                initialize(buffer_.front());
+                search_pos = 1;
+            }
+
+            // only the closing quote matters in a string, find(char)
+            // is a vectorized memchr where find_first_of tests each byte
+            std::size_t token_pos =
+                in_string_ ? buffer_.find('"', search_pos)
+                           : buffer_.find_first_of(tokens_, search_pos);
             if (token_pos == std::string::npos) {
                 break;
             }
+            search_pos = token_pos + 1;
 
             char token = buffer_[token_pos];
             if (token == '"' && !is_escaped(token_pos)) {
@@ -100,14 +143,11 @@ private:
                 if (--depth_ == 0) {
                     // found objet, store the interesting part of the buffer
                     std::size_t buffer_size = token_pos + 1;
-                    std::string new_raw_buffer = raw_buffer_.substr(buffer_size);
-                    raw_buffer_.resize(buffer_size);
-                    serialized_objects_.push_back(std::move(raw_buffer_));
-                    // then clear the buffer and re-feed the rest
-                    std::size_t bytes_left = buffer_.size() - buffer_size;
-                    raw_buffer_ = std::move(new_raw_buffer);
-                    buffer_ = std::string_view{raw_buffer_.data(), bytes_left};
-                    token_pos -= buffer_size;
+                    if (buffer_size > max_message_size_) {
+                        set_message_size_exceeded();
+                        return;
+                    }
+                    pop_front(buffer_size);
                 }
             }
             else {
@@ -115,6 +155,61 @@ private:
                 ++depth_;
             }
         }
+
+        // bytes not yet part of a complete object, stop before buffering
+        // more of a message that can't fit anyway
+        if (buffer_.size() > max_message_size_) {
+            set_message_size_exceeded();
+        }
+    }
+
+    // store the compressed frame starting the buffer,
+    // false if it is not complete yet
+    bool extract_frame()
+    {
+        auto header = packio::internal::parse_frame_header(
+            buffer_.data(), buffer_.size());
+        if (!header) {
+            return false;
+        }
+        if (header->frame_size() > max_message_size_
+            || header->original_size > max_message_size_) {
+            set_message_size_exceeded();
+            return false;
+        }
+        if (buffer_.size() < header->frame_size()) {
+            return false;
+        }
+        pop_front(header->frame_size());
+        return true;
+    }
+
+    // store the first bytes of the buffer as a message
+    void pop_front(std::size_t size)
+    {
+        std::string new_raw_buffer = raw_buffer_.substr(size);
+        raw_buffer_.resize(size);
+        serialized_objects_.push_back(std::move(raw_buffer_));
+        // then clear the buffer and re-feed the rest
+        std::size_t bytes_left = buffer_.size() - size;
+        raw_buffer_ = std::move(new_raw_buffer);
+        buffer_ = std::string_view{raw_buffer_.data(), bytes_left};
+    }
+
+    void drop_front(std::size_t size)
+    {
+        if (size == 0) {
+            return;
+        }
+        raw_buffer_.erase(0, size);
+        buffer_ = std::string_view{raw_buffer_.data(), buffer_.size() - size};
+    }
+
+    void set_message_size_exceeded()
+    {
+        message_size_exceeded_ = true;
+        buffer_ = std::string_view{};
+        raw_buffer_ = std::string{};
     }
 
     bool is_escaped(std::size_t pos)
@@ -147,8 +242,12 @@ private:
         in_string_ = false;
     }
 
+    // a compressed frame or the opening token of an object
+    static constexpr char kMessageStarts[] = {
+        '{', '[', static_cast<char>(packio::internal::kFrameMarker), '\0'};
+
     bool in_string_;
-    int depth_;
+    int depth_{0};
     char first_char_;
     char last_char_;
     const char* tokens_;
@@ -156,6 +255,9 @@ private:
     std::string_view buffer_;
     std::string raw_buffer_;
 
+    std::size_t max_message_size_;
+    bool message_size_exceeded_{false};
+
     std::deque<std::string> serialized_objects_;
 };
 
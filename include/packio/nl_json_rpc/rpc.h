@@ -5,14 +5,25 @@
 #ifndef PACKIO_NL_JSON_RPC_RPC_H
 #define PACKIO_NL_JSON_RPC_RPC_H
 
+#include <cstdio>
+#include <cstdlib>
 #include <deque>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <nlohmann/json.hpp>
 
 #include "../arg.h"
+#include "../bytes.h"
+#include "../internal/base64.h"
 #include "../internal/config.h"
 #include "../internal/log.h"
 #include "../internal/rpc.h"
+#include "../trace_context.h"
+#include "fast_json.h"
 #include "incremental_buffers.h"
 
 namespace packio {
@@ -34,6 +45,7 @@ struct request {
     internal::id_type id;
     std::string method;
     native_type args;
+    trace_context trace; //!< Trace context of the caller, if any
 };
 
 //! The object representing the response to a call
@@ -46,6 +58,12 @@ struct response {
 //! The incremental parser for JSON-RPC objects
 class incremental_parser {
 public:
+    explicit incremental_parser(
+        std::size_t max_message_size = std::numeric_limits<std::size_t>::max())
+        : incremental_buffers_{max_message_size}
+    {
+    }
+
     std::optional<request> get_request()
     {
         try_parse_object();
@@ -68,6 +86,13 @@ public:
         return parse_response(std::move(object));
     }
 
+    //! Get the next message if it is a compressed frame
+    std::optional<std::string> get_compressed_frame()
+    {
+        try_parse_object();
+        return std::exchange(frame_, std::nullopt);
+    }
+
     char* buffer()
     { //
         return incremental_buffers_.in_place_buffer();
@@ -78,6 +103,11 @@ public:
         return incremental_buffers_.in_place_buffer_capacity();
     }
 
+    std::size_t buffered_size() const
+    { //
+        return incremental_buffers_.in_place_buffer_size();
+    }
+
     void buffer_consumed(std::size_t bytes)
     { //
         incremental_buffers_.in_place_buffer_consumed(bytes);
@@ -88,15 +118,26 @@ public:
         incremental_buffers_.reserve_in_place_buffer(bytes);
     }
 
+    bool message_size_exceeded() const noexcept
+    {
+        return incremental_buffers_.message_size_exceeded();
+    }
+
 private:
     void try_parse_object()
     {
-        if (parsed_) {
+        if (parsed_ || frame_) {
             return;
         }
         auto buffer = incremental_buffers_.get_parsed_buffer();
-        if (buffer) {
-            parsed_ = nlohmann::json::parse(*buffer);
+        if (!buffer) {
+            return;
+        }
+        if (packio::internal::is_frame_start(buffer->front())) {
+            frame_ = std::move(buffer);
+        }
+        else {
+            parsed_ = internal::parse(*buffer);
         }
     }
 
@@ -161,10 +202,41 @@ private:
             parsed->type = call_type::request;
             parsed->id = std::move(*id_it);
         }
+
+        auto trace_it = req.find("trace");
+        if (trace_it != end(req)) {
+            parse_trace(*trace_it, parsed->trace);
+        }
         return parsed;
     }
 
+    // the trace context is {"trace_id": hex, "span_id": hex, "sampled": bool},
+    // IDs are hexadecimal strings as they do not fit in a double
+    static void parse_trace(const nlohmann::json& trace, trace_context& context)
+    {
+        if (!trace.is_object()) {
+            PACKIO_WARN("invalid trace context");
+            return;
+        }
+        auto parse_id = [&](const char* key) -> uint64_t {
+            auto it = trace.find(key);
+            if (it == end(trace) || !it->is_string()) {
+                return 0;
+            }
+            const auto& str = it->get_ref<const std::string&>();
+            return std::strtoull(str.c_str(), nullptr, 16);
+        };
+        auto sampled_it = trace.find("sampled");
+
+        context.trace_id = parse_id("trace_id");
+        context.parent_span_id = parse_id("span_id");
+        context.span_id = packio::internal::random_trace_id();
+        context.sampled = sampled_it != end(trace) && sampled_it->is_boolean()
+                          && sampled_it->get<bool>();
+    }
+
     std::optional<nlohmann::json> parsed_;
+    std::optional<std::string> frame_;
     incremental_buffers incremental_buffers_;
 };
 
@@ -194,84 +266,62 @@ public:
     }
 
     template <typename... Args>
-    static auto serialize_notification(std::string_view method, Args&&... args)
-        -> std::enable_if_t<internal::positional_args_v<Args...>, std::string>
+    static std::string serialize_notification(std::string_view method, Args&&... args)
     {
-        return nlohmann::json({
-                                  {"jsonrpc", "2.0"},
-                                  {"method", method},
-                                  {"params",
-                                   nlohmann::json::array({nlohmann::json(
-                                       std::forward<Args>(args))...})},
-                              })
-            .dump();
+        return internal::dump(make_call(method, std::forward<Args>(args)...));
     }
 
+    //! Serialize a notification with the trace context
     template <typename... Args>
-    static auto serialize_notification(std::string_view method, Args&&... args)
-        -> std::enable_if_t<internal::named_args_v<Args...>, std::string>
+    static std::string serialize_traced_notification(
+        const trace_context& trace,
+        std::string_view method,
+        Args&&... args)
     {
-        return nlohmann::json({
-                                  {"jsonrpc", "2.0"},
-                                  {"method", method},
-                                  {"params", {{args.name, args.value}...}},
-                              })
-            .dump();
+        auto call = make_call(method, std::forward<Args>(args)...);
+        call["trace"] = make_trace(trace);
+        return internal::dump(call);
     }
 
+    //! Serialize a notification at the end of a buffer, with the trace
+    //! context when it is valid and sampled
     template <typename... Args>
-    static auto serialize_notification(std::string_view, Args&&...) -> std::enable_if_t<
-        !internal::positional_args_v<Args...> && !internal::named_args_v<Args...>,
-        std::string>
+    static void append_notification(
+        std::string& buffer,
+        const trace_context& trace,
+        std::string_view method,
+        Args&&... args)
     {
-        static_assert(
-            internal::positional_args_v<Args...> || internal::named_args_v<Args...>,
-            "JSON-RPC does not support mixed named and unnamed arguments");
+        auto call = make_call(method, std::forward<Args>(args)...);
+        if (trace.valid() && trace.sampled) {
+            call["trace"] = make_trace(trace);
+        }
+        internal::json_writer{buffer}.write(call);
     }
 
     template <typename... Args>
-    static auto serialize_request(
+    static std::string serialize_request(
         const id_type& id,
         std::string_view method,
         Args&&... args)
-        -> std::enable_if_t<internal::positional_args_v<Args...>, std::string>
     {
-        return nlohmann::json({
-                                  {"jsonrpc", "2.0"},
-                                  {"method", method},
-                                  {"params",
-                                   nlohmann::json::array({nlohmann::json(
-                                       std::forward<Args>(args))...})},
-                                  {"id", id},
-                              })
-            .dump();
+        auto call = make_call(method, std::forward<Args>(args)...);
+        call["id"] = id;
+        return internal::dump(call);
     }
 
+    //! Serialize a request with the trace context
     template <typename... Args>
-    static auto serialize_request(
+    static std::string serialize_traced_request(
+        const trace_context& trace,
         const id_type& id,
         std::string_view method,
         Args&&... args)
-        -> std::enable_if_t<internal::named_args_v<Args...>, std::string>
     {
-        return nlohmann::json({
-                                  {"jsonrpc", "2.0"},
-                                  {"method", method},
-                                  {"params", {{args.name, args.value}...}},
-                                  {"id", id},
-                              })
-            .dump();
-    }
-
-    template <typename... Args>
-    static auto serialize_request(const id_type&, std::string_view, Args&&...)
-        -> std::enable_if_t<
-            !internal::positional_args_v<Args...> && !internal::named_args_v<Args...>,
-            std::string>
-    {
-        static_assert(
-            internal::positional_args_v<Args...> || internal::named_args_v<Args...>,
-            "JSON-RPC does not support mixed named and unnamed arguments");
+        auto call = make_call(method, std::forward<Args>(args)...);
+        call["id"] = id;
+        call["trace"] = make_trace(trace);
+        return internal::dump(call);
     }
 
     static std::string serialize_response(const id_type& id)
@@ -282,18 +332,17 @@ public:
     template <typename T>
     static std::string serialize_response(const id_type& id, T&& value)
     {
-        return nlohmann::json{
+        return internal::dump(nlohmann::json{
             {"jsonrpc", "2.0"},
             {"id", id},
             {"result", std::forward<T>(value)},
-        }
-            .dump();
+        });
     }
 
     template <typename T>
     static std::string serialize_error_response(const id_type& id, T&& value)
     {
-        return nlohmann::json{
+        return internal::dump(nlohmann::json{
             {"jsonrpc", "2.0"},
             {"id", id},
             {"error",
@@ -310,8 +359,7 @@ public:
                  }
                  return error;
              }()},
-        }
-            .dump();
+        });
     }
 
     static net::const_buffer buffer(const std::string& buf)
@@ -351,7 +399,79 @@ public:
         }
     }
 
+    //! Split the arguments of a map call, [name, [args...]], into the name
+    //! of the procedure and the arguments of each item
+    static std::optional<std::pair<std::string, std::vector<nlohmann::json>>>
+    extract_map_args(nlohmann::json&& args)
+    {
+        if (!args.is_array() || args.size() != 2 || !args[0].is_string()
+            || !args[1].is_array()) {
+            PACKIO_ERROR("map arguments are not a [name, items] array");
+            return std::nullopt;
+        }
+
+        std::optional<std::pair<std::string, std::vector<nlohmann::json>>>
+            parsed{std::in_place};
+        parsed->first = args[0].get<std::string>();
+        parsed->second.reserve(args[1].size());
+        for (auto& item : args[1]) {
+            parsed->second.push_back(std::move(item));
+        }
+        return parsed;
+    }
+
 private:
+    template <typename... Args>
+    static auto make_call(std::string_view method, Args&&... args)
+        -> std::enable_if_t<internal::positional_args_v<Args...>, nlohmann::json>
+    {
+        return nlohmann::json({
+            {"jsonrpc", "2.0"},
+            {"method", method},
+            {"params",
+             nlohmann::json::array({nlohmann::json(std::forward<Args>(args))...})},
+        });
+    }
+
+    template <typename... Args>
+    static auto make_call(std::string_view method, Args&&... args)
+        -> std::enable_if_t<internal::named_args_v<Args...>, nlohmann::json>
+    {
+        return nlohmann::json({
+            {"jsonrpc", "2.0"},
+            {"method", method},
+            {"params", {{args.name, args.value}...}},
+        });
+    }
+
+    template <typename... Args>
+    static auto make_call(std::string_view, Args&&...) -> std::enable_if_t<
+        !internal::positional_args_v<Args...> && !internal::named_args_v<Args...>,
+        nlohmann::json>
+    {
+        static_assert(
+            internal::positional_args_v<Args...> || internal::named_args_v<Args...>,
+            "JSON-RPC does not support mixed named and unnamed arguments");
+    }
+
+    static nlohmann::json make_trace(const trace_context& trace)
+    {
+        auto format_id = [](uint64_t id) {
+            char buffer[17];
+            std::snprintf(
+                buffer,
+                sizeof(buffer),
+                "%016llx",
+                static_cast<unsigned long long>(id));
+            return std::string{buffer};
+        };
+        return {
+            {"trace_id", format_id(trace.trace_id)},
+            {"span_id", format_id(trace.span_id)},
+            {"sampled", trace.sampled},
+        };
+    }
+
     template <typename T, typename NamesContainer>
     static T convert_named_args(const nlohmann::json& args, const NamesContainer& names)
     {
@@ -373,4 +493,55 @@ private:
 } // nl_json_rpc
 } // packio
 
+namespace nlohmann {
+
+// an item of a map call is serialized as an object holding
+// either a result or an error, like a response
+template <typename T>
+struct adl_serializer<::packio::internal::map_item<T>> {
+    static void to_json(json& j, const ::packio::internal::map_item<T>& item)
+    {
+        j = json::object();
+        if (item.value) {
+            j["result"] = *item.value;
+        }
+        else {
+            j["error"] = {{"code", -32000}, {"message", item.error}};
+        }
+    }
+};
+
+// bytes are serialized as base64 strings, encoded and decoded
+// in place in the string and in the bytes
+template <>
+struct adl_serializer<::packio::bytes> {
+    static void to_json(json& j, const ::packio::bytes& data)
+    {
+        j = json::string_t(
+            ::packio::internal::base64_encoded_size(data.size()), '\0');
+        ::packio::internal::base64_encode(
+            data.data(), data.size(), j.get_ref<json::string_t&>().data());
+    }
+
+    static void from_json(const json& j, ::packio::bytes& data)
+    {
+        if (j.is_binary()) {
+            const auto& binary = j.get_binary();
+            data.assign(binary.begin(), binary.end());
+            return;
+        }
+        const auto& encoded = j.get_ref<const json::string_t&>();
+        auto size = ::packio::internal::base64_decoded_size(encoded);
+        if (!size) {
+            throw std::invalid_argument{"invalid base64 length"};
+        }
+        data.resize(*size);
+        if (!::packio::internal::base64_decode(encoded, data.data())) {
+            throw std::invalid_argument{"invalid base64 string"};
+        }
+    }
+};
+
+} // nlohmann
+
 #endif // PACKIO_NL_JSON_RPC_RPC_H
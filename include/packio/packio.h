@@ -10,11 +10,21 @@
 
 #include "internal/config.h"
 
+#include "admin.h"
 #include "arg.h"
+#include "bytes.h"
 #include "client.h"
+#include "compression.h"
+#include "contention_profile.h"
 #include "dispatcher.h"
 #include "handler.h"
+#include "io_context_pool.h"
+#include "latency_histogram.h"
 #include "server.h"
+#include "socket_tuning.h"
+#include "threading.h"
+#include "trace_context.h"
+#include "work_stealing_pool.h"
 
 #if PACKIO_HAS_MSGPACK
 #include "msgpack_rpc/msgpack_rpc.h"
@@ -8,43 +8,92 @@
 //! @file
 //! Class @ref packio::server "server"
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
 
+#include "compression.h"
+#include "connection_stats.h"
 #include "dispatcher.h"
+#include "internal/adaptive_reserve_size.h"
 #include "internal/config.h"
 #include "internal/log.h"
+#include "internal/memory_resource.h"
 #include "internal/utils.h"
+#include "latency_histogram.h"
+#include "memory_budget.h"
 #include "server_session.h"
+#include "socket_tuning.h"
+#include "threading.h"
 #include "traits.h"
 
 namespace packio {
 
+//! Default Dispatcher of the @ref server, replaced by a @ref dispatcher
+//! locked with the mutex_type of the threading policy of the server
+struct default_dispatcher {
+};
+
+namespace internal {
+
+template <typename Dispatcher, typename Rpc, typename Threading>
+struct select_dispatcher {
+    using type = Dispatcher;
+};
+
+template <typename Rpc, typename Threading>
+struct select_dispatcher<default_dispatcher, Rpc, Threading> {
+    using type = dispatcher<Rpc, default_map, typename Threading::mutex_type>;
+};
+
+} // internal
+
 //! The server class
 //! @tparam Rpc RPC protocol implementation
 //! @tparam Acceptor Acceptor type to use for this server
 //! @tparam Dispatcher Dispatcher used to store and dispatch procedures. See @ref dispatcher
-template <typename Rpc, typename Acceptor, typename Dispatcher = dispatcher<Rpc>>
+//! and @ref default_dispatcher
+//! @tparam Threading Threading policy of the sessions, see @ref multi_threaded and @ref single_threaded
+template <
+    typename Rpc,
+    typename Acceptor,
+    typename Dispatcher = default_dispatcher,
+    typename Threading = default_threading>
 class server
-    : public std::enable_shared_from_this<server<Rpc, Acceptor, Dispatcher>> {
+    : public std::enable_shared_from_this<
+          server<Rpc, Acceptor, Dispatcher, Threading>> {
 public:
     using rpc_type = Rpc; //!< The RPC protocol type
     using acceptor_type = Acceptor; //!< The acceptor type
     using protocol_type = typename Acceptor::protocol_type; //!< The protocol type
-    using dispatcher_type = Dispatcher; //!< The dispatcher type
+    //! The dispatcher type
+    using dispatcher_type =
+        typename internal::select_dispatcher<Dispatcher, Rpc, Threading>::type;
     using executor_type =
         typename acceptor_type::executor_type; //!< The executor type
     using socket_type = std::decay_t<decltype(
         std::declval<acceptor_type>().accept())>; //!< The connection socket type
-    using session_type = server_session<rpc_type, socket_type, dispatcher_type>;
+    using threading_type = Threading; //!< The threading policy
+    using session_type =
+        server_session<rpc_type, socket_type, dispatcher_type, threading_type>;
 
-    using std::enable_shared_from_this<server<Rpc, Acceptor, Dispatcher>>::shared_from_this;
+    using std::enable_shared_from_this<
+        server<Rpc, Acceptor, Dispatcher, Threading>>::shared_from_this;
 
     //! The constructor
     //!
     //! @param acceptor The acceptor that the server will use
     //! @param dispatcher A shared pointer to the dispatcher that the server will use
     server(acceptor_type acceptor, std::shared_ptr<dispatcher_type> dispatcher)
-        : acceptor_{std::move(acceptor)}, dispatcher_ptr_{std::move(dispatcher)}
+        : acceptor_{std::move(acceptor)},
+          dispatcher_ptr_{std::move(dispatcher)},
+          balancing_strand_{acceptor_.get_executor()},
+          balancing_timer_{acceptor_.get_executor()}
     {
     }
 
@@ -70,6 +119,307 @@ public:
     //! Get the executor associated with the object
     executor_type get_executor() { return acceptor().get_executor(); }
 
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    //! Set the memory resource used to allocate the sessions
+    //!
+    //! The resource is also given to each new session, see
+    //! @ref server_session::set_memory_resource. It must outlive the
+    //! server and all its sessions.
+    //! @param resource The memory resource, nullptr to use the default
+    //! allocators
+    void set_memory_resource(std::pmr::memory_resource* resource) noexcept
+    {
+        memory_resource_ = resource;
+    }
+    //! Get the memory resource used by the server
+    std::pmr::memory_resource* get_memory_resource() const noexcept
+    {
+        return memory_resource_;
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    //! Set the size reserved by the reception buffer of the sessions
+    //!
+    //! Applies to new sessions and to the running ones,
+    //! see @ref server_session::set_buffer_reserve_size
+    void set_buffer_reserve_size(std::size_t size)
+    {
+        buffer_reserve_size_.set_fixed(size);
+        for_each_session([size](session_type& session) {
+            session.set_buffer_reserve_size(size);
+        });
+    }
+    //! Let the size reserved by the reception buffer of the sessions adapt
+    //! to the traffic
+    //!
+    //! Applies to new sessions and to the running ones,
+    //! see @ref server_session::set_adaptive_buffer_reserve_size
+    //! @param min_size The minimum size reserved
+    //! @param max_size The maximum size reserved
+    void set_adaptive_buffer_reserve_size(
+        std::size_t min_size,
+        std::size_t max_size)
+    {
+        buffer_reserve_size_.set_adaptive(min_size, max_size);
+        for_each_session([min_size, max_size](session_type& session) {
+            session.set_adaptive_buffer_reserve_size(min_size, max_size);
+        });
+    }
+    //! Get the minimum and maximum size reserved by the reception buffer
+    //! of the sessions, equal when the size is fixed
+    std::pair<std::size_t, std::size_t> get_buffer_reserve_size() const noexcept
+    {
+        return {buffer_reserve_size_.min(), buffer_reserve_size_.max()};
+    }
+
+    //! Set the maximum size of a message received by the sessions
+    //!
+    //! Applies to new sessions only, the running ones keep their limit,
+    //! see @ref server_session::set_max_message_size
+    void set_max_message_size(std::size_t size) noexcept
+    {
+        max_message_size_.store(size, std::memory_order_relaxed);
+    }
+    //! Get the maximum size of a message received by new sessions
+    std::size_t get_max_message_size() const noexcept
+    {
+        return max_message_size_.load(std::memory_order_relaxed);
+    }
+
+    //! Set the memory budget of new sessions
+    //!
+    //! See @ref server_session::set_memory_budget. The budget can be
+    //! shared with other servers.
+    //! Must be called before serving.
+    //! @param budget The budget, nullptr to disable the accounting
+    void set_memory_budget(std::shared_ptr<memory_budget> budget) noexcept
+    {
+        memory_budget_ = std::move(budget);
+    }
+    //! Get the memory budget of new sessions
+    const std::shared_ptr<memory_budget>& get_memory_budget() const noexcept
+    {
+        return memory_budget_;
+    }
+
+    //! Get the number of sessions still alive
+    std::size_t get_session_count()
+    {
+        std::size_t count = 0;
+        for_each_session([&count](session_type&) { ++count; });
+        return count;
+    }
+
+    //! Get a snapshot of the counters of each session still alive
+    //!
+    //! See @ref server_session::get_stats
+    std::vector<connection_stats> get_sessions_stats()
+    {
+        std::vector<connection_stats> stats;
+        for_each_session([&stats](session_type& session) {
+            stats.push_back(session.get_stats());
+        });
+        return stats;
+    }
+
+    //! Get the counters of the n sessions with the highest load
+    //!
+    //! Sessions are sorted by decreasing @ref connection_stats::load
+    //! @param n The maximum number of sessions to report
+    std::vector<connection_stats> get_top_sessions(std::size_t n)
+    {
+        auto stats = get_sessions_stats();
+        n = std::min(n, stats.size());
+        std::partial_sort(
+            stats.begin(),
+            stats.begin() + n,
+            stats.end(),
+            [](const auto& lhs, const auto& rhs) {
+                return lhs.load() > rhs.load();
+            });
+        stats.resize(n);
+        return stats;
+    }
+
+    //! Set the handler called when a traced request of a new session
+    //! completes
+    //!
+    //! See @ref server_session::set_trace_handler.
+    //! Must be called before serving.
+    //! @param handler The handler
+    void set_trace_handler(typename session_type::trace_handler_type handler)
+    {
+        trace_handler_ = std::move(handler);
+    }
+
+    //! Compress the responses of new sessions bigger than a threshold
+    //!
+    //! See @ref server_session::set_compression.
+    //! Must be called before serving.
+    //! @param codec The compression codec
+    //! @param threshold The size from which responses are compressed
+    void set_compression(
+        compression_codec codec,
+        std::size_t threshold = kDefaultCompressionThreshold)
+    {
+        compression_ = std::make_shared<const compression_codec>(
+            std::move(codec));
+        compression_threshold_ = threshold;
+    }
+
+    //! Set the size from which the responses of new sessions are queued
+    //! in the bulk lane
+    //!
+    //! See @ref server_session::set_bulk_message_size.
+    //! Must be called before serving.
+    void set_bulk_message_size(std::size_t size) noexcept
+    {
+        bulk_message_size_ = size;
+    }
+    //! Get the size from which the responses of new sessions are queued
+    //! in the bulk lane
+    std::size_t get_bulk_message_size() const noexcept
+    {
+        return bulk_message_size_;
+    }
+
+    //! Write the bulk responses of new sessions in fragments
+    //!
+    //! See @ref server_session::set_fragment_size.
+    //! Must be called before serving.
+    //! @param size The size of the fragments, 0 to disable
+    void set_fragment_size(std::size_t size) noexcept
+    {
+        fragment_size_ = size;
+    }
+    //! Get the size of the fragments of the bulk responses of new sessions
+    std::size_t get_fragment_size() const noexcept { return fragment_size_; }
+
+    //! Set the socket options of new sessions
+    //!
+    //! See @ref server_session::set_socket_tuning.
+    //! Must be called before serving.
+    //! @param tuning The socket options, see @ref socket_tuning
+    void set_socket_tuning(const socket_tuning& tuning) noexcept
+    {
+        tuning_ = tuning;
+    }
+    //! Get the socket options of new sessions
+    const socket_tuning& get_socket_tuning() const noexcept { return tuning_; }
+
+    //! Measure where the time of the requests of new sessions is spent
+    //!
+    //! See @ref server_session::set_socket_timestamping.
+    //! Must be called before serving.
+    //! @param enabled True to enable the timestamping
+    void set_socket_timestamping(bool enabled) noexcept
+    {
+        socket_timestamping_ = enabled;
+    }
+
+    //! Get the latency histograms of the sessions still alive, merged
+    //!
+    //! See @ref server_session::get_latency_breakdown
+    latency_breakdown get_latency_breakdown()
+    {
+        latency_breakdown breakdown;
+        for_each_session([&breakdown](session_type& session) {
+            breakdown += session.get_latency_breakdown();
+        });
+        return breakdown;
+    }
+
+    //! Run the procedures of each new session sequentially
+    //!
+    //! See @ref server_session::set_sequential_execution.
+    //! Must be called before serving.
+    //! @param enabled True to run the procedures sequentially
+    void set_sequential_execution(bool enabled) noexcept
+    {
+        sequential_execution_ = enabled;
+    }
+    //! True if the procedures of new sessions run sequentially
+    bool get_sequential_execution() const noexcept
+    {
+        return sequential_execution_;
+    }
+
+    //! Set the executor running the procedures of new sessions
+    //!
+    //! See @ref server_session::set_procedure_executor.
+    //! Must be called before serving.
+    //! @param executor The executor
+    template <typename Executor>
+    void set_procedure_executor(const Executor& executor)
+    {
+        set_procedure_executor_ = [executor](session_type& session) {
+            session.set_procedure_executor(executor);
+        };
+    }
+
+    //! Add an executor on which new sessions can be placed
+    //!
+    //! New sessions are distributed round-robin over the added executors,
+    //! their socket and all their handlers use it for their whole lifetime.
+    //! Without session executor, sessions use the executor of the acceptor.
+    //! Must be called before serving. See @ref io_context_pool::place_sessions
+    //! @param executor The executor
+    void add_session_executor(const executor_type& executor)
+    {
+        session_placements_.push_back({executor, memory_resource_});
+    }
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    //! @overload
+    //! @param executor The executor
+    //! @param resource The memory resource used by the sessions
+    //! placed on this executor, see @ref set_memory_resource
+    void add_session_executor(
+        const executor_type& executor,
+        std::pmr::memory_resource* resource)
+    {
+        session_placements_.push_back({executor, resource});
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    //! Periodically rebalance the sessions between the session executors
+    //!
+    //! The load of each session, bytes and requests received, is sampled at
+    //! each interval. When the load of the busiest executor exceeds
+    //! imbalance_ratio times the load of the least busy one, a session of
+    //! the busiest executor is moved to the least busy one. A session is only
+    //! moved between two reads, when none of its requests is in progress.
+    //! A moved session allocates from the memory resource of its new
+    //! executor, see @ref add_session_executor.
+    //! Requires at least two session executors, see @ref add_session_executor
+    //! @param interval The sampling interval
+    //! @param imbalance_ratio The ratio triggering a migration
+    void start_load_balancing(
+        std::chrono::steady_clock::duration interval,
+        double imbalance_ratio = 1.5)
+    {
+        net::dispatch(
+            balancing_strand_,
+            [self = shared_from_this(), interval, imbalance_ratio] {
+                self->balancing_interval_ = interval;
+                self->imbalance_ratio_ = imbalance_ratio;
+                async_wait_balancing(
+                    self->weak_from_this(), ++self->balancing_generation_);
+            });
+    }
+
+    //! Stop rebalancing the sessions
+    //!
+    //! Can be called from any thread, a rebalancing already running
+    //! completes but no other one starts.
+    void stop_load_balancing()
+    {
+        net::post(balancing_strand_, [self = shared_from_this()] {
+            ++self->balancing_generation_;
+            self->balancing_timer_.cancel();
+        });
+    }
+
     //! Accept one connection and initialize a session for it
     //!
     //! @param handler Handler called when a connection is accepted.
@@ -117,39 +467,276 @@ private:
             PACKIO_STATIC_ASSERT_TTRAIT(ServeHandler, session_type);
             PACKIO_TRACE("async_serve");
 
-            self_->acceptor_.async_accept(
+            std::optional<std::size_t> placement = self_->next_placement();
+            auto* resource = placement
+                                 ? self_->session_placements_[*placement].resource
+                                 : self_->memory_resource_;
+            auto accept_handler =
                 [self = self_->shared_from_this(),
+                 placement,
+                 resource,
                  handler = std::forward<ServeHandler>(handler)](
                     error_code ec, socket_type sock) mutable {
-                    std::shared_ptr<session_type> session;
                     if (ec) {
                         PACKIO_WARN("accept error: {}", ec.message());
+                        handler(ec, std::shared_ptr<session_type>{});
+                        return;
                     }
-                    else {
-                        internal::set_no_delay(sock);
-                        session = std::make_shared<session_type>(
-                            std::move(sock), self->dispatcher_ptr_);
+                    if (!placement) {
+                        auto session = self->make_session(
+                            std::move(sock), resource, 0);
+                        handler(ec, std::move(session));
+                        return;
                     }
-                    handler(ec, std::move(session));
-                });
+                    // the session is built by a thread of its executor,
+                    // so that its memory is first touched on its node
+                    auto executor =
+                        self->session_placements_[*placement].executor;
+                    net::post(
+                        executor,
+                        [self = std::move(self),
+                         placement = *placement,
+                         resource,
+                         handler = std::move(handler),
+                         sock = std::move(sock)]() mutable {
+                            auto session = self->make_session(
+                                std::move(sock), resource, placement);
+                            handler(error_code{}, std::move(session));
+                        });
+                };
+
+            if (placement) {
+                // the socket is created directly on the session executor
+                self_->acceptor_.async_accept(
+                    self_->session_placements_[*placement].executor,
+                    std::move(accept_handler));
+            }
+            else {
+                self_->acceptor_.async_accept(std::move(accept_handler));
+            }
         }
 
     private:
         server* self_;
     };
 
+    struct session_placement {
+        executor_type executor;
+        internal::memory_resource* resource;
+    };
+
+    struct registered_session {
+        std::weak_ptr<session_type> session;
+        std::size_t placement;
+    };
+
+    std::shared_ptr<session_type> make_session(
+        socket_type sock,
+        internal::memory_resource* resource,
+        std::size_t placement)
+    {
+        auto session = internal::make_shared_with_resource<session_type>(
+            resource, std::move(sock), dispatcher_ptr_);
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+        session->set_memory_resource(resource);
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        if (set_procedure_executor_) {
+            set_procedure_executor_(*session);
+        }
+        session->set_trace_handler(trace_handler_);
+        session->set_sequential_execution(sequential_execution_);
+        session->set_bulk_message_size(bulk_message_size_);
+        session->set_fragment_size(fragment_size_);
+        session->set_socket_tuning(tuning_);
+        session->set_socket_timestamping(socket_timestamping_);
+        session->set_compression(compression_, compression_threshold_);
+        auto [min_size, max_size] = get_buffer_reserve_size();
+        session->set_adaptive_buffer_reserve_size(min_size, max_size);
+        session->set_max_message_size(get_max_message_size());
+        session->set_memory_budget(memory_budget_);
+        register_session(session, placement);
+        return session;
+    }
+
+    std::optional<std::size_t> next_placement()
+    {
+        if (session_placements_.empty()) {
+            return std::nullopt;
+        }
+        auto index = next_placement_.fetch_add(1, std::memory_order_relaxed);
+        return index % session_placements_.size();
+    }
+
+    void register_session(
+        const std::shared_ptr<session_type>& session,
+        std::size_t placement)
+    {
+        std::lock_guard l{sessions_mutex_};
+        // drop the closed sessions once in a while
+        if (sessions_.size() >= 2 * live_sessions_) {
+            prune_sessions();
+        }
+        sessions_.push_back({session, placement});
+        ++live_sessions_;
+    }
+
+    void prune_sessions()
+    {
+        sessions_.erase(
+            std::remove_if(
+                sessions_.begin(),
+                sessions_.end(),
+                [](const auto& entry) { return entry.session.expired(); }),
+            sessions_.end());
+        live_sessions_ = std::max<std::size_t>(sessions_.size(), 1);
+    }
+
+    template <typename F>
+    void for_each_session(F&& f)
+    {
+        std::lock_guard l{sessions_mutex_};
+        for (const auto& entry : sessions_) {
+            if (auto session = entry.session.lock()) {
+                f(*session);
+            }
+        }
+    }
+
+    // the timer is only used from balancing_strand_, the loop ends once
+    // its generation is outdated by a stop or another start
+    static void async_wait_balancing(
+        std::weak_ptr<server> weak_self,
+        uint64_t generation)
+    {
+        auto self = weak_self.lock();
+        if (!self) {
+            return;
+        }
+        self->balancing_timer_.expires_after(self->balancing_interval_);
+        self->balancing_timer_.async_wait(net::bind_executor(
+            self->balancing_strand_,
+            [weak_self = std::move(weak_self), generation](
+                error_code ec) mutable {
+                if (ec) {
+                    return;
+                }
+                auto self = weak_self.lock();
+                if (!self || generation != self->balancing_generation_) {
+                    return;
+                }
+                self->rebalance();
+                async_wait_balancing(std::move(weak_self), generation);
+            }));
+    }
+
+    void rebalance()
+    {
+        const std::size_t n_placements = session_placements_.size();
+        if (n_placements < 2) {
+            return;
+        }
+
+        struct candidate {
+            std::shared_ptr<session_type> session;
+            registered_session* entry;
+            uint64_t load;
+        };
+
+        std::lock_guard l{sessions_mutex_};
+        prune_sessions();
+
+        std::vector<uint64_t> loads(n_placements, 0);
+        std::vector<candidate> candidates;
+        for (auto& entry : sessions_) {
+            auto session = entry.session.lock();
+            if (!session) {
+                continue;
+            }
+            uint64_t load = session->sample_load();
+            loads[entry.placement] += load;
+            candidates.push_back({std::move(session), &entry, load});
+        }
+
+        auto [min_it, max_it] = std::minmax_element(loads.begin(), loads.end());
+        std::size_t busiest = std::distance(loads.begin(), max_it);
+        std::size_t least_busy = std::distance(loads.begin(), min_it);
+        if (*max_it == 0
+            || static_cast<double>(*max_it)
+                   <= static_cast<double>(*min_it) * imbalance_ratio_) {
+            return;
+        }
+
+        // move the session whose load best evens out both executors,
+        // moving more than half of the difference would only swap them
+        const uint64_t target = (*max_it - *min_it) / 2;
+        candidate* best = nullptr;
+        for (auto& c : candidates) {
+            if (c.entry->placement != busiest || c.load == 0
+                || c.load > target) {
+                continue;
+            }
+            if (!best || c.load > best->load) {
+                best = &c;
+            }
+        }
+        if (!best) {
+            return;
+        }
+
+        PACKIO_DEBUG("migrating a session: {} -> {}", busiest, least_busy);
+        best->entry->placement = least_busy;
+        best->session->request_migration(
+            session_placements_[least_busy].executor,
+            session_placements_[least_busy].resource);
+    }
+
     acceptor_type acceptor_;
     std::shared_ptr<dispatcher_type> dispatcher_ptr_;
+    std::function<void(session_type&)> set_procedure_executor_;
+    typename session_type::trace_handler_type trace_handler_;
+    std::shared_ptr<const compression_codec> compression_;
+    std::size_t compression_threshold_{kDefaultCompressionThreshold};
+    bool sequential_execution_{false};
+    std::size_t bulk_message_size_{std::numeric_limits<std::size_t>::max()};
+    std::size_t fragment_size_{0};
+    socket_tuning tuning_;
+    bool socket_timestamping_{false};
+    internal::adaptive_reserve_size buffer_reserve_size_{
+        session_type::kDefaultBufferReserveSize};
+    typename threading_type::template atomic_type<std::size_t>
+        max_message_size_{session_type::kDefaultMaxMessageSize};
+    std::shared_ptr<memory_budget> memory_budget_;
+    internal::memory_resource* memory_resource_{nullptr};
+    std::vector<session_placement> session_placements_;
+    typename threading_type::template atomic_type<std::size_t>
+        next_placement_{0};
+
+    typename threading_type::mutex_type sessions_mutex_;
+    std::vector<registered_session> sessions_;
+    std::size_t live_sessions_{1};
+
+    typename threading_type::template strand_type<executor_type>
+        balancing_strand_;
+    net::steady_timer balancing_timer_;
+    std::chrono::steady_clock::duration balancing_interval_{};
+    double imbalance_ratio_{1.5};
+    uint64_t balancing_generation_{0};
 };
 
 //! Create a server from an acceptor
 //! @tparam Rpc RPC protocol implementation
 //! @tparam Acceptor Acceptor type to use for this server
 //! @tparam Dispatcher Dispatcher used to store and dispatch procedures. See @ref dispatcher
-template <typename Rpc, typename Acceptor, typename Dispatcher = dispatcher<Rpc>>
+//! and @ref default_dispatcher
+//! @tparam Threading Threading policy of the sessions, see @ref multi_threaded and @ref single_threaded
+template <
+    typename Rpc,
+    typename Acceptor,
+    typename Dispatcher = default_dispatcher,
+    typename Threading = default_threading>
 auto make_server(Acceptor&& acceptor)
 {
-    return std::make_shared<server<Rpc, Acceptor, Dispatcher>>(
+    return std::make_shared<server<Rpc, Acceptor, Dispatcher, Threading>>(
         std::forward<Acceptor>(acceptor));
 }
 
@@ -8,40 +8,85 @@
 //! @file
 //! Class @ref packio::server_session "server_session"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <string>
+#include <utility>
 
+#include "compression.h"
+#include "connection_stats.h"
 #include "handler.h"
+#include "internal/adaptive_reserve_size.h"
 #include "internal/config.h"
 #include "internal/log.h"
 #include "internal/manual_strand.h"
+#include "internal/memory_resource.h"
+#include "internal/movable_function.h"
 #include "internal/rpc.h"
+#include "internal/socket_timestamps.h"
 #include "internal/utils.h"
+#include "latency_histogram.h"
+#include "memory_budget.h"
+#include "socket_tuning.h"
+#include "threading.h"
+#include "trace_context.h"
 
 namespace packio {
 
 //! The server_session class, created by the @ref server
-template <typename Rpc, typename Socket, typename Dispatcher>
+template <
+    typename Rpc,
+    typename Socket,
+    typename Dispatcher,
+    typename Threading = default_threading>
 class server_session
-    : public std::enable_shared_from_this<server_session<Rpc, Socket, Dispatcher>> {
+    : public std::enable_shared_from_this<
+          server_session<Rpc, Socket, Dispatcher, Threading>> {
 public:
     using socket_type = Socket; //!< The socket type
     using protocol_type =
         typename socket_type::protocol_type; //!< The protocol type
     using executor_type =
         typename socket_type::executor_type; //!< The executor type
-    using std::enable_shared_from_this<server_session<Rpc, Socket, Dispatcher>>::shared_from_this;
+    using threading_type = Threading; //!< The threading policy
+    using std::enable_shared_from_this<
+        server_session<Rpc, Socket, Dispatcher, Threading>>::shared_from_this;
+
+    //! The handler called when a traced request completes,
+    //! with the trace context and the latency of the request
+    using trace_handler_type =
+        std::function<void(const trace_context&, std::chrono::nanoseconds)>;
 
     //! The default size reserved by the reception buffer
     static constexpr size_t kDefaultBufferReserveSize = 4096;
+    //! The default maximum size of a received message, unlimited
+    static constexpr size_t kDefaultMaxMessageSize =
+        std::numeric_limits<size_t>::max();
 
     server_session(socket_type sock, std::shared_ptr<Dispatcher> dispatcher_ptr)
         : socket_{std::move(sock)},
           dispatcher_ptr_{std::move(dispatcher_ptr)},
-          wstrand_{socket_.get_executor()}
+          wstrand_{socket_.get_executor()},
+          budget_timer_{socket_.get_executor()},
+          peer_{internal::format_peer(socket_)}
     {
     }
 
+    ~server_session()
+    {
+        if (memory_budget_) {
+            memory_budget_->release(get_stats().memory_usage());
+            memory_budget_->detach();
+        }
+    }
+
     //! Get the underlying socket
     socket_type& socket() { return socket_; }
     //! Get the underlying socket, const
@@ -51,35 +96,681 @@ public:
     executor_type get_executor() { return socket().get_executor(); }
 
     //! Set the size reserved by the reception buffer
+    //!
+    //! The size is fixed, this disables the adaptive sizing
+    //! set by @ref set_adaptive_buffer_reserve_size
     void set_buffer_reserve_size(std::size_t size) noexcept
     {
-        buffer_reserve_size_ = size;
+        buffer_reserve_size_.set_fixed(size);
     }
-    //! Get the size reserved by the reception buffer
+    //! Let the size reserved by the reception buffer adapt to the traffic
+    //!
+    //! The size grows when reads consistently fill the buffer and shrinks
+    //! after sustained small reads, staying between min_size and max_size
+    //! @param min_size The minimum size reserved
+    //! @param max_size The maximum size reserved
+    void set_adaptive_buffer_reserve_size(
+        std::size_t min_size,
+        std::size_t max_size) noexcept
+    {
+        buffer_reserve_size_.set_adaptive(min_size, max_size);
+    }
+    //! Get the size currently reserved by the reception buffer
     std::size_t get_buffer_reserve_size() const noexcept
     {
-        return buffer_reserve_size_;
+        return buffer_reserve_size_.get();
+    }
+
+    //! Set the maximum size of a received message
+    //!
+    //! The connection is closed when a bigger message is received.
+    //! Must be called before @ref start.
+    void set_max_message_size(std::size_t size) noexcept
+    {
+        max_message_size_ = size;
+    }
+    //! Get the maximum size of a received message
+    std::size_t get_max_message_size() const noexcept
+    {
+        return max_message_size_;
+    }
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    //! Set the memory resource used to allocate the asynchronous
+    //! operations of this session, the state of its completion handlers and
+    //! the boxes owning its response buffers
+    //!
+    //! The buffers of the parser and of the serialized responses, and the
+    //! procedures of the dispatcher, stay on the default heap.
+    //! @param resource The memory resource, nullptr to use the default
+    //! allocators
+    void set_memory_resource(std::pmr::memory_resource* resource) noexcept
+    {
+        memory_resource_ = resource;
+    }
+    //! Get the memory resource used by this session
+    std::pmr::memory_resource* get_memory_resource() const noexcept
+    {
+        return memory_resource_;
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    //! Set the memory budget shared with other sessions
+    //!
+    //! The session accounts the memory held by its reception buffer, its
+    //! pending requests and its queued responses in the budget. When the
+    //! budget is exceeded, the session may stop reading until the budget
+    //! allows it again, see @ref memory_budget.
+    //! Must be called before @ref start.
+    //! @param budget The budget, nullptr to disable the accounting
+    void set_memory_budget(std::shared_ptr<memory_budget> budget) noexcept
+    {
+        if (memory_budget_) {
+            memory_budget_->detach();
+        }
+        memory_budget_ = std::move(budget);
+        if (memory_budget_) {
+            memory_budget_->attach();
+        }
+    }
+    //! Get the memory budget of this session
+    const std::shared_ptr<memory_budget>& get_memory_budget() const noexcept
+    {
+        return memory_budget_;
+    }
+
+    //! Set the handler called when a traced request completes
+    //!
+    //! The handler receives the trace context of the request, see
+    //! @ref trace_context, and its latency, from its reception to the end
+    //! of the write of its response. It is called from any thread.
+    //! Must be called before @ref start.
+    //! @param handler The handler
+    void set_trace_handler(trace_handler_type handler)
+    {
+        trace_handler_ = std::move(handler);
+    }
+
+    //! Compress the responses bigger than a threshold
+    //!
+    //! Compression is negotiated: responses are only compressed once the
+    //! client announced it supports the same codec, see
+    //! @ref client::set_compression. Compressed requests are decompressed
+    //! on the executor running the procedures.
+    //! Must be called before @ref start.
+    //! @param codec The compression codec
+    //! @param threshold The size from which responses are compressed
+    void set_compression(
+        compression_codec codec,
+        std::size_t threshold = kDefaultCompressionThreshold)
+    {
+        set_compression(
+            std::make_shared<const compression_codec>(std::move(codec)),
+            threshold);
+    }
+
+    //! Set the executor running the procedures of this session
+    //!
+    //! By default procedures run on the executor of the session. With another
+    //! executor, for instance a @ref work_stealing_pool, the socket I/O stays
+    //! on the executor of the session and the responses are sent from it.
+    //! Must be called before @ref start.
+    //! @param executor The executor
+    template <typename Executor>
+    void set_procedure_executor(const Executor& executor)
+    {
+        procedure_poster_ = [executor](procedure_type procedure) {
+            net::post(executor, std::move(procedure));
+        };
+    }
+
+    //! Set the size from which responses are queued in the bulk lane
+    //!
+    //! Responses in the bulk lane are written when no smaller response is
+    //! waiting, so that small responses are not blocked behind big ones,
+    //! and at least once every 16 smaller responses, so that they still
+    //! progress under a sustained traffic of small responses.
+    //! Responses are written in order by default.
+    //! Must be called before @ref start.
+    void set_bulk_message_size(std::size_t size) noexcept
+    {
+        bulk_message_size_ = size;
+    }
+    //! Get the size from which responses are queued in the bulk lane
+    std::size_t get_bulk_message_size() const noexcept
+    {
+        return bulk_message_size_;
+    }
+
+    //! Write the responses of the bulk lane in fragments
+    //!
+    //! Smaller responses are written between the fragments. The client
+    //! must support fragments, which packio clients do since they were
+    //! introduced, see @ref set_bulk_message_size.
+    //! Must be called before @ref start.
+    //! @param size The size of the fragments, 0 to disable
+    void set_fragment_size(std::size_t size) noexcept
+    {
+        fragment_size_ = size;
+    }
+    //! Get the size of the fragments of the bulk responses
+    std::size_t get_fragment_size() const noexcept { return fragment_size_; }
+
+    //! Run the procedures of this session one at a time, in arrival order
+    //!
+    //! A request starts once the previous one completed, including
+    //! asynchronous and coroutine procedures, and its response is queued
+    //! after the response of the previous one. Other sessions still run
+    //! in parallel.
+    //! Must be called before @ref start.
+    //! @param enabled True to run the procedures sequentially
+    void set_sequential_execution(bool enabled) noexcept
+    {
+        sequential_execution_ = enabled;
+    }
+    //! True if the procedures of this session run sequentially
+    bool get_sequential_execution() const noexcept
+    {
+        return sequential_execution_;
+    }
+
+    //! Set the socket options of this session
+    //!
+    //! The options are applied once, when the session starts.
+    //! Must be called before @ref start.
+    //! @param tuning The socket options, see @ref socket_tuning
+    void set_socket_tuning(const socket_tuning& tuning) noexcept
+    {
+        tuning_ = tuning;
+    }
+    //! Get the socket options of this session
+    const socket_tuning& get_socket_tuning() const noexcept { return tuning_; }
+
+    //! Measure where the time of the requests is spent
+    //!
+    //! Enables the software timestamps of the kernel on the socket, on
+    //! Linux TCP sockets, and fills the histograms returned by
+    //! @ref get_latency_breakdown. The application stages are measured
+    //! even when the kernel timestamps are not supported.
+    //! Must be called before @ref start.
+    //! @param enabled True to enable the timestamping
+    void set_socket_timestamping(bool enabled) noexcept
+    {
+        socket_timestamping_ = enabled;
+    }
+
+    //! Get the latency histograms of this session
+    //!
+    //! Empty unless @ref set_socket_timestamping is enabled.
+    //! Can be called from any thread.
+    latency_breakdown get_latency_breakdown() const
+    {
+        return timestamps_.get();
+    }
+
+    //! Get a snapshot of the counters of this session
+    //!
+    //! Can be called from any thread, the counters are updated with relaxed
+    //! atomics and may be slightly inconsistent with each other
+    connection_stats get_stats() const
+    {
+        connection_stats stats;
+        stats.peer = peer_;
+        counters_.fill(stats);
+        stats.in_progress = in_progress_.load(std::memory_order_relaxed);
+        return stats;
     }
 
     //! Start the session
-    void start() { this->async_read(parser_type{}); }
+    void start()
+    {
+        internal::apply_socket_tuning(socket_, tuning_);
+        if (socket_timestamping_) {
+            timestamps_.enable(socket_);
+        }
+        async_read(parser_type{max_message_size_}, shared_from_this());
+    }
 
 private:
     using parser_type = typename Rpc::incremental_parser_type;
     using request_type = typename Rpc::request_type;
+    // each outstanding operation owns exactly one reference to the session,
+    // which is moved along the chain of handlers instead of being
+    // re-acquired with shared_from_this at each step
+    using session_ptr = std::shared_ptr<server_session>;
+    using procedure_type = internal::movable_function<void()>;
+    using procedure_poster_type = std::function<void(procedure_type)>;
+    using clock_type = std::chrono::steady_clock;
+    using counter_type =
+        typename threading_type::template atomic_type<uint64_t>;
+
+    // what a request holds until it completes
+    struct request_context {
+        clock_type::time_point received;
+        std::size_t bytes;
+        trace_context trace;
+        // only set with socket timestamping
+        clock_type::time_point responded{};
+    };
+
+    // let the server share its poster with its sessions,
+    // sample their load and migrate them
+    template <typename, typename, typename, typename>
+    friend class server;
+
+    // weight of a request compared to a byte received when measuring the load
+    static constexpr uint64_t kRequestLoad = connection_stats::kRequestLoad;
+
+    // load since the last call, only called by the server
+    uint64_t sample_load() noexcept
+    {
+        uint64_t bytes = counters_.bytes_read.load(std::memory_order_relaxed);
+        uint64_t requests = counters_.requests.load(std::memory_order_relaxed);
+        uint64_t load = (bytes - sampled_bytes_read_)
+                        + (requests - sampled_requests_) * kRequestLoad;
+        sampled_bytes_read_ = bytes;
+        sampled_requests_ = requests;
+        return load;
+    }
+
+    // move the session to another executor at the next safe point: the
+    // session stops reading at the next read completion, then moves once
+    // none of its requests is in progress
+    // the session then allocates from the resource of the executor
+    void request_migration(
+        const executor_type& executor,
+        internal::memory_resource* resource)
+    {
+        std::lock_guard l{migration_mutex_};
+        migration_target_ = executor;
+        migration_resource_ = resource;
+        migration_requested_.store(true, std::memory_order_release);
+    }
+
+    // stop reading until none of the requests is in progress,
+    // to migrate the session or to release memory
+    void pause_reading(parser_type&& parser, session_ptr self)
+    {
+        {
+            std::lock_guard l{migration_mutex_};
+            paused_parser_.emplace(std::move(parser));
+            reading_paused_.store(true);
+        }
+        maybe_resume_reading(std::move(self));
+    }
+
+    bool should_pause_reading() const noexcept
+    {
+        return migration_requested_.load(std::memory_order_acquire)
+               || over_budget();
+    }
+
+    bool over_budget() const noexcept
+    {
+        return memory_budget_
+               && memory_budget_->should_pause(get_stats().memory_usage());
+    }
+
+    void request_completed(session_ptr& self, const request_context& context)
+    {
+        const auto now = clock_type::now();
+        const auto latency = now - context.received;
+        counters_.add_latency(latency);
+        if (context.responded != clock_type::time_point{}) {
+            timestamps_.response_to_write.record(now - context.responded);
+        }
+        if (context.trace.valid() && trace_handler_) {
+            trace_handler_(
+                context.trace,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+        }
+        discharge(counters_.pending_request_bytes, context.bytes);
+        if (in_progress_.fetch_sub(1) == 1 && reading_paused_.load()) {
+            maybe_resume_reading(self);
+        }
+    }
+
+    void maybe_resume_reading(session_ptr self)
+    {
+        std::optional<parser_type> parser;
+        std::optional<executor_type> target;
+        internal::memory_resource* resource = nullptr;
+        {
+            std::lock_guard l{migration_mutex_};
+            if (!paused_parser_ || in_progress_.load() != 0) {
+                return;
+            }
+            if (over_budget()) {
+                // the memory is released by the other sessions,
+                // nothing in progress here will resume the reads
+                wait_for_budget(std::move(self));
+                return;
+            }
+            parser.swap(paused_parser_);
+            target.swap(migration_target_);
+            resource = migration_resource_;
+            reading_paused_.store(false, std::memory_order_relaxed);
+            migration_requested_.store(false, std::memory_order_relaxed);
+        }
+
+        // no read is in flight and no request is in progress, so once the
+        // write strand reaches this function no write is in flight either
+        wstrand_.push([this,
+                       self = std::move(self),
+                       parser = std::move(*parser),
+                       target = std::move(target),
+                       resource]() mutable {
+            if (target && *target != socket_.get_executor()) {
+                rebind_socket(*target, resource);
+            }
+            wstrand_.next();
+
+            net::post(
+                get_executor(),
+                [self = std::move(self), parser = std::move(parser)]() mutable {
+                    auto& session = *self;
+                    session.async_read(std::move(parser), std::move(self));
+                });
+        });
+    }
+
+    // the budget only holds the session weakly, the wait of budget_timer_
+    // keeps it alive until the budget cancels it; the timer is only used
+    // from wstrand_
+    void wait_for_budget(session_ptr self)
+    {
+        wstrand_.push([this, self = std::move(self)]() mutable {
+            std::weak_ptr<server_session> weak = self;
+            budget_timer_.expires_at(clock_type::time_point::max());
+            budget_timer_.async_wait(
+                [self = std::move(self)](error_code) mutable {
+                    auto& session = *self;
+                    if (session.socket_.is_open()) {
+                        session.maybe_resume_reading(std::move(self));
+                    }
+                });
+            memory_budget_->wait(get_stats().memory_usage(), [weak] {
+                if (auto self = weak.lock()) {
+                    auto& session = *self;
+                    session.wstrand_.push([self] {
+                        self->budget_timer_.cancel();
+                        self->wstrand_.next();
+                    });
+                }
+            });
+            wstrand_.next();
+        });
+    }
+
+    void rebind_socket(
+        const executor_type& executor,
+        internal::memory_resource* resource)
+    {
+        error_code ec;
+        auto protocol = socket_.local_endpoint(ec).protocol();
+        if (ec) {
+            PACKIO_WARN("migration failed: {}", ec.message());
+            return;
+        }
+
+        auto handle = socket_.release(ec);
+        if (ec) {
+            PACKIO_WARN("migration failed: {}", ec.message());
+            return;
+        }
+
+        socket_type socket{executor};
+        socket.assign(protocol, handle, ec);
+        if (ec) {
+            PACKIO_WARN("migration failed: {}", ec.message());
+            return;
+        }
+        socket_ = std::move(socket);
+        wstrand_.rebind(executor);
+        budget_timer_ = net::steady_timer{executor};
+        // nothing is allocated from the resource while no read, write or
+        // request is in progress
+        memory_resource_ = resource;
+        PACKIO_DEBUG("session migrated");
+    }
+
+    void charge(counter_type& counter, std::size_t bytes) noexcept
+    {
+        counter.fetch_add(bytes, std::memory_order_relaxed);
+        if (memory_budget_) {
+            memory_budget_->add(bytes);
+        }
+    }
+
+    void discharge(counter_type& counter, std::size_t bytes)
+    {
+        counter.fetch_sub(bytes, std::memory_order_relaxed);
+        if (memory_budget_) {
+            memory_budget_->release(bytes);
+        }
+    }
+
+    // only called by the reader
+    void account_read_buffer(std::size_t bytes)
+    {
+        auto previous = counters_.read_buffer_bytes.load(
+            std::memory_order_relaxed);
+        if (bytes > previous) {
+            charge(counters_.read_buffer_bytes, bytes - previous);
+        }
+        else {
+            discharge(counters_.read_buffer_bytes, previous - bytes);
+        }
+    }
+
+    // the servers share their codec with their sessions
+    void set_compression(
+        std::shared_ptr<const compression_codec> codec,
+        std::size_t threshold) noexcept
+    {
+        compression_ = std::move(codec);
+        compression_threshold_ = threshold;
+    }
+
+    // only called by the reader
+    request_context new_request_context(
+        clock_type::time_point received,
+        const trace_context& trace)
+    {
+        request_context context{
+            received, std::exchange(unaccounted_bytes_, 0), trace};
+        charge(counters_.pending_request_bytes, context.bytes);
+        counters_.requests.fetch_add(1, std::memory_order_relaxed);
+        in_progress_.fetch_add(1);
+        return context;
+    }
+
+    // run a task on the executor of the procedures, the responses come
+    // back through wstrand_, on the executor of the session
+    template <typename Task>
+    void post_procedure(Task&& task)
+    {
+        if (procedure_poster_) {
+            procedure_poster_(std::forward<Task>(task));
+            return;
+        }
+        internal::initiate_with_resource(
+            memory_resource_, std::forward<Task>(task), [&](auto&& handler) {
+                net::post(
+                    get_executor(), std::forward<decltype(handler)>(handler));
+            });
+    }
+
+    // run a request now or, for sequential sessions, once the
+    // requests received before it completed
+    template <typename Task>
+    void post_request(Task&& task)
+    {
+        if (sequential_execution_) {
+            std::lock_guard l{sequential_mutex_};
+            if (sequential_running_) {
+                sequential_queue_.emplace(std::forward<Task>(task));
+                return;
+            }
+            sequential_running_ = true;
+        }
+        post_procedure(std::forward<Task>(task));
+    }
+
+    // start the next request of a sequential session
+    void sequential_request_done()
+    {
+        std::optional<procedure_type> next;
+        {
+            std::lock_guard l{sequential_mutex_};
+            if (sequential_queue_.empty()) {
+                sequential_running_ = false;
+                return;
+            }
+            next.emplace(std::move(sequential_queue_.front()));
+            sequential_queue_.pop();
+        }
+        post_procedure(std::move(*next));
+    }
 
-    void async_read(parser_type&& parser)
+    // only called by the reader
+    void frame_received(
+        std::string&& frame,
+        clock_type::time_point received,
+        session_ptr& self)
+    {
+        auto header = internal::parse_frame_header(frame);
+        if (header->codec == internal::kFragmentCodec) {
+            fragment_received(frame, received, self);
+            return;
+        }
+        if (!compression_ || header->codec != compression_->id) {
+            if (header->is_announcement()) {
+                // the client won't compress its requests without answer
+                PACKIO_DEBUG("unsupported codec: {}", header->codec);
+                return;
+            }
+            PACKIO_WARN("unsupported codec: {}", header->codec);
+            close_connection();
+            return;
+        }
+
+        if (header->is_announcement()) {
+            if (!peer_compression_.exchange(true)) {
+                PACKIO_DEBUG("compression enabled");
+                async_write_message(
+                    internal::make_announcement_frame(compression_->id),
+                    self,
+                    std::nullopt);
+            }
+            return;
+        }
+
+        auto context = new_request_context(received, {});
+        post_request(
+            [self, frame = std::move(frame), context]() mutable {
+                auto& session = *self;
+                session.decompress_request(frame, std::move(self), context);
+            });
+    }
+
+    // only called by the reader
+    void fragment_received(
+        std::string_view frame,
+        clock_type::time_point received,
+        session_ptr& self)
+    {
+        using status = internal::fragment_assembler::status;
+        switch (fragments_.add(frame, max_message_size_)) {
+        case status::incomplete:
+            return;
+        case status::error:
+            PACKIO_WARN("invalid fragment");
+            close_connection();
+            return;
+        case status::complete:
+            break;
+        }
+
+        parser_type parser{max_message_size_};
+        internal::feed_parser(parser, fragments_.take());
+        if (auto message = parser.get_compressed_frame()) {
+            if (internal::parse_frame_header(*message)->codec
+                == internal::kFragmentCodec) {
+                PACKIO_WARN("nested fragment");
+                close_connection();
+                return;
+            }
+            frame_received(std::move(*message), received, self);
+            return;
+        }
+        auto request = parser.get_request();
+        if (!request) {
+            PACKIO_WARN("invalid fragmented request");
+            close_connection();
+            return;
+        }
+        request_received(std::move(*request), received, self);
+    }
+
+    // only called by the reader
+    void request_received(
+        request_type&& request,
+        clock_type::time_point received,
+        session_ptr& self)
+    {
+        auto context = new_request_context(received, request.trace);
+        // handle the call asynchronously (post)
+        // to schedule the next read immediately
+        // this will allow parallel call handling
+        // in multi-threaded environments
+        post_request(
+            [self, request = std::move(request), context]() mutable {
+                auto& session = *self;
+                session.async_handle_request(
+                    std::move(request), std::move(self), context);
+            });
+    }
+
+    void decompress_request(
+        std::string_view frame,
+        session_ptr self,
+        request_context context)
+    {
+        auto message = internal::decompress_frame(
+            frame, *compression_, max_message_size_);
+        std::optional<request_type> request;
+        if (message) {
+            parser_type parser{max_message_size_};
+            internal::feed_parser(parser, *message);
+            request = parser.get_request();
+        }
+        if (!request) {
+            PACKIO_WARN("invalid compressed request");
+            close_connection();
+            request_completed(self, context);
+            if (sequential_execution_) {
+                sequential_request_done();
+            }
+            return;
+        }
+        context.trace = request->trace;
+        async_handle_request(std::move(*request), std::move(self), context);
+    }
+
+    void async_read(parser_type&& parser, session_ptr self)
     {
         // abort R/W on error
         if (!socket_.is_open()) {
             return;
         }
 
-        parser.reserve_buffer(buffer_reserve_size_);
+        parser.reserve_buffer(buffer_reserve_size_.get());
+        account_read_buffer(parser.buffered_size() + parser.buffer_capacity());
         auto buffer = net::buffer(parser.buffer(), parser.buffer_capacity());
-        socket_.async_read_some(
-            buffer,
-            [self = shared_from_this(), parser = std::move(parser)](
+        internal::initiate_with_resource(
+            memory_resource_,
+            [self = std::move(self), parser = std::move(parser)](
                 error_code ec, size_t length) mutable {
                 if (ec) {
                     PACKIO_WARN("read error: {}", ec.message());
@@ -88,41 +779,125 @@ private:
                 }
 
                 PACKIO_TRACE("read: {}", length);
+                self->buffer_reserve_size_.read_completed(length);
+                self->counters_.bytes_read.fetch_add(
+                    length, std::memory_order_relaxed);
                 parser.buffer_consumed(length);
 
-                while (auto request = parser.get_request()) {
-                    if (!request) {
-                        self->close_connection();
+                // the size of the requests is estimated from the bytes
+                // received since the previous request
+                self->unaccounted_bytes_ += length;
+                const auto received = clock_type::now();
+                while (true) {
+                    if (auto frame = parser.get_compressed_frame()) {
+                        auto& session = *self;
+                        session.frame_received(
+                            std::move(*frame), received, self);
                         continue;
                     }
-                    // handle the call asynchronously (post)
-                    // to schedule the next read immediately
-                    // this will allow parallel call handling
-                    // in multi-threaded environments
-                    net::post(
-                        self->get_executor(),
-                        [self, request = std::move(*request)]() mutable {
-                            self->async_handle_request(std::move(request));
-                        });
+                    auto request = parser.get_request();
+                    if (!request) {
+                        break;
+                    }
+                    auto& session = *self;
+                    session.request_received(
+                        std::move(*request), received, self);
+                }
+
+                if (parser.message_size_exceeded()) {
+                    PACKIO_WARN(
+                        "message exceeds the maximum size: {}",
+                        self->max_message_size_);
+                    self->close_connection();
+                    return;
                 }
 
-                self->async_read(std::move(parser));
+                auto& session = *self;
+                if (session.should_pause_reading()) {
+                    session.pause_reading(std::move(parser), std::move(self));
+                    return;
+                }
+                session.async_read(std::move(parser), std::move(self));
+            },
+            [&](auto&& handler) {
+                if (timestamps_.enabled()) {
+                    timestamps_.async_read_some(
+                        socket_,
+                        buffer,
+                        std::forward<decltype(handler)>(handler));
+                    return;
+                }
+                socket_.async_read_some(
+                    buffer, std::forward<decltype(handler)>(handler));
             });
     }
 
-    void async_handle_request(request_type&& request)
+    void async_handle_request(
+        request_type&& request,
+        session_ptr self,
+        const request_context& context)
     {
-        completion_handler<Rpc> handler(
+        std::optional<clock_type::time_point> dispatched;
+        if (socket_timestamping_) {
+            dispatched = clock_type::now();
+            timestamps_.read_to_dispatch.record(*dispatched - context.received);
+        }
+
+        auto handler = make_completion_handler(
             request.id,
-            [type = request.type, id = request.id, self = shared_from_this()](
-                auto&& response_buffer) {
+            [type = request.type,
+             id = request.id,
+             self = std::move(self),
+             context = context,
+             dispatched](auto&& response_buffer) mutable {
+                auto& session = *self;
+                if (dispatched) {
+                    context.responded = clock_type::now();
+                    session.timestamps_.dispatch_to_response.record(
+                        context.responded - *dispatched);
+                }
                 if (type == call_type::request) {
                     PACKIO_TRACE("result (id={})", Rpc::format_id(id));
                     (void)id;
-                    self->async_send_response(std::move(response_buffer));
+                    if (!session.sequential_execution_) {
+                        session.async_send_response(
+                            std::move(response_buffer),
+                            std::move(self),
+                            context);
+                        return;
+                    }
+                    // keep the session alive to start the next request
+                    // once the response is queued
+                    session.async_send_response(
+                        std::move(response_buffer), self, context);
+                }
+                else {
+                    session.request_completed(self, context);
+                }
+                if (session.sequential_execution_) {
+                    session.sequential_request_done();
                 }
             });
 
+        if (memory_budget_ && memory_budget_->should_shed()) {
+            PACKIO_DEBUG("memory budget exceeded, rejecting {}", request.method);
+            handler.set_error("Memory budget exceeded");
+            return;
+        }
+
+        // the procedure sees the trace context of the request,
+        // the calls it makes carry it along
+        std::optional<scoped_trace_context> trace_scope;
+        if (context.trace.valid()) {
+            trace_scope.emplace(context.trace);
+        }
+
+        if (request.method == internal::map_method) {
+            handle_map_request(
+                std::move(request), std::move(handler), context.trace);
+            return;
+        }
+
         const auto function = dispatcher_ptr_->get(request.method);
         if (function) {
             PACKIO_TRACE(
@@ -135,37 +910,222 @@ private:
         }
     }
 
+    // the state of the handler is allocated from the memory resource when
+    // there is one, the handler then only holds pointers to it
+    template <typename Respond>
+    completion_handler<Rpc> make_completion_handler(
+        const typename Rpc::id_type& id,
+        Respond&& respond)
+    {
+        if (memory_resource_) {
+            return {
+                id,
+                internal::resource_once_function<std::decay_t<Respond>>{
+                    internal::to_unique_ptr(
+                        std::forward<Respond>(respond), memory_resource_)}};
+        }
+        return {id, std::forward<Respond>(respond)};
+    }
+
+    void handle_map_request(
+        request_type&& request,
+        completion_handler<Rpc>&& handler,
+        const trace_context& trace)
+    {
+        auto map_args = Rpc::extract_map_args(std::move(request.args));
+        if (!map_args) {
+            handler.set_error("Incompatible arguments");
+            return;
+        }
+
+        auto& [name, items] = *map_args;
+        const auto function = dispatcher_ptr_->get_map(name);
+        if (!function) {
+            PACKIO_DEBUG("unknown synchronous function {}", name);
+            handler.set_error("Unknown function");
+            return;
+        }
+
+        PACKIO_TRACE(
+            "map call: {} x{} (id={})",
+            name,
+            items.size(),
+            Rpc::format_id(request.id));
+        procedure_poster_type poster = procedure_poster_;
+        if (!poster) {
+            poster = [executor = get_executor()](procedure_type task) {
+                net::post(executor, std::move(task));
+            };
+        }
+        if (trace.valid()) {
+            poster = [poster = std::move(poster),
+                      trace](procedure_type task) {
+                poster([task = std::move(task), trace]() mutable {
+                    scoped_trace_context scope{trace};
+                    task();
+                });
+            };
+        }
+        (*function)(std::move(handler), std::move(items), std::move(poster));
+    }
+
     template <typename Buffer>
-    void async_send_response(Buffer&& response_buffer)
+    void async_send_response(
+        Buffer&& response_buffer,
+        session_ptr self,
+        const request_context& context)
     {
         // abort R/W on error
         if (!socket_.is_open()) {
             return;
         }
 
-        auto message_ptr = internal::to_unique_ptr(std::move(response_buffer));
+        // compress where the response is produced, out of the I/O thread
+        if (peer_compression_.load(std::memory_order_relaxed)) {
+            auto buffer = Rpc::buffer(response_buffer);
+            auto frame = internal::compress_message(
+                {static_cast<const char*>(buffer.data()), buffer.size()},
+                *compression_,
+                compression_threshold_);
+            if (frame) {
+                async_write_message(
+                    std::move(*frame), std::move(self), context);
+                return;
+            }
+        }
+        async_write_message(
+            std::forward<Buffer>(response_buffer), std::move(self), context);
+    }
 
-        wstrand_.push([this,
-                       self = shared_from_this(),
-                       message_ptr = std::move(message_ptr)]() mutable {
-            auto buf = Rpc::buffer(*message_ptr);
-            net::async_write(
-                socket_,
-                buf,
-                [self = std::move(self), message_ptr = std::move(message_ptr)](
-                    error_code ec, size_t length) {
-                    self->wstrand_.next();
-
-                    if (ec) {
-                        PACKIO_WARN("write error: {}", ec.message());
-                        self->close_connection();
-                        return;
-                    }
+    template <typename Buffer>
+    void async_write_message(
+        Buffer&& message,
+        session_ptr self,
+        const std::optional<request_context>& context)
+    {
+        auto message_ptr = internal::to_unique_ptr(
+            std::forward<Buffer>(message), memory_resource_);
+        const std::size_t size = Rpc::buffer(*message_ptr).size();
+        charge(counters_.write_queue_bytes, size);
 
-                    PACKIO_TRACE("write: {}", length);
-                    (void)length;
-                });
-        });
+        wstrand_.push(
+            [this,
+             self = std::move(self),
+             message_ptr = std::move(message_ptr),
+             size,
+             context]() mutable {
+                write_message(
+                    std::move(message_ptr), size, 0, std::move(self), context);
+            },
+            size >= bulk_message_size_);
+    }
+
+    // size of the fragment starting at offset, 0 to write the whole message
+    std::size_t next_fragment_size(std::size_t size, std::size_t offset) const
+    {
+        if (fragment_size_ == 0 || size < bulk_message_size_
+            || size <= fragment_size_
+            || size > internal::kMaxFramePayloadSize) {
+            return 0;
+        }
+        return std::min(fragment_size_, size - offset);
+    }
+
+    // write the message, or its fragment starting at offset,
+    // only called from wstrand_
+    template <typename MessagePtr>
+    void write_message(
+        MessagePtr&& message_ptr,
+        std::size_t size,
+        std::size_t offset,
+        session_ptr self,
+        const std::optional<request_context>& context)
+    {
+        auto buf = Rpc::buffer(*message_ptr);
+        std::array<net::const_buffer, 2> buffers{buf, net::const_buffer{}};
+        const std::size_t fragment = next_fragment_size(size, offset);
+        if (fragment != 0) {
+            // a single write is in flight, it can use the member
+            fragment_header_ = internal::make_fragment_header(fragment, size);
+            buffers = {
+                net::buffer(fragment_header_),
+                net::buffer(buf + offset, fragment)};
+        }
+        offset = fragment != 0 ? offset + fragment : size;
+        if (timestamps_.enabled()) {
+            timestamps_.write_started(net::buffer_size(buffers));
+        }
+        // cork while more messages are queued, uncork with the last one
+        bool uncork = false;
+        if (tuning_.cork_batches) {
+            const bool more = offset < size || wstrand_.size() != 0;
+            if (more && !corked_) {
+                internal::set_cork(socket_, true);
+                corked_ = true;
+            }
+            uncork = corked_ && !more;
+        }
+
+        internal::initiate_with_resource(
+            memory_resource_,
+            [self = std::move(self),
+             message_ptr = std::forward<MessagePtr>(message_ptr),
+             size,
+             offset,
+             uncork,
+             context](error_code ec, size_t length) mutable {
+                if (self->timestamps_.enabled()) {
+                    self->timestamps_.collect_transmit_timestamps(
+                        self->socket_);
+                }
+                if (uncork) {
+                    internal::set_cork(self->socket_, false);
+                    self->corked_ = false;
+                }
+                if (!ec && offset < size) {
+                    // let the smaller messages through before the next
+                    // fragment
+                    auto& session = *self;
+                    session.counters_.bytes_written.fetch_add(
+                        length, std::memory_order_relaxed);
+                    session.wstrand_.yield(
+                        [self = std::move(self),
+                         message_ptr = std::move(message_ptr),
+                         size,
+                         offset,
+                         context]() mutable {
+                            auto* ptr = self.get();
+                            ptr->write_message(
+                                std::move(message_ptr),
+                                size,
+                                offset,
+                                std::move(self),
+                                context);
+                        });
+                    return;
+                }
+
+                self->wstrand_.next();
+                self->discharge(self->counters_.write_queue_bytes, size);
+                self->counters_.bytes_written.fetch_add(
+                    length, std::memory_order_relaxed);
+                if (context) {
+                    self->request_completed(self, *context);
+                }
+
+                if (ec) {
+                    PACKIO_WARN("write error: {}", ec.message());
+                    self->close_connection();
+                    return;
+                }
+
+                PACKIO_TRACE("write: {}", length);
+                (void)length;
+            },
+            [&](auto&& handler) {
+                net::async_write(
+                    socket_, buffers, std::forward<decltype(handler)>(handler));
+            });
     }
 
     void close_connection()
@@ -178,9 +1138,53 @@ private:
     }
 
     socket_type socket_;
-    std::size_t buffer_reserve_size_{kDefaultBufferReserveSize};
+    internal::adaptive_reserve_size buffer_reserve_size_{
+        kDefaultBufferReserveSize};
+    std::size_t max_message_size_{kDefaultMaxMessageSize};
+    std::size_t bulk_message_size_{std::numeric_limits<std::size_t>::max()};
+    std::size_t fragment_size_{0};
+    std::string fragment_header_;
+    internal::fragment_assembler fragments_;
+    socket_tuning tuning_;
+    // only used by the writer
+    bool corked_{false};
+    bool socket_timestamping_{false};
+    internal::socket_timestamper<threading_type> timestamps_;
     std::shared_ptr<Dispatcher> dispatcher_ptr_;
-    internal::manual_strand<typename socket_type::executor_type> wstrand_;
+    procedure_poster_type procedure_poster_;
+    trace_handler_type trace_handler_;
+    std::shared_ptr<const compression_codec> compression_;
+    std::size_t compression_threshold_{kDefaultCompressionThreshold};
+    internal::memory_resource* memory_resource_{nullptr};
+    internal::manual_strand<
+        typename threading_type::template strand_type<executor_type>>
+        wstrand_;
+    // pending while the reads wait for the memory budget
+    net::steady_timer budget_timer_;
+
+    template <typename T>
+    using atomic_type = typename threading_type::template atomic_type<T>;
+    std::string peer_;
+    internal::connection_counters<threading_type> counters_;
+    std::shared_ptr<memory_budget> memory_budget_;
+    std::size_t unaccounted_bytes_{0};
+    atomic_type<uint64_t> in_progress_{0};
+    uint64_t sampled_bytes_read_{0};
+    uint64_t sampled_requests_{0};
+
+    typename threading_type::mutex_type migration_mutex_;
+    std::optional<executor_type> migration_target_;
+    internal::memory_resource* migration_resource_{nullptr};
+    std::optional<parser_type> paused_parser_;
+    atomic_type<bool> migration_requested_{false};
+    atomic_type<bool> reading_paused_{false};
+    // set once the client announced it supports our codec
+    atomic_type<bool> peer_compression_{false};
+
+    bool sequential_execution_{false};
+    typename threading_type::mutex_type sequential_mutex_;
+    std::queue<procedure_type> sequential_queue_;
+    bool sequential_running_{false};
 };
 
 } // packio
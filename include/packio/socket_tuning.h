@@ -0,0 +1,158 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_SOCKET_TUNING_H
+#define PACKIO_SOCKET_TUNING_H
+
+//! @file
+//! Struct @ref packio::socket_tuning "socket_tuning"
+
+#include <chrono>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif // defined(__linux__)
+
+#include "internal/config.h"
+#include "internal/log.h"
+
+namespace packio {
+
+//! Socket options applied once per connection
+//!
+//! The TCP options are ignored by the other sockets, the options
+//! marked Linux only are ignored on the other systems.
+struct socket_tuning {
+    //! Disable the Nagle algorithm (TCP_NODELAY)
+    bool no_delay{true};
+    //! Size of the send buffer (SO_SNDBUF), 0 to keep the default
+    int send_buffer_size{0};
+    //! Size of the receive buffer (SO_RCVBUF), 0 to keep the default
+    int receive_buffer_size{0};
+    //! Acknowledge the received data immediately (TCP_QUICKACK),
+    //! Linux only. The kernel can leave this mode by itself, the option
+    //! is not set again.
+    bool quick_ack{false};
+    //! Send keepalive probes on idle connections (SO_KEEPALIVE)
+    bool keep_alive{false};
+    //! Idle time before the first probe (TCP_KEEPIDLE), Linux only,
+    //! 0 to keep the default
+    std::chrono::seconds keep_alive_idle{0};
+    //! Time between two probes (TCP_KEEPINTVL), Linux only,
+    //! 0 to keep the default
+    std::chrono::seconds keep_alive_interval{0};
+    //! Number of probes before dropping the connection (TCP_KEEPCNT),
+    //! Linux only, 0 to keep the default
+    int keep_alive_count{0};
+    //! Cork the socket (TCP_CORK) while more messages are queued,
+    //! so that they are sent in full segments, Linux only.
+    //! The socket is uncorked once the last queued message is written.
+    bool cork_batches{false};
+
+    //! Options for small messages sent one at a time
+    static socket_tuning latency() noexcept
+    {
+        socket_tuning tuning;
+        tuning.no_delay = true;
+        tuning.quick_ack = true;
+        return tuning;
+    }
+
+    //! Options for connections writing many or big messages
+    static socket_tuning throughput() noexcept
+    {
+        socket_tuning tuning;
+        tuning.no_delay = true;
+        tuning.send_buffer_size = 4 * 1024 * 1024;
+        tuning.receive_buffer_size = 4 * 1024 * 1024;
+        tuning.cork_batches = true;
+        return tuning;
+    }
+};
+
+namespace internal {
+
+template <typename Socket>
+constexpr bool is_tcp_socket_v =
+    std::is_same_v<typename Socket::protocol_type, net::ip::tcp>;
+
+#if defined(__linux__)
+template <typename Socket>
+void set_tcp_option(Socket& socket, int name, int value)
+{
+    if (::setsockopt(
+            socket.native_handle(), IPPROTO_TCP, name, &value, sizeof(value))
+        != 0) {
+        PACKIO_WARN("cannot set TCP option {}: {}", name, errno);
+    }
+}
+#endif // defined(__linux__)
+
+template <typename Socket>
+void apply_socket_tuning(Socket& socket, const socket_tuning& tuning)
+{
+    auto set_option = [&](const auto& option) {
+        error_code ec;
+        socket.set_option(option, ec);
+        if (ec) {
+            PACKIO_WARN("cannot tune the socket: {}", ec.message());
+        }
+    };
+    if (tuning.send_buffer_size > 0) {
+        set_option(net::socket_base::send_buffer_size{tuning.send_buffer_size});
+    }
+    if (tuning.receive_buffer_size > 0) {
+        set_option(
+            net::socket_base::receive_buffer_size{tuning.receive_buffer_size});
+    }
+    if constexpr (is_tcp_socket_v<Socket>) {
+        set_option(net::ip::tcp::no_delay{tuning.no_delay});
+        if (tuning.keep_alive) {
+            set_option(net::socket_base::keep_alive{true});
+        }
+#if defined(__linux__)
+        if (tuning.quick_ack) {
+            set_tcp_option(socket, TCP_QUICKACK, 1);
+        }
+        if (tuning.keep_alive && tuning.keep_alive_idle.count() > 0) {
+            set_tcp_option(
+                socket,
+                TCP_KEEPIDLE,
+                static_cast<int>(tuning.keep_alive_idle.count()));
+        }
+        if (tuning.keep_alive && tuning.keep_alive_interval.count() > 0) {
+            set_tcp_option(
+                socket,
+                TCP_KEEPINTVL,
+                static_cast<int>(tuning.keep_alive_interval.count()));
+        }
+        if (tuning.keep_alive && tuning.keep_alive_count > 0) {
+            set_tcp_option(socket, TCP_KEEPCNT, tuning.keep_alive_count);
+        }
+#endif // defined(__linux__)
+    }
+}
+
+// cork or uncork the socket, no-op if unsupported
+template <typename Socket>
+void set_cork(Socket& socket, bool enabled)
+{
+#if defined(__linux__)
+    if constexpr (is_tcp_socket_v<Socket>) {
+        set_tcp_option(socket, TCP_CORK, enabled ? 1 : 0);
+    }
+#else // defined(__linux__)
+    (void)socket;
+    (void)enabled;
+#endif // defined(__linux__)
+}
+
+} // internal
+} // packio
+
+#endif // PACKIO_SOCKET_TUNING_H
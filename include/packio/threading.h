@@ -0,0 +1,122 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_THREADING_H
+#define PACKIO_THREADING_H
+
+//! @file
+//! Threading policies
+
+#include <atomic>
+#include <mutex>
+
+#include "internal/config.h"
+
+namespace packio {
+namespace internal {
+
+//! Drop-in replacement for std::atomic that performs no synchronization
+template <typename T>
+class unsynchronized {
+public:
+    constexpr unsynchronized(T value = T{}) noexcept : value_{value} {}
+
+    T load(std::memory_order = std::memory_order_seq_cst) const noexcept
+    {
+        return value_;
+    }
+
+    void store(T value, std::memory_order = std::memory_order_seq_cst) noexcept
+    {
+        value_ = value;
+    }
+
+    T fetch_add(T arg, std::memory_order = std::memory_order_seq_cst) noexcept
+    {
+        T previous = value_;
+        value_ += arg;
+        return previous;
+    }
+
+    T fetch_sub(T arg, std::memory_order = std::memory_order_seq_cst) noexcept
+    {
+        T previous = value_;
+        value_ -= arg;
+        return previous;
+    }
+
+    T exchange(T value, std::memory_order = std::memory_order_seq_cst) noexcept
+    {
+        T previous = value_;
+        value_ = value;
+        return previous;
+    }
+
+private:
+    T value_;
+};
+
+template <typename Executor>
+bool running_in_this_thread(const net::strand<Executor>& strand)
+{
+    return strand.running_in_this_thread();
+}
+
+template <typename Executor>
+bool running_in_this_thread(const Executor&)
+{
+    return true;
+}
+
+} // internal
+
+//! Lockable that does not lock anything
+//!
+//! Can be used as the Lockable of a @ref dispatcher that is
+//! only accessed from a single thread.
+class null_mutex {
+public:
+    void lock() noexcept {}
+    bool try_lock() noexcept { return true; }
+    void unlock() noexcept {}
+};
+
+//! Threading policy for objects accessed from multiple threads
+//!
+//! Operations are serialized using strands, call IDs are
+//! atomic and the dispatcher is protected by a mutex.
+struct multi_threaded {
+    //! The strand used to serialize operations on an executor
+    template <typename Executor>
+    using strand_type = net::strand<Executor>;
+    //! The atomic type used for counters shared between threads
+    template <typename T>
+    using atomic_type = std::atomic<T>;
+    //! The Lockable to use for the @ref dispatcher
+    using mutex_type = std::mutex;
+};
+
+//! Threading policy for objects accessed from a single thread
+//!
+//! Use it when the io_context is run by a single thread, for instance in
+//! thread-per-core designs, and the objects are only used from this thread.
+//! Strands are replaced by the underlying executor and counters are not
+//! atomic.
+struct single_threaded {
+    //! The strand used to serialize operations on an executor
+    template <typename Executor>
+    using strand_type = Executor;
+    //! The atomic type used for counters shared between threads
+    template <typename T>
+    using atomic_type = internal::unsynchronized<T>;
+    //! The Lockable to use for the @ref dispatcher
+    using mutex_type = null_mutex;
+};
+
+//! The threading policy used by default
+using default_threading = multi_threaded;
+
+} // packio
+
+#endif // PACKIO_THREADING_H
@@ -0,0 +1,184 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_TRACE_CONTEXT_H
+#define PACKIO_TRACE_CONTEXT_H
+
+//! @file
+//! Struct @ref packio::trace_context "trace_context"
+
+#include <cstdint>
+#include <random>
+#include <type_traits>
+#include <utility>
+
+#include "internal/config.h"
+
+namespace packio {
+namespace internal {
+
+inline uint64_t random_trace_id()
+{
+    thread_local std::mt19937_64 generator{std::random_device{}()};
+    uint64_t id;
+    do {
+        id = generator();
+    } while (id == 0);
+    return id;
+}
+
+} // internal
+
+//! Context of a trace, propagated along nested calls
+//!
+//! Only sampled contexts are sent with the requests, so unsampled calls
+//! cost nothing on the wire. The context of the request being handled is
+//! available to the procedures with @ref this_trace_context, and is
+//! automatically attached to the calls and notifications sent from the
+//! procedure by a @ref client.
+struct trace_context {
+    uint64_t trace_id{0}; //!< The ID of the trace, 0 when there is no trace
+    uint64_t span_id{0}; //!< The ID of the current span
+    uint64_t parent_span_id{0}; //!< The ID of the parent span, 0 for a root
+    bool sampled{false}; //!< True if the trace is recorded
+
+    //! Check if the context is part of a trace
+    bool valid() const noexcept { return trace_id != 0; }
+
+    //! Create the context of a new trace
+    //! @param sampled True if the trace is recorded
+    static trace_context new_trace(bool sampled = true)
+    {
+        trace_context context;
+        context.trace_id = internal::random_trace_id();
+        context.span_id = internal::random_trace_id();
+        context.sampled = sampled;
+        return context;
+    }
+
+    //! Create the context of a new span, child of this one
+    trace_context child() const
+    {
+        trace_context context = *this;
+        context.parent_span_id = span_id;
+        context.span_id = internal::random_trace_id();
+        return context;
+    }
+};
+
+namespace internal {
+
+inline trace_context& current_trace_context() noexcept
+{
+    thread_local trace_context context;
+    return context;
+}
+
+} // internal
+
+//! Get the trace context of the current thread
+//!
+//! Within a procedure, this is the context of the request being handled.
+//! The context is invalid when there is no trace.
+inline const trace_context& this_trace_context() noexcept
+{
+    return internal::current_trace_context();
+}
+
+//! Set the trace context of the current thread until the end of the scope
+class scoped_trace_context {
+public:
+    //! The constructor
+    //! @param context The trace context to use in this scope
+    explicit scoped_trace_context(const trace_context& context) noexcept
+        : previous_{std::exchange(internal::current_trace_context(), context)}
+    {
+    }
+
+    ~scoped_trace_context()
+    {
+        internal::current_trace_context() = previous_;
+    }
+
+    scoped_trace_context(const scoped_trace_context&) = delete;
+    scoped_trace_context& operator=(const scoped_trace_context&) = delete;
+
+private:
+    trace_context previous_;
+};
+
+#if defined(PACKIO_HAS_CO_AWAIT)
+namespace internal {
+
+//! Executor running each function with a trace context, used to keep the
+//! context of a coroutine across its suspensions
+template <typename Executor>
+class traced_executor {
+public:
+    traced_executor(Executor executor, const trace_context& context)
+        : executor_{std::move(executor)}, context_{context}
+    {
+    }
+
+    template <typename Property>
+    auto query(const Property& property) const
+        -> decltype(net::query(std::declval<const Executor&>(), property))
+    {
+        return net::query(executor_, property);
+    }
+
+    template <typename Property>
+    auto require(const Property& property) const
+        -> traced_executor<std::decay_t<
+            decltype(net::require(std::declval<const Executor&>(), property))>>
+    {
+        return {net::require(executor_, property), context_};
+    }
+
+    template <typename Property>
+    auto prefer(const Property& property) const
+        -> traced_executor<std::decay_t<
+            decltype(net::prefer(std::declval<const Executor&>(), property))>>
+    {
+        return {net::prefer(executor_, property), context_};
+    }
+
+    template <typename Function>
+    void execute(Function&& f) const
+    {
+        executor_.execute(
+            [context = context_, f = std::forward<Function>(f)]() mutable {
+                scoped_trace_context scope{context};
+                f();
+            });
+    }
+
+    friend bool operator==(
+        const traced_executor& lhs,
+        const traced_executor& rhs) noexcept
+    {
+        return lhs.executor_ == rhs.executor_
+               && lhs.context_.span_id == rhs.context_.span_id;
+    }
+    friend bool operator!=(
+        const traced_executor& lhs,
+        const traced_executor& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+private:
+    template <typename>
+    friend class traced_executor;
+
+    Executor executor_;
+    trace_context context_;
+};
+
+} // internal
+#endif // defined(PACKIO_HAS_CO_AWAIT)
+
+} // packio
+
+#endif // PACKIO_TRACE_CONTEXT_H
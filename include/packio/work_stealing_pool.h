@@ -0,0 +1,263 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifndef PACKIO_WORK_STEALING_POOL_H
+#define PACKIO_WORK_STEALING_POOL_H
+
+//! @file
+//! Class @ref packio::work_stealing_pool "work_stealing_pool"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "internal/config.h"
+#include "internal/movable_function.h"
+
+namespace packio {
+
+//! A thread pool balancing its work by stealing
+//!
+//! Each worker has its own queue. Work posted from a worker goes to its
+//! own queue, work posted from outside the pool is distributed round-robin.
+//! Idle workers take work from the queues of the others.
+//! Meant to run CPU-heavy procedures, see
+//! @ref server::set_procedure_executor, while the I/O stays on the
+//! io_context owning the sockets.
+class work_stealing_pool {
+public:
+    //! The type of the functions run by the pool
+    using function_type = internal::movable_function<void()>;
+
+    //! The executor of the pool
+    //!
+    //! Implements the Networking TS executor requirements so that it
+    //! can be used with net::post and net::dispatch
+    class executor_type {
+    public:
+        //! True if the caller is a worker of the pool
+        bool running_in_this_thread() const noexcept
+        {
+            return current_pool() == pool_;
+        }
+
+        //! Get the pool of the executor
+        work_stealing_pool& context() const noexcept { return *pool_; }
+
+        //! Work is not tracked, the pool runs until it is stopped
+        void on_work_started() const noexcept {}
+        //! Work is not tracked, the pool runs until it is stopped
+        void on_work_finished() const noexcept {}
+
+        //! Run the function now if called from the pool, else post it
+        template <typename Function, typename Allocator>
+        void dispatch(Function&& function, const Allocator& allocator) const
+        {
+            if (running_in_this_thread()) {
+                std::decay_t<Function> tmp{std::forward<Function>(function)};
+                tmp();
+                return;
+            }
+            post(std::forward<Function>(function), allocator);
+        }
+
+        //! Queue the function on the pool
+        template <typename Function, typename Allocator>
+        void post(Function&& function, const Allocator&) const
+        {
+            pool_->post(function_type{std::forward<Function>(function)});
+        }
+
+        //! Queue the function on the pool
+        template <typename Function, typename Allocator>
+        void defer(Function&& function, const Allocator& allocator) const
+        {
+            post(std::forward<Function>(function), allocator);
+        }
+
+        friend bool operator==(
+            const executor_type& lhs,
+            const executor_type& rhs) noexcept
+        {
+            return lhs.pool_ == rhs.pool_;
+        }
+
+        friend bool operator!=(
+            const executor_type& lhs,
+            const executor_type& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        friend class work_stealing_pool;
+        explicit executor_type(work_stealing_pool* pool) noexcept : pool_{pool}
+        {
+        }
+
+        work_stealing_pool* pool_;
+    };
+
+    //! The constructor
+    //! @param n_threads The number of workers, defaults to
+    //! the number of CPUs
+    explicit work_stealing_pool(
+        std::size_t n_threads =
+            std::max(1u, std::thread::hardware_concurrency()))
+    {
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            workers_.push_back(std::make_unique<worker>());
+        }
+        for (std::size_t i = 0; i < n_threads; ++i) {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    //! The destructor, stops the pool and waits for its threads
+    //!
+    //! Functions still queued are destroyed without being run
+    ~work_stealing_pool()
+    {
+        stop();
+        join();
+    }
+
+    //! Get the executor of the pool
+    executor_type get_executor() noexcept { return executor_type{this}; }
+
+    //! Get the number of workers of the pool
+    std::size_t size() const noexcept { return workers_.size(); }
+
+    //! Run a function on the pool
+    void post(function_type function)
+    {
+        std::size_t index = current_pool() == this
+                                ? current_index()
+                                : next_.fetch_add(1, std::memory_order_relaxed)
+                                      % workers_.size();
+        pending_.fetch_add(1);
+        {
+            std::lock_guard l{workers_[index]->mutex};
+            workers_[index]->queue.push_back(std::move(function));
+        }
+
+        if (sleepers_.load() > 0) {
+            std::lock_guard l{sleep_mutex_};
+            wakeup_.notify_one();
+        }
+    }
+
+    //! Stop the workers, they exit after their current function
+    void stop()
+    {
+        {
+            std::lock_guard l{sleep_mutex_};
+            stopped_ = true;
+        }
+        wakeup_.notify_all();
+    }
+
+    //! Wait for the workers to exit
+    void join()
+    {
+        for (auto& thread : threads_) {
+            if (thread.joinable()) {
+                thread.join();
+            }
+        }
+        threads_.clear();
+    }
+
+private:
+    struct worker {
+        std::mutex mutex;
+        std::deque<function_type> queue;
+    };
+
+    static work_stealing_pool*& current_pool() noexcept
+    {
+        static thread_local work_stealing_pool* pool = nullptr;
+        return pool;
+    }
+
+    static std::size_t& current_index() noexcept
+    {
+        static thread_local std::size_t index = 0;
+        return index;
+    }
+
+    void run(std::size_t index)
+    {
+        current_pool() = this;
+        current_index() = index;
+
+        while (true) {
+            if (auto function = take(index)) {
+                function();
+                continue;
+            }
+
+            std::unique_lock l{sleep_mutex_};
+            sleepers_.fetch_add(1);
+            wakeup_.wait(l, [this] { return stopped_ || pending_.load() > 0; });
+            sleepers_.fetch_sub(1);
+            if (stopped_) {
+                return;
+            }
+        }
+    }
+
+    // oldest work from the own queue first, then steal the newest work
+    // of the others so that the owner keeps processing in order
+    function_type take(std::size_t index)
+    {
+        if (pending_.load() == 0) {
+            return nullptr;
+        }
+
+        for (std::size_t i = 0; i < workers_.size(); ++i) {
+            auto& worker = *workers_[(index + i) % workers_.size()];
+            std::lock_guard l{worker.mutex};
+            if (worker.queue.empty()) {
+                continue;
+            }
+
+            function_type function;
+            if (i == 0) {
+                function = std::move(worker.queue.front());
+                worker.queue.pop_front();
+            }
+            else {
+                function = std::move(worker.queue.back());
+                worker.queue.pop_back();
+            }
+            pending_.fetch_sub(1);
+            return function;
+        }
+        return nullptr;
+    }
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_{0};
+
+    std::atomic<std::size_t> pending_{0};
+    std::atomic<std::size_t> sleepers_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wakeup_;
+    bool stopped_{false};
+};
+
+} // packio
+
+#endif // PACKIO_WORK_STEALING_POOL_H
@@ -0,0 +1,343 @@
+// Connection scale benchmark, Linux only
+//
+// The server runs in a child process so that its resident memory is
+// measured alone, the clients run in this process. For each number of
+// connections it reports the resident memory per idle and per lightly
+// active connection, the accept rate, the time to first response when
+// every connection makes its first call at once, and the throughput of
+// a round of calls on every connection, to compare with the smallest
+// number of connections.
+//
+// Usage: bench_connections [max_connections]
+// The number of connections is limited by RLIMIT_NOFILE.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <packio/packio.h>
+
+using namespace packio::net;
+using packio::error_code;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+constexpr std::size_t kFdMargin = 64;
+// connections per source address, below the range of ephemeral ports
+constexpr std::size_t kConnectionsPerAddress = 20'000;
+constexpr std::size_t kConnectThreads = 4;
+
+std::size_t rss_bytes()
+{
+    std::size_t pages = 0;
+    std::size_t resident = 0;
+    std::ifstream statm{"/proc/self/statm"};
+    statm >> pages >> resident;
+    return resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+std::size_t raise_fd_limit()
+{
+    rlimit limit{};
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    return limit.rlim_cur;
+}
+
+double quantile_us(std::vector<double> values, double q)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    auto nth = values.begin()
+               + static_cast<std::ptrdiff_t>(q * (values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+template <typename Protocol>
+struct protocol_traits;
+
+template <>
+struct protocol_traits<ip::tcp> {
+    static constexpr const char* name = "tcp";
+
+    static ip::tcp::endpoint server_endpoint()
+    {
+        return {ip::make_address("127.0.0.1"), 0};
+    }
+
+    // spread the connections over source addresses,
+    // each one has its own range of ephemeral ports
+    static void open(
+        ip::tcp::socket& socket,
+        std::size_t index,
+        error_code& ec)
+    {
+        const auto host =
+            static_cast<unsigned char>(2 + index / kConnectionsPerAddress);
+        auto address =
+            ip::address_v4{ip::address_v4::bytes_type{127, 0, 0, host}};
+        socket.open(ip::tcp::v4(), ec);
+        if (!ec) {
+            socket.bind({address, 0}, ec);
+        }
+    }
+
+    static void remove(const ip::tcp::endpoint&) {}
+};
+
+#if defined(PACKIO_HAS_LOCAL_SOCKETS)
+template <>
+struct protocol_traits<local::stream_protocol> {
+    static constexpr const char* name = "unix";
+
+    static local::stream_protocol::endpoint server_endpoint()
+    {
+        auto path = "/tmp/packio-bench-" + std::to_string(::getpid());
+        ::unlink(path.c_str());
+        return {path};
+    }
+
+    static void open(local::stream_protocol::socket&, std::size_t, error_code&)
+    {
+    }
+
+    static void remove(const local::stream_protocol::endpoint& endpoint)
+    {
+        ::unlink(endpoint.path().c_str());
+    }
+};
+#endif // defined(PACKIO_HAS_LOCAL_SOCKETS)
+
+// serve until killed, write the endpoint to the pipe once listening
+template <typename Protocol>
+[[noreturn]] void run_server(typename Protocol::endpoint endpoint, int pipe_fd)
+{
+    using server_type =
+        packio::msgpack_rpc::server<typename Protocol::acceptor>;
+
+    io_context io;
+    auto server = std::make_shared<server_type>(
+        typename Protocol::acceptor{io, endpoint});
+    std::weak_ptr<server_type> weak_server = server;
+    server->dispatcher()->add("echo", [](int i) { return i; });
+    server->dispatcher()->add("rss", [] { return rss_bytes(); });
+    server->dispatcher()->add("sessions", [weak_server] {
+        auto server = weak_server.lock();
+        return server ? server->get_session_count() : std::size_t{0};
+    });
+    server->async_serve_forever();
+
+    endpoint = server->acceptor().local_endpoint();
+    const auto size = static_cast<ssize_t>(endpoint.size());
+    if (::write(pipe_fd, endpoint.data(), endpoint.size()) != size) {
+        std::_Exit(1);
+    }
+    ::close(pipe_fd);
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::thread::hardware_concurrency(); ++i) {
+        threads.emplace_back([&] { io.run(); });
+    }
+    io.run();
+    std::_Exit(0);
+}
+
+template <typename Protocol>
+void run(std::size_t n_connections)
+{
+    using client_type = packio::msgpack_rpc::client<typename Protocol::socket>;
+    using endpoint_type = typename Protocol::endpoint;
+    using traits = protocol_traits<Protocol>;
+
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        std::perror("pipe");
+        return;
+    }
+    endpoint_type endpoint = traits::server_endpoint();
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        std::perror("fork");
+        return;
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        run_server<Protocol>(endpoint, fds[1]);
+    }
+    ::close(fds[1]);
+    const auto size = ::read(fds[0], endpoint.data(), endpoint.capacity());
+    ::close(fds[0]);
+    if (size <= 0) {
+        std::printf("server failed to start\n");
+        ::waitpid(pid, nullptr, 0);
+        return;
+    }
+    endpoint.resize(static_cast<std::size_t>(size));
+
+    io_context io;
+    auto work = make_work_guard(io);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < std::thread::hardware_concurrency(); ++i) {
+        threads.emplace_back([&] { io.run(); });
+    }
+    auto stop = [&] {
+        work.reset();
+        io.stop();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, nullptr, 0);
+        traits::remove(endpoint);
+    };
+
+    auto control = std::make_shared<client_type>(typename Protocol::socket{io});
+    control->socket().connect(endpoint);
+    auto call = [&](std::string_view name) {
+        auto result = control->async_call(name, use_future).get().result;
+        return result.template as<std::size_t>();
+    };
+    const std::size_t rss_before = call("rss");
+
+    // idle connections
+    std::vector<std::shared_ptr<client_type>> clients(n_connections);
+    auto start = clock_type::now();
+    std::vector<std::thread> connectors;
+    std::atomic<std::size_t> failures{0};
+    for (std::size_t t = 0; t < kConnectThreads; ++t) {
+        connectors.emplace_back([&, t] {
+            for (std::size_t i = t; i < n_connections; i += kConnectThreads) {
+                auto client = std::make_shared<client_type>(
+                    typename Protocol::socket{io});
+                error_code ec;
+                traits::open(client->socket(), i, ec);
+                if (!ec) {
+                    client->socket().connect(endpoint, ec);
+                }
+                if (ec) {
+                    ++failures;
+                    continue;
+                }
+                clients[i] = std::move(client);
+            }
+        });
+    }
+    for (auto& connector : connectors) {
+        connector.join();
+    }
+    const std::size_t connected = n_connections - failures;
+    if (connected == 0) {
+        std::printf("%4s: no connection\n", traits::name);
+        stop();
+        return;
+    }
+    while (call("sessions") < connected + 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    const double accept_s =
+        std::chrono::duration<double>(clock_type::now() - start).count();
+    const std::size_t rss_idle = call("rss");
+
+    // lightly active connections: one call on each of them per round,
+    // the first round measures the time to first response
+    std::vector<double> first_response_us(n_connections, -1);
+    double round_s[2];
+    for (int round = 0; round < 2; ++round) {
+        std::promise<void> done;
+        std::atomic<std::size_t> remaining{connected};
+        start = clock_type::now();
+        for (std::size_t i = 0; i < n_connections; ++i) {
+            if (!clients[i]) {
+                continue;
+            }
+            auto sent = clock_type::now();
+            clients[i]->async_call(
+                "echo",
+                std::tuple{static_cast<int>(i)},
+                [&, i, sent, round](error_code, auto) {
+                    if (round == 0) {
+                        first_response_us[i] =
+                            std::chrono::duration<double, std::micro>(
+                                clock_type::now() - sent)
+                                .count();
+                    }
+                    if (--remaining == 0) {
+                        done.set_value();
+                    }
+                });
+        }
+        done.get_future().wait();
+        round_s[round] =
+            std::chrono::duration<double>(clock_type::now() - start).count();
+    }
+    const std::size_t rss_active = call("rss");
+    first_response_us.erase(
+        std::remove(first_response_us.begin(), first_response_us.end(), -1),
+        first_response_us.end());
+
+    std::printf(
+        "%4s %7zu connections: rss %6.0f B/idle %6.0f B/active, "
+        "accept %8.0f conn/s, first response p50 %8.1f us "
+        "p99 %8.1f us, round %8.0f calls/s",
+        traits::name,
+        connected,
+        (static_cast<double>(rss_idle) - rss_before) / connected,
+        (static_cast<double>(rss_active) - rss_before) / connected,
+        connected / accept_s,
+        quantile_us(first_response_us, 0.5),
+        quantile_us(first_response_us, 0.99),
+        connected / round_s[1]);
+    if (failures != 0) {
+        std::printf(" (%zu connections failed)", failures.load());
+    }
+    std::printf("\n");
+
+    clients.clear();
+    control.reset();
+    stop();
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t max_connections = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                           : 100'000;
+    const std::size_t fd_limit = raise_fd_limit();
+    if (fd_limit < max_connections + kFdMargin) {
+        std::printf(
+            "limited to %zu connections by RLIMIT_NOFILE\n",
+            fd_limit - kFdMargin);
+        max_connections = fd_limit - kFdMargin;
+    }
+
+    // the small count gives the reference throughput
+    for (std::size_t n : {1'000, 10'000, 50'000, 100'000}) {
+        if (n > max_connections) {
+            break;
+        }
+        run<ip::tcp>(n);
+#if defined(PACKIO_HAS_LOCAL_SOCKETS)
+        run<local::stream_protocol>(n);
+#endif // defined(PACKIO_HAS_LOCAL_SOCKETS)
+    }
+    return 0;
+}
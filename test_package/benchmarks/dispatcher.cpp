@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <packio/packio.h>
+
+using dispatcher_type = packio::msgpack_rpc::dispatcher<>;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+double elapsed_ns(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(clock_type::now() - start)
+        .count();
+}
+
+std::vector<std::string> make_names(std::size_t n)
+{
+    std::vector<std::string> names;
+    names.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        names.push_back("service.procedure_" + std::to_string(i));
+    }
+    return names;
+}
+
+void run(std::size_t n_procedures)
+{
+    constexpr std::size_t kNLookups = 1'000'000;
+    constexpr std::size_t kHotSet = 100;
+    auto names = make_names(n_procedures);
+
+    auto start = clock_type::now();
+    dispatcher_type one_by_one;
+    for (const auto& name : names) {
+        one_by_one.add(name, [](int i) { return i; });
+    }
+    double add_ns = elapsed_ns(start);
+
+    start = clock_type::now();
+    dispatcher_type bulk;
+    dispatcher_type::procedure_set set{n_procedures};
+    for (const auto& name : names) {
+        set.add(name, [](int i) { return i; });
+    }
+    bulk.add_bulk(std::move(set));
+    double add_bulk_ns = elapsed_ns(start);
+
+    start = clock_type::now();
+    dispatcher_type lazy;
+    dispatcher_type::procedure_set lazy_set{n_procedures};
+    for (const auto& name : names) {
+        lazy_set.add_lazy(name, [] { return [](int i) { return i; }; });
+    }
+    lazy.add_bulk(std::move(lazy_set));
+    double add_lazy_ns = elapsed_ns(start);
+
+    // the hot set isolates the cost of the lookup itself,
+    // spreading the lookups over all the names adds the cache misses
+    std::size_t found = 0;
+    std::size_t hot_set = std::min<std::size_t>(kHotSet, n_procedures);
+    start = clock_type::now();
+    for (std::size_t i = 0; i < kNLookups; ++i) {
+        found += bulk.get(names[(i * 7919) % hot_set]) != nullptr;
+    }
+    double hot_lookup_ns = elapsed_ns(start) / kNLookups;
+
+    start = clock_type::now();
+    for (std::size_t i = 0; i < kNLookups; ++i) {
+        found += bulk.get(names[(i * 7919) % n_procedures]) != nullptr;
+    }
+    double lookup_ns = elapsed_ns(start) / kNLookups;
+
+    std::printf(
+        "%7zu procedures: add %7.1f ms, add_bulk %7.1f ms, "
+        "add_bulk lazy %7.1f ms, lookup %5.1f ns (hot set) "
+        "%5.1f ns (all names)\n",
+        n_procedures,
+        add_ns / 1e6,
+        add_bulk_ns / 1e6,
+        add_lazy_ns / 1e6,
+        hot_lookup_ns,
+        lookup_ns);
+    if (found != 2 * kNLookups) {
+        std::printf("unexpected missing procedures\n");
+    }
+}
+
+} // namespace
+
+int main(int, char**)
+{
+    for (std::size_t n : {100, 1'000, 10'000, 50'000, 200'000}) {
+        run(n);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+// JSON-RPC string throughput benchmark
+//
+// Serializes and parses responses carrying long strings, a text document
+// with a few characters to escape and a base64 blob, with nlohmann and
+// with the vectorized path used by nl_json_rpc.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <packio/packio.h>
+
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+double elapsed_s(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+std::string make_document(std::size_t size)
+{
+    static constexpr char kLine[] =
+        "The \"quick\" brown fox jumps over the lazy dog, caf\xc3\xa9.\n";
+    std::string document;
+    while (document.size() < size) {
+        document += kLine;
+    }
+    return document;
+}
+
+std::string make_base64(std::size_t size)
+{
+    static constexpr char kAlphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string blob(size, '=');
+    for (std::size_t i = 0; i < size; ++i) {
+        blob[i] = kAlphabet[(i * 7919) % 64];
+    }
+    return blob;
+}
+
+template <typename F>
+double throughput_mb_s(std::size_t bytes, std::size_t iterations, F&& f)
+{
+    const auto start = clock_type::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        f();
+    }
+    return static_cast<double>(bytes * iterations) / 1e6 / elapsed_s(start);
+}
+
+void run(const char* name, const std::string& payload)
+{
+    constexpr std::size_t kBytes = 200'000'000;
+    const nlohmann::json response = {
+        {"jsonrpc", "2.0"},
+        {"id", 42},
+        {"result", {{"name", name}, {"payload", payload}}},
+    };
+    const std::string serialized = response.dump();
+    const std::size_t iterations = kBytes / serialized.size() + 1;
+    const std::size_t size = serialized.size();
+
+    std::size_t sink = 0;
+    const double dump = throughput_mb_s(size, iterations, [&] {
+        sink += response.dump().size();
+    });
+    const double fast_dump = throughput_mb_s(size, iterations, [&] {
+        sink += packio::nl_json_rpc::internal::dump(response).size();
+    });
+    const double parse = throughput_mb_s(size, iterations, [&] {
+        sink += nlohmann::json::parse(serialized).size();
+    });
+    const double fast_parse = throughput_mb_s(size, iterations, [&] {
+        sink += packio::nl_json_rpc::internal::parse(serialized).size();
+    });
+
+    std::printf(
+        "%8s %8zu B: serialize %7.0f MB/s (nlohmann %7.0f MB/s), "
+        "parse %7.0f MB/s (nlohmann %7.0f MB/s)\n",
+        name,
+        size,
+        fast_dump,
+        dump,
+        fast_parse,
+        parse);
+    if (sink == 0) {
+        std::printf("unexpected empty output\n");
+    }
+}
+
+} // namespace
+
+int main(int, char**)
+{
+    for (std::size_t size : {100, 10'000, 1'000'000}) {
+        run("document", make_document(size));
+        run("base64", make_base64(size));
+    }
+    return 0;
+}
@@ -6,19 +6,23 @@ from conans import ConanFile, CMake, tools
 class PackioConan(ConanFile):
     settings = "os", "compiler", "build_type", "arch"
     generators = "cmake"
-    requires = ["gtest/1.10.0"]
+    requires = ["gtest/1.10.0", "zlib/1.2.11"]
     options = {
         "boost": "ANY",
         "asio": "ANY",
         "coroutines": [True, False],
+        "benchmarks": [True, False],
         "loglevel": [None, "trace", "debug", "info", "warn", "error"],
+        "contention_profiling": [True, False],
         "cppstd": ["17", "20"],
     }
     default_options = {
         "boost": None,
         "asio": None,
         "coroutines": False,
+        "benchmarks": False,
         "loglevel": None,
+        "contention_profiling": False,
         "cppstd": "17",
     }
 
@@ -39,8 +43,12 @@ class PackioConan(ConanFile):
         defs = dict()
         if self.options.loglevel:
             defs["PACKIO_LOGGING"] = self.options.loglevel
+        if self.options.contention_profiling:
+            defs["PACKIO_CONTENTION_PROFILING"] = "1"
         if self.options.coroutines:
             defs["PACKIO_COROUTINES"] = "1"
+        if self.options.benchmarks:
+            defs["BUILD_BENCHMARKS"] = "1"
         # dont use the compiler setting, it breaks pre-built binaries
         defs["CMAKE_CXX_STANDARD"] = self.options.cppstd
 
@@ -188,6 +188,35 @@ TYPED_TEST(Test, test_args_types)
     ASSERT_RESULT_EQ(this->client_->async_call("add", pair, use_future), 35);
 }
 
+TYPED_TEST(Test, test_bytes)
+{
+    this->server_->async_serve_forever();
+    this->connect();
+    this->async_run();
+
+    this->server_->dispatcher()->add("reverse", [](packio::bytes data) {
+        std::reverse(data.begin(), data.end());
+        return data;
+    });
+
+    // sizes around the blocks of the vectorized base64
+    for (std::size_t size : {0, 1, 2, 3, 16, 47, 1000, 100'000}) {
+        packio::bytes data(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<uint8_t>(i * 7);
+        }
+        packio::bytes reversed(data.rbegin(), data.rend());
+        ASSERT_RESULT_EQ(
+            this->client_->async_call(
+                "reverse", std::tuple{std::move(data)}, use_future),
+            reversed);
+    }
+
+    ASSERT_EQ(packio::bytes{"abc"}.str(), "abc");
+    ASSERT_RESULT_IS_ERROR(
+        this->client_->async_call("reverse", std::tuple{42}, use_future));
+}
+
 TYPED_TEST(Test, test_functions)
 {
     using completion_handler =
@@ -458,6 +487,119 @@ TYPED_TEST(Test, test_named_arguments)
 #endif // defined(PACKIO_HAS_CO_AWAIT) || defined(PACKIO_FORCE_COROUTINES)
 }
 
+TYPED_TEST(Test, test_blocking_call)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add("add", [](int a, int b) { return a + b; });
+    std::optional<completion_handler> blocked;
+    this->server_->dispatcher()->add_async(
+        "block", [&](completion_handler handler) {
+            blocked.emplace(std::move(handler));
+        });
+    this->connect();
+    this->async_run();
+
+    error_code ec;
+    for (int i = 0; i < 10; ++i) {
+        auto response = this->client_->call("add", std::tuple{i, 1}, 1s, ec);
+        ASSERT_FALSE(ec);
+        ASSERT_EQ(i + 1, get<int>(response.result));
+    }
+
+    {
+        auto response = this->client_->call("unexisting", 1s, ec);
+        ASSERT_FALSE(ec);
+        ASSERT_TRUE(is_error_response(response));
+    }
+
+    // the late completion of a timed out call is ignored
+    this->client_->call("block", 10ms, ec);
+    ASSERT_EQ(make_error_code(error::timed_out), ec);
+    post(this->io_, [&] { blocked->set_value(); });
+    auto response = this->client_->call("add", std::tuple{1, 2}, 1s, ec);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(3, get<int>(response.result));
+
+    // the late completion can also arrive after the caller thread exited
+    std::thread{[&] {
+        error_code thread_ec;
+        this->client_->call("block", 10ms, thread_ec);
+        EXPECT_EQ(make_error_code(error::timed_out), thread_ec);
+    }}.join();
+    post(this->io_, [&] { blocked->set_value(); });
+    response = this->client_->call("add", std::tuple{2, 3}, 1s, ec);
+    ASSERT_FALSE(ec);
+    ASSERT_EQ(5, get<int>(response.result));
+}
+
+TYPED_TEST(Test, test_notification_batching)
+{
+    using client_type = typename TestFixture::client_type;
+    using socket_type = typename TestFixture::socket_type;
+    constexpr int kNNotifications{1000};
+
+    latch received{kNNotifications};
+    std::vector<int> values;
+    this->server_->dispatcher()->add("push", [&](int i) {
+        values.push_back(i);
+        received.count_down();
+    });
+    this->server_->async_serve_forever();
+    this->client_->set_notification_batching(1024, 1ms);
+    this->connect();
+    this->async_run();
+
+    for (int i = 0; i < kNNotifications; ++i) {
+        ASSERT_TRUE(this->client_->notify("push", std::tuple{i}));
+    }
+    ASSERT_TRUE(received.wait_for(1s));
+    for (int i = 0; i < kNNotifications; ++i) {
+        ASSERT_EQ(i, values[i]);
+    }
+
+    // a batch smaller than the flush size is written after the delay
+    received.reset(1);
+    ASSERT_TRUE(this->client_->notify("push", std::tuple{-1}));
+    ASSERT_TRUE(received.wait_for(1s));
+
+    // notifications are dropped once the batch is full
+    auto client = std::make_shared<client_type>(socket_type{this->io_});
+    client->set_notification_batching(
+        1024 * 1024, 10ms, 64, client_type::batch_overflow::drop);
+    client->socket().connect(this->server_->acceptor().local_endpoint());
+    received.reset(0);
+    int sent = 0;
+    for (int i = 0; i < 100; ++i) {
+        if (client->notify("push", std::tuple{i})) {
+            received.count_up();
+            ++sent;
+        }
+    }
+    ASSERT_LT(0, sent);
+    ASSERT_GT(100, sent);
+    ASSERT_TRUE(received.wait_for(1s));
+
+    // notify waits for the batch to be written with the block policy
+    auto blocking_client =
+        std::make_shared<client_type>(socket_type{this->io_});
+    blocking_client->set_notification_batching(
+        1024 * 1024, 1ms, 64, client_type::batch_overflow::block);
+    blocking_client->socket().connect(
+        this->server_->acceptor().local_endpoint());
+    const std::size_t first = values.size();
+    received.reset(100);
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(blocking_client->notify("push", std::tuple{i}));
+    }
+    ASSERT_TRUE(received.wait_for(1s));
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(i, values[first + i]);
+    }
+}
+
 TYPED_TEST(Test, test_dispatcher)
 {
     using completion_handler =
@@ -478,6 +620,13 @@ TYPED_TEST(Test, test_dispatcher)
     ASSERT_FALSE(this->server_->dispatcher()->add("f001", []() {}));
     ASSERT_FALSE(this->server_->dispatcher()->add("f002", []() {}));
 
+    // reserved to the map calls
+    ASSERT_FALSE(this->server_->dispatcher()->add("rpc.map", []() {}));
+    ASSERT_FALSE(this->server_->dispatcher()->add_async(
+        "rpc.map", [](completion_handler handler) { handler(); }));
+    ASSERT_FALSE(this->server_->dispatcher()->add_lazy(
+        "rpc.map", []() { return []() {}; }));
+
     ASSERT_RESULT_IS_OK(this->client_->async_call("f001", use_future));
     ASSERT_RESULT_IS_OK(this->client_->async_call("f002", use_future));
 
@@ -503,6 +652,136 @@ TYPED_TEST(Test, test_dispatcher)
     ASSERT_FALSE(this->server_->dispatcher()->has("f003"));
 }
 
+TYPED_TEST(Test, test_dispatcher_bulk)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    using dispatcher_type =
+        std::decay_t<decltype(*this->server_->dispatcher())>;
+
+    this->server_->async_serve_forever();
+    this->connect();
+    this->async_run();
+
+    std::atomic<int> created{0};
+    typename dispatcher_type::procedure_set set{3};
+    ASSERT_TRUE(set.add("f001", [](int i) { return i; }));
+    ASSERT_TRUE(set.add_async(
+        "f002", [](completion_handler handler, int i) { handler(2 * i); }));
+    ASSERT_TRUE(set.add_lazy("f003", [&]() {
+        ++created;
+        return [](int i) { return 3 * i; };
+    }));
+    ASSERT_FALSE(set.add("f001", [](int i) { return i; }));
+    ASSERT_FALSE(set.add("rpc.map", [](int i) { return i; }));
+    ASSERT_EQ(3u, set.size());
+
+    ASSERT_TRUE(this->server_->dispatcher()->add("f004", []() {}));
+    ASSERT_EQ(3u, this->server_->dispatcher()->add_bulk(std::move(set)));
+    ASSERT_EQ(0, created.load());
+
+    auto known = this->server_->dispatcher()->known();
+    ASSERT_EQ(
+        (std::set<std::string>{"f001", "f002", "f003", "f004"}),
+        std::set<std::string>(begin(known), end(known)));
+
+    auto f1 = this->client_->async_call("f001", std::tuple{1}, use_future);
+    ASSERT_RESULT_EQ(f1, 1);
+    auto f2 = this->client_->async_call("f002", std::tuple{1}, use_future);
+    ASSERT_RESULT_EQ(f2, 2);
+    auto f3 = this->client_->async_call("f003", std::tuple{1}, use_future);
+    ASSERT_RESULT_EQ(f3, 3);
+    auto f4 = this->client_->async_call("f003", std::tuple{2}, use_future);
+    ASSERT_RESULT_EQ(f4, 6);
+    ASSERT_EQ(1, created.load());
+
+    ASSERT_TRUE(this->server_->dispatcher()->add_lazy("f005", [&]() {
+        ++created;
+        return [](int i) { return 5 * i; };
+    }));
+    auto f5 = this->client_->async_call_map(
+        "f005", std::vector<std::tuple<int>>{{1}, {2}}, use_future);
+    auto res = safe_future_get(f5);
+    ASSERT_EQ(2u, get_map_size(res.result));
+    ASSERT_EQ(10, get_map_result<int>(res.result, 1));
+    ASSERT_EQ(2, created.load());
+
+    // names already registered are not replaced
+    typename dispatcher_type::procedure_set other;
+    ASSERT_TRUE(other.add("f001", [](int i) { return -i; }));
+    ASSERT_TRUE(other.add("f006", [](int i) { return i; }));
+    ASSERT_EQ(1u, this->server_->dispatcher()->add_bulk(std::move(other)));
+    auto f6 = this->client_->async_call("f001", std::tuple{1}, use_future);
+    ASSERT_RESULT_EQ(f6, 1);
+}
+
+TYPED_TEST(Test, test_call_map)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    constexpr int kNItems{1000};
+
+    this->server_->async_serve_forever();
+    this->connect();
+    this->async_run();
+
+    this->server_->dispatcher()->add("square", [](int i) { return i * i; });
+    std::atomic<int> calls{0};
+    this->server_->dispatcher()->add("count", [&](int) { ++calls; });
+    this->server_->dispatcher()->add_async(
+        "async_square", [](completion_handler handler, int i) {
+            handler(i * i);
+        });
+
+    {
+        std::vector<std::tuple<int>> args;
+        for (int i = 0; i < kNItems; ++i) {
+            args.emplace_back(i);
+        }
+        auto f = this->client_->async_call_map("square", args, use_future);
+        auto res = safe_future_get(f);
+        ASSERT_FALSE(is_error_response(res));
+        ASSERT_EQ(static_cast<std::size_t>(kNItems), get_map_size(res.result));
+        for (int i = 0; i < kNItems; ++i) {
+            ASSERT_FALSE(is_map_error(res.result, i));
+            ASSERT_EQ(i * i, get_map_result<int>(res.result, i));
+        }
+
+        f = this->client_->async_call_map("count", args, use_future);
+        ASSERT_RESULT_IS_OK(f);
+        ASSERT_EQ(kNItems, calls.load());
+    }
+
+    {
+        // errors are reported per item
+        std::vector<std::tuple<int, int>> args{{1, 2}, {3, 4}};
+        auto f = this->client_->async_call_map("square", args, use_future);
+        auto res = safe_future_get(f);
+        ASSERT_FALSE(is_error_response(res));
+        ASSERT_EQ(2u, get_map_size(res.result));
+        ASSERT_TRUE(is_map_error(res.result, 0));
+        ASSERT_TRUE(is_map_error(res.result, 1));
+    }
+
+    {
+        auto f = this->client_->async_call_map(
+            "square", std::vector<std::tuple<int>>{}, use_future);
+        auto res = safe_future_get(f);
+        ASSERT_FALSE(is_error_response(res));
+        ASSERT_EQ(0u, get_map_size(res.result));
+    }
+
+    {
+        // only synchronous procedures can be mapped
+        std::vector<std::tuple<int>> args{{1}};
+        auto f1 = this->client_->async_call_map(
+            "async_square", args, use_future);
+        ASSERT_RESULT_IS_ERROR(f1);
+        auto f2 = this->client_->async_call_map("unknown", args, use_future);
+        ASSERT_RESULT_IS_ERROR(f2);
+    }
+}
+
 TYPED_TEST(Test, test_end_of_work)
 {
     using client_type = typename std::decay_t<decltype(*this)>::client_type;
@@ -708,6 +987,857 @@ TYPED_TEST(Test, test_shared_dispatcher)
     ASSERT_TRUE(l.wait_for(1s));
 }
 
+TYPED_TEST(Test, test_single_threaded)
+{
+    using rpc_type = typename std::decay_t<decltype(*this)>::client_type::rpc_type;
+    using protocol_type =
+        typename std::decay_t<decltype(*this)>::client_type::protocol_type;
+    using endpoint_type = typename protocol_type::endpoint;
+    using dispatcher_type =
+        packio::dispatcher<rpc_type, default_map, single_threaded::mutex_type>;
+    using server_type = packio::server<
+        rpc_type,
+        typename protocol_type::acceptor,
+        packio::default_dispatcher,
+        single_threaded>;
+    static_assert(
+        std::is_same_v<dispatcher_type, typename server_type::dispatcher_type>);
+    using client_type = packio::client<
+        rpc_type,
+        typename protocol_type::socket,
+        default_map,
+        single_threaded>;
+
+    io_context io{1};
+    auto server = std::make_shared<server_type>(
+        typename protocol_type::acceptor{io, get_endpoint<endpoint_type>()});
+    auto client =
+        std::make_shared<client_type>(typename protocol_type::socket{io});
+
+    server->dispatcher()->add("add", [](int a, int b) { return a + b; });
+    server->async_serve_forever();
+    client->socket().connect(server->acceptor().local_endpoint());
+
+    int result = 0;
+    client->async_call("add", std::tuple{12, 23}, [&](auto ec, auto res) {
+        ASSERT_FALSE(ec);
+        result = get<int>(res.result);
+        client->async_notify("add", std::tuple{1, 2}, [&](auto ec) {
+            ASSERT_FALSE(ec);
+            io.stop();
+        });
+    });
+    io.run_for(1s);
+    ASSERT_EQ(35, result);
+}
+
+TYPED_TEST(Test, test_max_message_size)
+{
+    this->server_->async_serve([&](auto ec, auto session) {
+        ASSERT_FALSE(ec);
+        session->set_max_message_size(1024);
+        ASSERT_EQ(1024u, session->get_max_message_size());
+        session->start();
+    });
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+
+    this->connect();
+    this->async_run();
+
+    {
+        // small enough for both ends
+        auto f = this->client_->async_call(
+            "echo", std::tuple{std::string(100, 'a')}, use_future);
+        ASSERT_RESULT_EQ(f, std::string(100, 'a'));
+    }
+
+    {
+        // too big for the client
+        this->client_->set_max_message_size(256);
+        ASSERT_EQ(256u, this->client_->get_max_message_size());
+        auto f = this->client_->async_call(
+            "echo", std::tuple{std::string(500, 'a')}, use_future);
+        ASSERT_FUTURE_THROW(f, std::exception);
+    }
+
+    this->client_->set_max_message_size(
+        std::decay_t<decltype(*this->client_)>::kDefaultMaxMessageSize);
+    this->server_->async_serve([&](auto ec, auto session) {
+        ASSERT_FALSE(ec);
+        session->set_max_message_size(1024);
+        session->start();
+    });
+    this->connect();
+
+    {
+        // too big for the server, the connection is closed
+        auto f = this->client_->async_call(
+            "echo", std::tuple{std::string(2048, 'a')}, use_future);
+        ASSERT_FUTURE_THROW(f, std::exception);
+    }
+}
+
+TYPED_TEST(Test, test_invalid_frames)
+{
+    using client_type = typename TestFixture::client_type;
+    using socket_type = typename TestFixture::socket_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+
+    acceptor_type acceptor{this->io_, get_endpoint<endpoint_type>()};
+    auto work = make_work_guard(this->io_);
+    this->async_run();
+
+    // the pending calls fail instead of waiting for a lost response
+    auto expect_aborted = [&](const std::string& frame,
+                              std::optional<compression_codec> codec = {}) {
+        auto client = std::make_shared<client_type>(socket_type{this->io_});
+        if (codec) {
+            client->set_compression(std::move(*codec));
+        }
+        client->socket().connect(acceptor.local_endpoint());
+        auto peer = acceptor.accept();
+        std::promise<error_code> promise;
+        auto future = promise.get_future();
+        client->async_call(
+            "echo", [&](error_code ec, auto) { promise.set_value(ec); });
+        write(peer, buffer(frame));
+        ASSERT_EQ(
+            make_error_code(error::connection_aborted),
+            safe_future_get(future));
+    };
+
+    // unknown codec
+    expect_aborted(packio::internal::make_frame(0x42, "abc", 3));
+    // fragment bigger than its message
+    expect_aborted(packio::internal::make_fragment_header(8, 4) + "12345678");
+    // fragment holding another fragment
+    const auto inner = packio::internal::make_fragment_header(1, 1) + "x";
+    expect_aborted(
+        packio::internal::make_fragment_header(inner.size(), inner.size())
+        + inner);
+    // fragments of a message advertising different sizes
+    expect_aborted(
+        packio::internal::make_fragment_header(4, 0xffffffff) + "abcd"
+        + packio::internal::make_fragment_header(4, 8) + "efgh");
+#if PACKIO_HAS_ZLIB
+    // compressed message advertising a size it can't expand to
+    auto compressed = zlib_codec().compress(std::string(64, 'a'));
+    ASSERT_TRUE(compressed);
+    expect_aborted(
+        packio::internal::make_frame(kZlibCodecId, *compressed, 0xffffffff),
+        zlib_codec());
+#endif // PACKIO_HAS_ZLIB
+}
+
+TYPED_TEST(Test, test_adaptive_buffer_reserve_size)
+{
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+    this->server_->dispatcher()->add(
+        "data", [](int size) { return std::string(size, 'a'); });
+
+    this->connect();
+    this->async_run();
+
+    // the current size is kept within the bounds
+    this->client_->set_adaptive_buffer_reserve_size(1024, 16 * 1024);
+    ASSERT_EQ(4096u, this->client_->get_buffer_reserve_size());
+
+    // bulk responses fill the buffer, it grows up to the maximum
+    for (int i = 0; i < 10; ++i) {
+        auto f = this->client_->async_call("data", std::tuple{1 << 20}, use_future);
+        ASSERT_RESULT_IS_OK(f);
+    }
+    ASSERT_EQ(16u * 1024, this->client_->get_buffer_reserve_size());
+
+    // sustained small responses shrink it back to the minimum
+    for (int i = 0; i < 200; ++i) {
+        auto f = this->client_->async_call("echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_IS_OK(f);
+    }
+    ASSERT_EQ(1024u, this->client_->get_buffer_reserve_size());
+
+    this->client_->set_buffer_reserve_size(4096);
+    ASSERT_EQ(4096u, this->client_->get_buffer_reserve_size());
+    auto f = this->client_->async_call("data", std::tuple{1 << 20}, use_future);
+    ASSERT_RESULT_IS_OK(f);
+    ASSERT_EQ(4096u, this->client_->get_buffer_reserve_size());
+}
+
+TYPED_TEST(Test, test_admin_procedures)
+{
+    using settings_type = std::map<std::string, uint64_t>;
+    using server_type = std::decay_t<decltype(*this->server_)>;
+    using session_type = std::decay_t<typename server_type::session_type>;
+
+    std::shared_ptr<session_type> session_ptr;
+    this->server_->async_serve([&](auto ec, auto session) {
+        ASSERT_FALSE(ec);
+        session->start();
+        session_ptr = session;
+    });
+    ASSERT_TRUE(add_admin_procedures(this->server_));
+    ASSERT_FALSE(add_admin_procedures(this->server_));
+    ASSERT_TRUE(add_admin_procedures(this->server_, "other."));
+
+    this->connect();
+    this->async_run();
+
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.get_settings", use_future);
+        auto settings = get<settings_type>(safe_future_get(f).result);
+        ASSERT_EQ(4096u, settings["buffer_reserve_min_size"]);
+        ASSERT_EQ(4096u, settings["buffer_reserve_max_size"]);
+        ASSERT_EQ(1u, settings["sessions"]);
+    }
+
+    // buffer sizes apply to the running sessions
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.set_adaptive_buffer_reserve_size",
+            std::tuple{1024, 8192},
+            use_future);
+        ASSERT_RESULT_IS_OK(f);
+        ASSERT_EQ(4096u, session_ptr->get_buffer_reserve_size());
+        ASSERT_EQ(
+            std::make_pair(std::size_t{1024}, std::size_t{8192}),
+            this->server_->get_buffer_reserve_size());
+    }
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.set_buffer_reserve_size", std::tuple{8192}, use_future);
+        ASSERT_RESULT_IS_OK(f);
+        ASSERT_EQ(8192u, session_ptr->get_buffer_reserve_size());
+    }
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.set_buffer_reserve_size", std::tuple{0}, use_future);
+        ASSERT_RESULT_IS_ERROR(f);
+    }
+
+    // the maximum message size applies to new sessions
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.set_max_message_size", std::tuple{1024}, use_future);
+        ASSERT_RESULT_IS_OK(f);
+        ASSERT_EQ(1024u, this->server_->get_max_message_size());
+        ASSERT_EQ(
+            session_type::kDefaultMaxMessageSize,
+            session_ptr->get_max_message_size());
+    }
+
+    latch started{1};
+    this->server_->async_serve([&](auto ec, auto session) {
+        ASSERT_FALSE(ec);
+        session->start();
+        session_ptr = session;
+        started.count_down();
+    });
+    using client_type = typename TestFixture::client_type;
+    using socket_type = typename TestFixture::socket_type;
+    auto other_client = std::make_shared<client_type>(socket_type{this->io_});
+    other_client->socket().connect(this->server_->acceptor().local_endpoint());
+    ASSERT_TRUE(started.wait_for(1s));
+    ASSERT_EQ(1024u, session_ptr->get_max_message_size());
+    ASSERT_EQ(8192u, session_ptr->get_buffer_reserve_size());
+
+    {
+        auto f = this->client_->async_call(
+            "packio.admin.get_settings", use_future);
+        auto settings = get<settings_type>(safe_future_get(f).result);
+        ASSERT_EQ(8192u, settings["buffer_reserve_min_size"]);
+        ASSERT_EQ(8192u, settings["buffer_reserve_max_size"]);
+        ASSERT_EQ(1024u, settings["max_message_size"]);
+    }
+}
+
+TYPED_TEST(Test, test_connection_stats)
+{
+    using response_type = typename TestFixture::client_type::response_type;
+    using stats_type = std::vector<
+        std::tuple<std::string, std::map<std::string, uint64_t>>>;
+    constexpr int kNCalls = 10;
+
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+    add_admin_procedures(this->server_);
+
+    this->connect();
+    this->async_run();
+
+    // the stats can be read while the socket is in use
+    std::atomic<bool> done{false};
+    std::thread reader{[&] {
+        while (!done) {
+            (void)this->client_->get_stats();
+        }
+    }};
+    std::vector<std::future<response_type>> futures;
+    for (int i = 0; i < kNCalls; ++i) {
+        futures.push_back(this->client_->async_call(
+            "echo", std::tuple{std::string(100, 'a')}, use_future));
+        futures.back().wait_for(1s);
+    }
+    done = true;
+    reader.join();
+    for (auto& f : futures) {
+        ASSERT_RESULT_IS_OK(f);
+    }
+
+    auto client_stats = this->client_->get_stats();
+    ASSERT_FALSE(client_stats.peer.empty());
+    ASSERT_EQ(static_cast<uint64_t>(kNCalls), client_stats.requests);
+    ASSERT_EQ(0u, client_stats.in_progress);
+    ASSERT_EQ(0u, client_stats.write_queue_bytes);
+    ASSERT_GT(client_stats.bytes_written, kNCalls * 100u);
+    ASSERT_GT(client_stats.bytes_read, kNCalls * 100u);
+    ASSERT_GT(client_stats.average_latency.count(), 0);
+
+    auto sessions = this->server_->get_sessions_stats();
+    ASSERT_EQ(1u, sessions.size());
+    ASSERT_EQ(static_cast<uint64_t>(kNCalls), sessions[0].requests);
+    ASSERT_EQ(client_stats.bytes_written, sessions[0].bytes_read);
+
+    auto top = this->server_->get_top_sessions(5);
+    ASSERT_EQ(1u, top.size());
+    ASSERT_TRUE(this->server_->get_top_sessions(0).empty());
+
+    // the admin call is counted before the stats are reported
+    auto f = this->client_->async_call(
+        "packio.admin.get_top_sessions", std::tuple{1}, use_future);
+    auto reported = get<stats_type>(safe_future_get(f).result);
+    ASSERT_EQ(1u, reported.size());
+    auto& counters = std::get<1>(reported[0]);
+    ASSERT_EQ(kNCalls + 1u, counters["requests"]);
+    ASSERT_EQ(1u, counters["in_progress"]);
+    ASSERT_LT(0u, counters["load"]);
+}
+
+TYPED_TEST(Test, test_memory_budget)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+
+    using client_type = typename TestFixture::client_type;
+    using server_type = typename TestFixture::server_type;
+    using socket_type = typename TestFixture::socket_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+
+    auto budget = std::make_shared<memory_budget>(1 << 20);
+    this->server_->set_memory_budget(budget);
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+
+    std::mutex mtx;
+    std::optional<completion_handler> blocked;
+    latch block_called{1};
+    this->server_->dispatcher()->add_async(
+        "block", [&](completion_handler handler, std::string) {
+            std::unique_lock l{mtx};
+            blocked = std::move(handler);
+            block_called.count_down();
+        });
+
+    this->connect();
+    this->async_run();
+
+    {
+        auto f = this->client_->async_call("echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_EQ(f, "a"s);
+    }
+    // only the reception buffer is left once the response is written
+    auto deadline = std::chrono::steady_clock::now() + 1s;
+    while (this->server_->get_sessions_stats()[0].write_queue_bytes != 0
+           && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    auto stats = this->server_->get_sessions_stats()[0];
+    ASSERT_EQ(0u, stats.pending_request_bytes);
+    ASSERT_LT(0u, stats.read_buffer_bytes);
+    ASSERT_EQ(stats.memory_usage(), budget->used());
+    ASSERT_EQ(1u, budget->sessions());
+
+    // leave room for the reception buffer only, the session stops reading
+    // until its requests complete
+    budget->set_limit(stats.memory_usage());
+    auto f_block = this->client_->async_call(
+        "block", std::tuple{"a"}, use_future);
+    ASSERT_TRUE(block_called.wait_for(1s));
+    ASSERT_TRUE(budget->exceeded());
+    auto f_echo = this->client_->async_call("echo", std::tuple{"b"}, use_future);
+    ASSERT_FUTURE_BLOCKS(f_echo, 100ms);
+
+    budget->set_limit(1 << 20);
+    {
+        std::unique_lock l{mtx};
+        (*blocked)();
+    }
+    ASSERT_RESULT_IS_OK(f_block);
+    ASSERT_RESULT_EQ(f_echo, "b"s);
+
+    // the session also stops reading without requests in progress,
+    // after the read in flight
+    budget->set_limit(1);
+    {
+        auto f = this->client_->async_call("echo", std::tuple{"c"}, use_future);
+        ASSERT_RESULT_EQ(f, "c"s);
+    }
+    f_echo = this->client_->async_call("echo", std::tuple{"d"}, use_future);
+    ASSERT_FUTURE_BLOCKS(f_echo, 100ms);
+    budget->set_limit(1 << 20);
+    ASSERT_RESULT_EQ(f_echo, "d"s);
+
+    // requests are rejected while the budget is exceeded
+    auto shed_budget = std::make_shared<memory_budget>(
+        0, memory_budget::overflow_policy::shed_requests);
+    auto other_server = std::make_shared<server_type>(
+        acceptor_type(this->io_, get_endpoint<endpoint_type>()),
+        this->server_->dispatcher());
+    other_server->set_memory_budget(shed_budget);
+    other_server->async_serve_forever();
+    auto other_client = std::make_shared<client_type>(socket_type{this->io_});
+    other_client->socket().connect(other_server->acceptor().local_endpoint());
+    {
+        auto f = other_client->async_call("echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_IS_ERROR(f);
+    }
+    shed_budget->set_limit(1 << 20);
+    {
+        auto f = other_client->async_call("echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_EQ(f, "a"s);
+    }
+}
+
+#if PACKIO_HAS_ZLIB
+TYPED_TEST(Test, test_compression)
+{
+    using client_type = typename TestFixture::client_type;
+    using server_type = typename TestFixture::server_type;
+    using socket_type = typename TestFixture::socket_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+
+    this->server_->set_compression(zlib_codec());
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+    this->client_->set_compression(zlib_codec());
+    this->connect();
+    this->async_run();
+
+    const std::string big(64 * 1024, 'a');
+
+    // the first message negotiates the compression
+    {
+        auto f = this->client_->async_call("echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_EQ(f, "a"s);
+    }
+
+    {
+        auto before = this->client_->get_stats();
+        auto f = this->client_->async_call("echo", std::tuple{big}, use_future);
+        ASSERT_RESULT_EQ(f, big);
+        auto after = this->client_->get_stats();
+        ASSERT_LT(after.bytes_written - before.bytes_written, big.size() / 10);
+        ASSERT_LT(after.bytes_read - before.bytes_read, big.size() / 10);
+    }
+
+    // small messages are sent as-is
+    {
+        auto before = this->client_->get_stats();
+        auto f = this->client_->async_call("echo", std::tuple{"b"}, use_future);
+        ASSERT_RESULT_EQ(f, "b"s);
+        auto after = this->client_->get_stats();
+        ASSERT_LT(after.bytes_written - before.bytes_written, 100u);
+    }
+
+    // servers without compression receive plain messages
+    auto other_server = std::make_shared<server_type>(
+        acceptor_type(this->io_, get_endpoint<endpoint_type>()),
+        this->server_->dispatcher());
+    other_server->async_serve_forever();
+    auto other_client = std::make_shared<client_type>(socket_type{this->io_});
+    other_client->set_compression(zlib_codec());
+    other_client->socket().connect(other_server->acceptor().local_endpoint());
+    for (int i = 0; i < 2; ++i) {
+        auto before = other_client->get_stats();
+        auto f = other_client->async_call("echo", std::tuple{big}, use_future);
+        ASSERT_RESULT_EQ(f, big);
+        auto after = other_client->get_stats();
+        ASSERT_GT(after.bytes_read - before.bytes_read, big.size());
+    }
+}
+#endif // PACKIO_HAS_ZLIB
+
+TYPED_TEST(Test, test_write_lanes)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    using response_type = typename TestFixture::client_type::response_type;
+    constexpr std::size_t kBulkSize = 16 * 1024;
+    constexpr std::size_t kFragmentSize = 4096;
+
+    this->server_->set_bulk_message_size(kBulkSize);
+    this->server_->set_fragment_size(kFragmentSize);
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+    this->client_->set_bulk_message_size(kBulkSize);
+    this->client_->set_fragment_size(kFragmentSize);
+    ASSERT_EQ(kBulkSize, this->client_->get_bulk_message_size());
+    ASSERT_EQ(kFragmentSize, this->client_->get_fragment_size());
+    this->connect();
+    this->async_run();
+
+    // big messages are fragmented in both directions,
+    // small messages are written between the fragments
+    std::string big(256 * 1024, '\0');
+    for (std::size_t i = 0; i < big.size(); ++i) {
+        big[i] = static_cast<char>('a' + i % 26);
+    }
+    std::vector<std::future<response_type>> big_calls;
+    std::vector<std::future<response_type>> small_calls;
+    for (int i = 0; i < 4; ++i) {
+        big_calls.push_back(
+            this->client_->async_call("echo", std::tuple{big}, use_future));
+        small_calls.push_back(this->client_->async_call(
+            "echo", std::tuple{std::to_string(i)}, use_future));
+    }
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_RESULT_EQ(small_calls[i], std::to_string(i));
+        ASSERT_RESULT_EQ(big_calls[i], big);
+    }
+
+    // a small response queued after a big one is received first
+    std::optional<completion_handler> big_handler;
+    this->server_->dispatcher()->add_async(
+        "big", [&](completion_handler handler) {
+            big_handler.emplace(std::move(handler));
+        });
+    this->server_->dispatcher()->add("small", [&]() {
+        big_handler->set_value(big);
+        return 0;
+    });
+    std::mutex order_mutex;
+    std::vector<std::string> order;
+    latch done{2};
+    auto record = [&](std::string name) {
+        return [&, name](error_code ec, response_type) {
+            EXPECT_FALSE(ec);
+            {
+                std::lock_guard l{order_mutex};
+                order.push_back(name);
+            }
+            done.count_down();
+        };
+    };
+    this->client_->async_call("big", record("big"));
+    this->client_->async_call("small", record("small"));
+    ASSERT_TRUE(done.wait_for(1s));
+    ASSERT_EQ((std::vector<std::string>{"small", "big"}), order);
+
+    // a big message completes under a sustained traffic of small messages
+    constexpr int kMaxInFlight = 256;
+    std::atomic<bool> stop{false};
+    std::atomic<int> in_flight{0};
+    std::thread small_traffic{[&] {
+        while (!stop) {
+            if (in_flight.load() >= kMaxInFlight) {
+                std::this_thread::yield();
+                continue;
+            }
+            ++in_flight;
+            this->client_->async_call(
+                "echo",
+                std::tuple{std::string{"small"}},
+                [&](error_code ec, response_type) {
+                    EXPECT_FALSE(ec);
+                    --in_flight;
+                });
+        }
+    }};
+    auto big_call = this->client_->async_call(
+        "echo", std::tuple{big}, use_future);
+    const bool big_done = big_call.wait_for(5s) == std::future_status::ready;
+    stop = true;
+    small_traffic.join();
+    const auto deadline = std::chrono::steady_clock::now() + 5s;
+    while (in_flight.load() != 0
+           && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(0, in_flight.load());
+    ASSERT_TRUE(big_done);
+    ASSERT_RESULT_EQ(big_call, big);
+}
+
+TYPED_TEST(Test, test_socket_tuning)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    using response_type = typename TestFixture::client_type::response_type;
+    using socket_type = typename TestFixture::socket_type;
+    constexpr int kCalls = 200;
+
+    auto tuning = packio::socket_tuning::throughput();
+    tuning.keep_alive = true;
+    this->server_->set_socket_tuning(tuning);
+    ASSERT_TRUE(this->server_->get_socket_tuning().cork_batches);
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add(
+        "echo", [](std::string str) { return str; });
+    std::optional<completion_handler> hanging;
+    latch hang_called{1};
+    this->server_->dispatcher()->add_async(
+        "hang", [&](completion_handler handler) {
+            hanging = std::move(handler);
+            hang_called.count_down();
+        });
+    this->client_->set_socket_tuning(tuning);
+    ASSERT_TRUE(this->client_->get_socket_tuning().keep_alive);
+    this->connect();
+    this->async_run();
+
+    // the messages queued while writing are corked together
+    std::vector<std::future<response_type>> futures;
+    for (int i = 0; i < kCalls; ++i) {
+        futures.push_back(this->client_->async_call(
+            "echo", std::tuple{std::to_string(i)}, use_future));
+    }
+    for (int i = 0; i < kCalls; ++i) {
+        ASSERT_RESULT_EQ(futures[i], std::to_string(i));
+    }
+
+    if constexpr (std::is_same_v<socket_type, packio::net::ip::tcp::socket>) {
+        packio::net::socket_base::keep_alive keep_alive;
+        this->client_->socket().get_option(keep_alive);
+        ASSERT_TRUE(keep_alive.value());
+        packio::net::ip::tcp::no_delay no_delay;
+        this->client_->socket().get_option(no_delay);
+        ASSERT_TRUE(no_delay.value());
+
+        // the reconnected socket is tuned again
+        auto f = this->client_->async_call("hang", use_future);
+        ASSERT_TRUE(hang_called.wait_for(1s));
+        packio::net::post(this->io_, [&] { this->client_->socket().close(); });
+        ASSERT_FUTURE_CANCELLED(f);
+        this->connect();
+        auto f_echo = this->client_->async_call(
+            "echo", std::tuple{"a"}, use_future);
+        ASSERT_RESULT_EQ(f_echo, "a"s);
+        this->client_->socket().get_option(keep_alive);
+        ASSERT_TRUE(keep_alive.value());
+
+        // reconnected while idle, the socket may get the same handle
+        std::promise<void> closed;
+        packio::net::post(this->io_, [&] {
+            this->client_->socket().close();
+            closed.set_value();
+        });
+        closed.get_future().wait();
+        this->client_->connect(this->server_->acceptor().local_endpoint());
+        f_echo = this->client_->async_call("echo", std::tuple{"b"}, use_future);
+        ASSERT_RESULT_EQ(f_echo, "b"s);
+        this->client_->socket().get_option(keep_alive);
+        ASSERT_TRUE(keep_alive.value());
+
+        std::promise<void> reclosed;
+        packio::net::post(this->io_, [&] {
+            this->client_->socket().close();
+            reclosed.set_value();
+        });
+        reclosed.get_future().wait();
+        auto f_connect = this->client_->async_connect(
+            this->server_->acceptor().local_endpoint(), use_future);
+        ASSERT_FUTURE_NO_THROW(f_connect);
+        f_echo = this->client_->async_call("echo", std::tuple{"c"}, use_future);
+        ASSERT_RESULT_EQ(f_echo, "c"s);
+        this->client_->socket().get_option(keep_alive);
+        ASSERT_TRUE(keep_alive.value());
+    }
+}
+
+TYPED_TEST(Test, test_socket_timestamping)
+{
+    using socket_type = typename TestFixture::socket_type;
+    constexpr std::size_t kCalls = 20;
+
+    this->server_->set_socket_timestamping(true);
+    this->server_->async_serve_forever();
+    this->server_->dispatcher()->add("add", [](int a, int b) { return a + b; });
+    this->connect();
+    this->client_->set_socket_timestamping(true);
+    this->async_run();
+
+    for (int i = 0; i < static_cast<int>(kCalls); ++i) {
+        auto f = this->client_->async_call("add", std::tuple{i, 1}, use_future);
+        ASSERT_RESULT_EQ(f, i + 1);
+    }
+
+    // the response is written after the handler of its call is called
+    auto deadline = std::chrono::steady_clock::now() + 1s;
+    while (this->server_->get_latency_breakdown().response_to_write.count()
+               != kCalls
+           && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(1ms);
+    }
+    auto server = this->server_->get_latency_breakdown();
+    ASSERT_EQ(kCalls, server.response_to_write.count());
+    ASSERT_EQ(kCalls, server.read_to_dispatch.count());
+    ASSERT_EQ(kCalls, server.dispatch_to_response.count());
+    ASSERT_LE(
+        server.dispatch_to_response.quantile(0.5),
+        server.dispatch_to_response.quantile(1.0));
+
+    auto client = this->client_->get_latency_breakdown();
+    ASSERT_EQ(kCalls, client.read_to_dispatch.count());
+    ASSERT_EQ(0u, client.dispatch_to_response.count());
+
+#if defined(__linux__)
+    // kernel timestamps are only supported by TCP sockets
+    if constexpr (std::is_same_v<socket_type, packio::net::ip::tcp::socket>) {
+        ASSERT_LT(0u, server.kernel_to_read.count());
+        ASSERT_LT(0u, client.kernel_to_read.count());
+        ASSERT_LT(0u, server.write_to_kernel.count());
+        ASSERT_LT(0u, client.write_to_kernel.count());
+    }
+#endif // defined(__linux__)
+}
+
+TYPED_TEST(Test, test_trace_context)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    using ids_type = std::vector<uint64_t>;
+
+    using client_type = typename TestFixture::client_type;
+    using socket_type = typename TestFixture::socket_type;
+
+    std::atomic<int> traced_completed{0};
+    this->server_->set_trace_handler([&](const trace_context& trace, auto) {
+        ASSERT_TRUE(trace.valid());
+        ++traced_completed;
+    });
+    this->server_->async_serve_forever();
+    this->connect();
+    this->async_run();
+
+    auto other_client = std::make_shared<client_type>(socket_type{this->io_});
+    other_client->socket().connect(this->server_->acceptor().local_endpoint());
+
+    auto to_ids = [](const trace_context& trace) {
+        return ids_type{trace.trace_id, trace.span_id, trace.parent_span_id};
+    };
+    this->server_->dispatcher()->add(
+        "inner", [&]() { return to_ids(this_trace_context()); });
+    // the nested call carries the context of the outer request
+    this->server_->dispatcher()->add_async(
+        "outer", [&](completion_handler handler) {
+            auto outer = to_ids(this_trace_context());
+            other_client->async_call(
+                "inner",
+                [handler = std::move(handler), outer](auto ec, auto res) mutable {
+                    ASSERT_FALSE(ec);
+                    auto ids = outer;
+                    auto inner = get<ids_type>(res.result);
+                    ids.insert(ids.end(), inner.begin(), inner.end());
+                    handler(ids);
+                });
+        });
+
+    {
+        auto f = this->client_->async_call("inner", use_future);
+        ASSERT_RESULT_EQ(f, (ids_type{0, 0, 0}));
+        ASSERT_EQ(0, traced_completed.load());
+    }
+
+    {
+        auto root = trace_context::new_trace();
+        auto f = [&] {
+            scoped_trace_context scope{root};
+            return this->client_->async_call("outer", use_future);
+        }();
+        ASSERT_FALSE(this_trace_context().valid());
+
+        auto ids = get<ids_type>(safe_future_get(f).result);
+        ASSERT_EQ(6u, ids.size());
+        ASSERT_EQ(root.trace_id, ids[0]);
+        ASSERT_NE(root.span_id, ids[1]);
+        ASSERT_EQ(root.span_id, ids[2]);
+        ASSERT_EQ(root.trace_id, ids[3]);
+        ASSERT_NE(ids[1], ids[4]);
+        ASSERT_EQ(ids[1], ids[5]);
+
+        auto deadline = std::chrono::steady_clock::now() + 1s;
+        while (traced_completed.load() != 2
+               && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(1ms);
+        }
+        ASSERT_EQ(2, traced_completed.load());
+    }
+
+    // unsampled contexts are not propagated
+    {
+        scoped_trace_context scope{trace_context::new_trace(false)};
+        auto f = this->client_->async_call("inner", use_future);
+        ASSERT_RESULT_EQ(f, (ids_type{0, 0, 0}));
+    }
+}
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+TYPED_TEST(Test, test_memory_resource)
+{
+    using completion_handler =
+        typename std::decay_t<decltype(*this)>::completion_handler;
+    // sessions may outlive the test body
+    static counting_resource server_resource;
+    static counting_resource client_resource;
+
+    this->server_->set_memory_resource(&server_resource);
+    this->client_->set_memory_resource(&client_resource);
+    ASSERT_EQ(&server_resource, this->server_->get_memory_resource());
+    ASSERT_EQ(&client_resource, this->client_->get_memory_resource());
+
+    this->server_->dispatcher()->add("add", [](int a, int b) { return a + b; });
+    this->server_->async_serve_forever();
+    this->connect();
+    this->async_run();
+
+    server_resource.allocations = 0;
+    client_resource.allocations = 0;
+    auto f = this->client_->async_call("add", std::tuple{12, 23}, use_future);
+    ASSERT_RESULT_EQ(f, 35);
+    ASSERT_GT(server_resource.allocations.load(), 0);
+    ASSERT_GT(client_resource.allocations.load(), 0);
+
+    // completion handlers keep their state in the resource until they
+    // complete, or until they are dropped
+    std::optional<completion_handler> held;
+    latch holding{1};
+    this->server_->dispatcher()->add_async(
+        "hold", [&](completion_handler handler) {
+            held.emplace(std::move(handler));
+            holding.count_down();
+        });
+    this->server_->dispatcher()->add_async("drop", [](completion_handler) {});
+
+    auto held_call = this->client_->async_call("hold", use_future);
+    ASSERT_TRUE(holding.wait_for(1s));
+    ASSERT_FUTURE_BLOCKS(held_call, 10ms);
+    held->set_value(42);
+    ASSERT_RESULT_EQ(held_call, 42);
+    auto dropped_call = this->client_->async_call("drop", use_future);
+    ASSERT_RESULT_IS_ERROR(dropped_call);
+}
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
 TYPED_TEST(Test, test_errors)
 {
     using completion_handler =
@@ -830,5 +1960,19 @@ TYPED_TEST(Test, test_coroutine)
         },
         detached);
     ASSERT_FUTURE_NO_THROW(p.get_future());
+
+    // the trace context is kept across suspensions
+    this->server_->dispatcher()->add_coro(
+        "trace_id", this->io_, [&]() -> awaitable<uint64_t> {
+            timer.expires_after(1ms);
+            co_await timer.async_wait(use_awaitable);
+            co_return this_trace_context().trace_id;
+        });
+    auto root = trace_context::new_trace();
+    auto f = [&] {
+        scoped_trace_context scope{root};
+        return this->client_->async_call("trace_id", use_future);
+    }();
+    ASSERT_RESULT_EQ(f, root.trace_id);
 }
 #endif // defined(PACKIO_HAS_CO_AWAIT) || defined(PACKIO_FORCE_COROUTINES)
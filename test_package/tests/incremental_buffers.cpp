@@ -1,7 +1,18 @@
 
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include <nlohmann/json.hpp>
 
+#include <packio/compression.h>
+#include <packio/internal/base64.h>
+#include <packio/internal/frame.h>
+#include <packio/nl_json_rpc/fast_json.h>
 #include <packio/nl_json_rpc/incremental_buffers.h>
 
 using namespace packio::nl_json_rpc;
@@ -122,3 +133,336 @@ TEST(TestParser, test_partial_feed_complex)
         pos += feed_size;
     }
 }
+
+TEST(TestParser, test_feed_token_boundaries)
+{
+    const nlohmann::json obj = {
+        {"items", {{{"result", 1}}, {{"result", 2}}, {{"error", "\"}"}}}}};
+    const std::string serialized = obj.dump() + obj.dump();
+
+    // every chunk size makes some chunks start with a token
+    for (std::size_t chunk_size = 1; chunk_size < serialized.size();
+         ++chunk_size) {
+        incremental_buffers parser;
+        for (std::size_t pos = 0; pos < serialized.size(); pos += chunk_size) {
+            parser.feed(serialized.substr(pos, chunk_size));
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            auto buffer = parser.get_parsed_buffer();
+            ASSERT_TRUE(buffer);
+            ASSERT_EQ(nlohmann::json::parse(*buffer), obj);
+        }
+        ASSERT_FALSE(parser.get_parsed_buffer());
+    }
+}
+
+TEST(TestParser, test_max_message_size)
+{
+    const nlohmann::json obj = {{"key", 42}, {"nested", {"key", 12}}};
+    const std::string serialized = obj.dump();
+
+    {
+        incremental_buffers parser{serialized.size()};
+        parser.feed(serialized);
+        auto buffer = parser.get_parsed_buffer();
+        ASSERT_TRUE(buffer);
+        ASSERT_EQ(nlohmann::json::parse(*buffer), obj);
+        ASSERT_FALSE(parser.message_size_exceeded());
+    }
+
+    {
+        incremental_buffers parser{serialized.size() - 1};
+        parser.feed(serialized);
+        ASSERT_FALSE(parser.get_parsed_buffer());
+        ASSERT_TRUE(parser.message_size_exceeded());
+    }
+
+    {
+        // endless object, rejected before the whole message is buffered
+        incremental_buffers parser{64};
+        parser.feed("{\"key\": \"");
+        for (int i = 0; i < 100; ++i) {
+            parser.feed("0123456789");
+            if (parser.message_size_exceeded()) {
+                break;
+            }
+        }
+        ASSERT_TRUE(parser.message_size_exceeded());
+        ASSERT_FALSE(parser.get_parsed_buffer());
+        ASSERT_EQ(0u, parser.in_place_buffer_capacity());
+    }
+}
+
+TEST(TestParser, test_compressed_frames)
+{
+    const nlohmann::json obj = {{"key", 42}, {"nested", {"key", 12}}};
+    // the payload of a frame is not parsed
+    const std::string frame = packio::internal::make_frame(1, "}{\"[", 42);
+    const std::string serialized = obj.dump() + frame + " " + obj.dump()
+                                   + packio::internal::make_announcement_frame(1);
+
+    for (std::size_t chunk_size = 1; chunk_size < serialized.size();
+         ++chunk_size) {
+        incremental_buffers parser;
+        for (std::size_t pos = 0; pos < serialized.size(); pos += chunk_size) {
+            parser.feed(serialized.substr(pos, chunk_size));
+        }
+
+        auto buffer = parser.get_parsed_buffer();
+        ASSERT_TRUE(buffer);
+        ASSERT_EQ(nlohmann::json::parse(*buffer), obj);
+        ASSERT_EQ(parser.get_parsed_buffer(), frame);
+        buffer = parser.get_parsed_buffer();
+        ASSERT_TRUE(buffer);
+        ASSERT_EQ(nlohmann::json::parse(*buffer), obj);
+        buffer = parser.get_parsed_buffer();
+        ASSERT_TRUE(buffer);
+        auto header = packio::internal::parse_frame_header(*buffer);
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header->is_announcement());
+        ASSERT_FALSE(parser.get_parsed_buffer());
+    }
+}
+
+TEST(TestFrame, test_fragment_lying_size)
+{
+    using packio::internal::fragment_assembler;
+    using packio::internal::make_fragment_header;
+    constexpr std::size_t kLyingSize = 0xffffffff;
+
+    // the message grows with the fragments, not with the advertised size
+    fragment_assembler fragments;
+    ASSERT_EQ(
+        fragment_assembler::status::incomplete,
+        fragments.add(
+            make_fragment_header(4, kLyingSize) + "abcd", kLyingSize));
+    ASSERT_LT(fragments.capacity(), 1024u);
+
+    // all the fragments of a message advertise the same size
+    ASSERT_EQ(
+        fragment_assembler::status::error,
+        fragments.add(make_fragment_header(4, 8) + "efgh", kLyingSize));
+
+    fragment_assembler other;
+    ASSERT_EQ(
+        fragment_assembler::status::incomplete,
+        other.add(make_fragment_header(4, 8) + "abcd", 8));
+    ASSERT_EQ(
+        fragment_assembler::status::complete,
+        other.add(make_fragment_header(4, 8) + "efgh", 8));
+    ASSERT_EQ("abcdefgh", other.take());
+}
+
+TEST(TestFrame, test_compressed_lying_size)
+{
+    using packio::internal::decompress_frame;
+    using packio::internal::make_frame;
+
+    std::optional<std::size_t> decompressed_size;
+    packio::compression_codec codec;
+    codec.id = 1;
+    codec.decompress = [&](std::string_view, std::size_t original_size) {
+        decompressed_size = original_size;
+        return std::optional<std::string>{std::string(original_size, 'a')};
+    };
+    constexpr auto max = std::numeric_limits<std::size_t>::max();
+
+    // the advertised size is bounded by the expansion ratio of the codec
+    ASSERT_FALSE(
+        decompress_frame(make_frame(1, "abcd", 0xffffffff), codec, max));
+    ASSERT_FALSE(decompress_frame(
+        make_frame(1, "abcd", 4 * packio::kDefaultMaxExpansion + 1),
+        codec,
+        max));
+    ASSERT_FALSE(decompressed_size);
+    ASSERT_TRUE(decompress_frame(
+        make_frame(1, "abcd", 4 * packio::kDefaultMaxExpansion), codec, max));
+    ASSERT_EQ(4 * packio::kDefaultMaxExpansion, decompressed_size);
+
+    // and by the maximum message size
+    decompressed_size.reset();
+    ASSERT_FALSE(decompress_frame(make_frame(1, "abcd", 1024), codec, 1023));
+    ASSERT_FALSE(decompressed_size);
+
+    codec.max_expansion = 2;
+    ASSERT_FALSE(decompress_frame(make_frame(1, "abcd", 9), codec, max));
+    ASSERT_TRUE(decompress_frame(make_frame(1, "abcd", 8), codec, max));
+}
+
+namespace {
+
+// message of the nlohmann exception thrown by f, empty if none
+template <typename F>
+std::string exception_message(F&& f)
+{
+    try {
+        f();
+    }
+    catch (const nlohmann::json::exception& exc) {
+        return exc.what();
+    }
+    return {};
+}
+
+} // namespace
+
+TEST(TestFastJson, test_dump_same_as_nlohmann)
+{
+    std::string all_ascii;
+    for (int c = 0; c < 0x80; ++c) {
+        all_ascii.push_back(static_cast<char>(c));
+    }
+    std::vector<nlohmann::json> values = {
+        nullptr,
+        true,
+        false,
+        0,
+        -42,
+        std::numeric_limits<int64_t>::min(),
+        std::numeric_limits<uint64_t>::max(),
+        0.1,
+        -1.5e300,
+        "",
+        all_ascii,
+        "h\u00e9llo w\u00f6rld \u2603 \U0001f600",
+        nlohmann::json::object(),
+        nlohmann::json::array(),
+        {{"key", {1, "two", 3.0}}, {"\"quoted\"\n", {{"a", nullptr}}}},
+    };
+    // a special character at every position of the vectorized chunks
+    for (char special : {'"', '\\', '\n', '\x01', '\x7f'}) {
+        for (std::size_t size = 1; size < 70; ++size) {
+            std::string str(size, 'a');
+            str[size - 1] = special;
+            values.push_back(str);
+            str[size / 2] = special;
+            values.push_back(str);
+        }
+    }
+
+    for (const auto& value : values) {
+        ASSERT_EQ(value.dump(), packio::nl_json_rpc::internal::dump(value));
+    }
+}
+
+TEST(TestFastJson, test_parse_same_as_nlohmann)
+{
+    const std::vector<std::string> inputs = {
+        " { \"a\" : [ 1 , -2 , 3.5e1 , true , false , null ] } ",
+        R"("escapes \" \\ \/ \b \f \n \r \t \u00e9 \u2603 \ud83d\ude00")",
+        R"({"dup": 1, "dup": 2})",
+        "[18446744073709551615, 18446744073709551616, -9223372036854775809]",
+        "[0, -0, 0.0, 1E2, 1e-2, 1.25e+3]",
+        "\"h\xc3\xa9llo \xe2\x98\x83 \xf0\x9f\x98\x80\"",
+        std::string(300, '[') + std::string(300, ']'),
+    };
+    for (const auto& input : inputs) {
+        ASSERT_EQ(
+            nlohmann::json::parse(input),
+            packio::nl_json_rpc::internal::parse(input));
+    }
+
+    // invalid inputs throw the same exceptions
+    const std::vector<std::string> invalid_inputs = {
+        "",
+        "[1, 2",
+        "{\"a\" 1}",
+        "[01]",
+        "1e999",
+        "\"\\ud83d\"",
+        "\"\\udc00\"",
+        "\"\\x\"",
+        "\"\x01\"",
+        "\"\xc0\xaf\"",
+        "\"\xed\xa0\x80\"",
+        "[] []",
+    };
+    for (const auto& input : invalid_inputs) {
+        auto expected = exception_message(
+            [&] { return nlohmann::json::parse(input); });
+        ASSERT_FALSE(expected.empty()) << input;
+        ASSERT_EQ(
+            expected,
+            exception_message(
+                [&] { return packio::nl_json_rpc::internal::parse(input); }));
+    }
+}
+
+TEST(TestFastJson, test_dump_invalid_utf8)
+{
+    const nlohmann::json value = {{"key", std::string(40, 'a') + "\xff"}};
+    auto expected = exception_message([&] { return value.dump(); });
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(
+        expected,
+        exception_message(
+            [&] { return packio::nl_json_rpc::internal::dump(value); }));
+}
+
+TEST(TestBase64, test_encode_decode)
+{
+    using namespace packio::internal;
+
+    auto encode = [](std::string_view data) {
+        std::string encoded(base64_encoded_size(data.size()), '\0');
+        base64_encode(
+            reinterpret_cast<const uint8_t*>(data.data()),
+            data.size(),
+            encoded.data());
+        return encoded;
+    };
+    auto decode = [](std::string_view encoded) -> std::optional<std::string> {
+        auto size = base64_decoded_size(encoded);
+        if (!size) {
+            return std::nullopt;
+        }
+        std::string data(*size, '\0');
+        if (!base64_decode(
+                encoded, reinterpret_cast<uint8_t*>(data.data()))) {
+            return std::nullopt;
+        }
+        return data;
+    };
+
+    // RFC 4648 test vectors
+    const std::pair<std::string, std::string> vectors[] = {
+        {"", ""},
+        {"f", "Zg=="},
+        {"fo", "Zm8="},
+        {"foo", "Zm9v"},
+        {"foob", "Zm9vYg=="},
+        {"fooba", "Zm9vYmE="},
+        {"foobar", "Zm9vYmFy"},
+    };
+    for (const auto& [data, encoded] : vectors) {
+        ASSERT_EQ(encoded, encode(data));
+        ASSERT_EQ(data, decode(encoded));
+    }
+
+    // every byte value, at every position of the vectorized blocks
+    for (std::size_t size = 0; size < 300; ++size) {
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i) {
+            data[i] = static_cast<char>((i * 131 + size) % 256);
+        }
+        const std::string encoded = encode(data);
+        ASSERT_EQ(data, decode(encoded));
+        for (std::size_t pos = 0; pos < encoded.size(); pos += 7) {
+            for (char invalid : {'!', '=', '\x80', '\0'}) {
+                // padding in the last group is valid
+                if (encoded[pos] == '='
+                    || (invalid == '=' && pos + 4 >= encoded.size())) {
+                    continue;
+                }
+                std::string corrupted = encoded;
+                corrupted[pos] = invalid;
+                ASSERT_FALSE(decode(corrupted)) << corrupted;
+            }
+        }
+    }
+
+    ASSERT_FALSE(decode("Zm9"));
+    ASSERT_FALSE(decode("Z==="));
+    ASSERT_FALSE(decode("Zg==Zm9v"));
+}
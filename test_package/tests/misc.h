@@ -102,6 +102,31 @@ using my_unordered_map = std::unordered_map<
     std::equal_to<Key>,
     my_allocator<std::pair<const Key, T>>>;
 
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+class counting_resource : public std::pmr::memory_resource {
+public:
+    std::atomic<int> allocations{0};
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(
+        void* p,
+        std::size_t bytes,
+        std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
 template <typename T>
 T get(const ::msgpack::object& value)
 {
@@ -124,6 +149,38 @@ inline std::string get_error_message(const ::nlohmann::json& error)
     return error["message"].get<std::string>();
 }
 
+inline std::size_t get_map_size(const ::msgpack::object& items)
+{
+    return items.via.array.size;
+}
+
+inline std::size_t get_map_size(const ::nlohmann::json& items)
+{
+    return items.size();
+}
+
+template <typename T>
+T get_map_result(const ::msgpack::object& items, std::size_t i)
+{
+    return items.via.array.ptr[i].via.array.ptr[1].as<T>();
+}
+
+template <typename T>
+T get_map_result(const ::nlohmann::json& items, std::size_t i)
+{
+    return items.at(i).at("result").get<T>();
+}
+
+inline bool is_map_error(const ::msgpack::object& items, std::size_t i)
+{
+    return !items.via.array.ptr[i].via.array.ptr[0].is_nil();
+}
+
+inline bool is_map_error(const ::nlohmann::json& items, std::size_t i)
+{
+    return items.at(i).contains("error");
+}
+
 inline bool is_error_response(const packio::msgpack_rpc::rpc::response_type& resp)
 {
     return resp.result.is_nil() && !resp.error.is_nil();
@@ -1,6 +1,11 @@
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <future>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -178,3 +183,309 @@ TYPED_TEST(Server, test_many_func)
     ASSERT_TRUE(done.wait_for(10s));
     ASSERT_TRUE(calls.wait_for(10s));
 }
+
+TYPED_TEST(Server, test_io_context_pool)
+{
+    using server_type = typename TestFixture::server_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    constexpr int kNClients = 8;
+
+    io_context_pool pool{io_context_pool::granularity::core, 1};
+    ASSERT_LT(0u, pool.size());
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+        ASSERT_FALSE(pool.get_cpus(i).empty());
+    }
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    // the memory of the contexts is bound to their node, or left to the OS
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+        auto* resource = pool.get_memory_resource(i);
+        void* big = resource->allocate(1 << 20);
+        std::memset(big, 0x42, 1 << 20);
+        void* small = resource->allocate(24);
+        std::memset(small, 0x42, 24);
+        resource->deallocate(small, 24);
+        resource->deallocate(big, 1 << 20);
+    }
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    // the server must not outlive the memory resources of the pool
+    auto server = std::make_shared<server_type>(acceptor_type(
+        pool.get_io_context(0), get_endpoint<endpoint_type>()));
+    pool.place_sessions(*server);
+    server->dispatcher()->add("context", [&]() {
+        for (std::size_t i = 0; i < pool.size(); ++i) {
+            if (pool.get_executor(i).running_in_this_thread()) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    });
+    server->async_serve_forever();
+
+    pool.run();
+    this->run(1);
+
+    // sessions are placed round-robin on the contexts of the pool
+    auto clients = this->create_clients(kNClients);
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        clients[i]->socket().connect(server->acceptor().local_endpoint());
+        auto f = clients[i]->async_call("context", use_future);
+        ASSERT_RESULT_EQ(f, static_cast<int>(i % pool.size()));
+    }
+}
+
+TYPED_TEST(Server, test_work_stealing_pool)
+{
+    constexpr int kNCalls{100};
+    constexpr int kNClients{4};
+
+    work_stealing_pool pool{4};
+    ASSERT_EQ(4u, pool.size());
+    auto pool_executor = pool.get_executor();
+    ASSERT_FALSE(pool_executor.running_in_this_thread());
+
+    {
+        // work posted from a worker is queued on it, the other workers
+        // steal it while this one is busy
+        auto stolen = std::make_shared<latch>(kNCalls);
+        auto ran_on_owner = std::make_shared<std::atomic<bool>>(false);
+        pool.post([&pool, stolen, ran_on_owner] {
+            const auto owner = std::this_thread::get_id();
+            for (int i = 0; i < kNCalls; ++i) {
+                pool.post([stolen, ran_on_owner, owner] {
+                    if (std::this_thread::get_id() == owner) {
+                        *ran_on_owner = true;
+                    }
+                    stolen->count_down();
+                });
+            }
+            stolen->wait_for(10s);
+        });
+        ASSERT_TRUE(stolen->wait_for(10s));
+        ASSERT_FALSE(ran_on_owner->load());
+    }
+
+    using server_type = typename TestFixture::server_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    auto server = std::make_shared<server_type>(
+        acceptor_type(this->io_, get_endpoint<endpoint_type>()));
+    server->set_procedure_executor(pool_executor);
+    server->dispatcher()->add("on_pool", [&](int n) {
+        if (!pool_executor.running_in_this_thread()) {
+            return -1;
+        }
+        return n;
+    });
+    server->async_serve_forever();
+
+    this->run(2);
+
+    latch done{kNCalls * kNClients};
+    auto clients = this->create_clients(kNClients);
+    for (auto& client : clients) {
+        client->socket().connect(server->acceptor().local_endpoint());
+    }
+    for (int i = 0; i < kNCalls; ++i) {
+        for (auto& client : clients) {
+            client->async_call(
+                "on_pool", std::tuple{i}, [&, i](auto ec, auto res) {
+                    ASSERT_FALSE(ec);
+                    ASSERT_EQ(i, get<int>(res.result));
+                    done.count_down();
+                });
+        }
+    }
+    ASSERT_TRUE(done.wait_for(10s));
+}
+
+TYPED_TEST(Server, test_session_migration)
+{
+    using server_type = typename TestFixture::server_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+    // sessions may outlive the test body
+    static counting_resource resource1;
+    static counting_resource resource2;
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+
+    io_context io1;
+    io_context io2;
+    auto work1 = make_work_guard(io1);
+    auto work2 = make_work_guard(io2);
+    std::thread runner1{[&] { io1.run(); }};
+    std::thread runner2{[&] { io2.run(); }};
+
+    [&] {
+        auto server = std::make_shared<server_type>(
+            acceptor_type(this->io_, get_endpoint<endpoint_type>()));
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+        server->add_session_executor(io1.get_executor(), &resource1);
+        server->add_session_executor(io2.get_executor(), &resource2);
+#else // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        server->add_session_executor(io1.get_executor());
+        server->add_session_executor(io2.get_executor());
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+        server->dispatcher()->add("context", [&]() {
+            return io1.get_executor().running_in_this_thread() ? 1 : 2;
+        });
+        server->async_serve_forever();
+        this->run(1);
+
+        // sessions are placed on io1, io2 then io1
+        auto clients = this->create_clients(3);
+        for (auto& client : clients) {
+            client->socket().connect(server->acceptor().local_endpoint());
+        }
+        auto call = [&](auto& client) {
+            auto f = client->async_call("context", use_future);
+            return get<int>(safe_future_get(f).result);
+        };
+        ASSERT_EQ(1, call(clients[0]));
+        ASSERT_EQ(2, call(clients[1]));
+        ASSERT_EQ(1, call(clients[2]));
+
+        // load io1 only, one of its sessions must move to io2
+        server->start_load_balancing(20ms);
+        bool migrated = false;
+        auto deadline = std::chrono::steady_clock::now() + 5s;
+        while (!migrated && std::chrono::steady_clock::now() < deadline) {
+            int c0 = call(clients[0]);
+            int c2 = call(clients[2]);
+            migrated = c0 != c2;
+        }
+        server->stop_load_balancing();
+        ASSERT_TRUE(migrated);
+
+        // migrated sessions keep working
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_NE(call(clients[0]), call(clients[2]));
+        }
+
+#if defined(PACKIO_HAS_MEMORY_RESOURCE)
+        // and allocate from the resource of their new executor
+        auto& moved = call(clients[0]) == 2 ? clients[0] : clients[2];
+        const int allocations1 = resource1.allocations.load();
+        const int allocations2 = resource2.allocations.load();
+        for (int i = 0; i < 10; ++i) {
+            ASSERT_EQ(2, call(moved));
+        }
+        ASSERT_EQ(allocations1, resource1.allocations.load());
+        ASSERT_LT(allocations2, resource2.allocations.load());
+#endif // defined(PACKIO_HAS_MEMORY_RESOURCE)
+    }();
+
+    work1.reset();
+    work2.reset();
+    io1.stop();
+    io2.stop();
+    runner1.join();
+    runner2.join();
+}
+
+TYPED_TEST(Server, test_sequential_execution)
+{
+    using server_type = typename TestFixture::server_type;
+    using endpoint_type = typename TestFixture::endpoint_type;
+    using acceptor_type = typename TestFixture::acceptor_type;
+    constexpr int kNCalls{100};
+    constexpr int kNClients{4};
+
+    auto server = std::make_shared<server_type>(
+        acceptor_type(this->io_, get_endpoint<endpoint_type>()));
+    server->set_sequential_execution(true);
+    ASSERT_TRUE(server->get_sequential_execution());
+
+    std::vector<std::vector<int>> received(kNClients);
+    std::vector<std::atomic<int>> running(kNClients);
+    std::atomic<bool> overlapped{false};
+    server->dispatcher()->add_async(
+        "append",
+        [&](packio::msgpack_rpc::completion_handler handler, int client, int i) {
+            if (running[client].fetch_add(1) != 0) {
+                overlapped = true;
+            }
+            received[client].push_back(i);
+            // complete later, from another handler
+            post(this->io_, [&, client, handler = std::move(handler)]() mutable {
+                running[client].fetch_sub(1);
+                handler();
+            });
+        });
+    server->async_serve_forever();
+
+    this->run(8);
+
+    latch done{kNCalls * kNClients};
+    auto clients = this->create_clients(kNClients);
+    for (auto& client : clients) {
+        client->socket().connect(server->acceptor().local_endpoint());
+    }
+    for (int i = 0; i < kNCalls; ++i) {
+        for (int c = 0; c < kNClients; ++c) {
+            clients[c]->async_call(
+                "append", std::tuple{c, i}, [&](auto ec, auto) {
+                    ASSERT_FALSE(ec);
+                    done.count_down();
+                });
+        }
+    }
+    ASSERT_TRUE(done.wait_for(10s));
+    ASSERT_FALSE(overlapped);
+
+    std::vector<int> expected(kNCalls);
+    std::iota(expected.begin(), expected.end(), 0);
+    for (const auto& r : received) {
+        ASSERT_EQ(expected, r);
+    }
+}
+
+TYPED_TEST(Server, test_contention_profile)
+{
+    constexpr int kNCalls{100};
+    constexpr int kNClients{4};
+
+    this->server_->dispatcher()->add("echo", [](int i) { return i; });
+    this->run(4);
+
+    latch done{kNCalls * kNClients};
+    auto clients = this->create_clients(kNClients);
+    for (auto& client : clients) {
+        client->socket().connect(this->local_endpoint());
+    }
+    packio::reset_contention_profile();
+    for (int i = 0; i < kNCalls; ++i) {
+        for (auto& client : clients) {
+            client->async_call("echo", std::tuple{i}, [&](auto ec, auto) {
+                ASSERT_FALSE(ec);
+                done.count_down();
+            });
+        }
+    }
+    ASSERT_TRUE(done.wait_for(10s));
+
+    auto profile = packio::get_contention_profile();
+#if defined(PACKIO_CONTENTION_PROFILING)
+    const uint64_t calls = kNCalls * kNClients;
+    ASSERT_LE(calls, profile.dispatcher_mutex.acquisitions);
+    ASSERT_LE(
+        profile.dispatcher_mutex.contended,
+        profile.dispatcher_mutex.acquisitions);
+    ASSERT_LE(calls, profile.dispatcher_mutex.hold.count());
+    // requests and responses
+    ASSERT_LE(2 * calls, profile.write_strand.dispatches);
+    ASSERT_LE(1u, profile.write_strand.max_depth);
+    ASSERT_LE(
+        profile.write_strand.dispatches,
+        profile.write_strand.total_depth);
+    ASSERT_LE(calls, profile.call_strand.dispatches);
+    ASSERT_LE(calls, profile.call_strand.wait.count());
+#else // defined(PACKIO_CONTENTION_PROFILING)
+    ASSERT_EQ(0u, profile.dispatcher_mutex.acquisitions);
+    ASSERT_EQ(0u, profile.write_strand.dispatches);
+    ASSERT_EQ(0u, profile.call_strand.dispatches);
+#endif // defined(PACKIO_CONTENTION_PROFILING)
+}